@@ -0,0 +1,267 @@
+/**
+ * Headless benchmarks of the kernels, band scheduling and image encoders,
+ * reported as JSON for comparing builds:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ra/band_renderer.hpp"
+#include "ra/henon.hpp"
+#include "ra/png.hpp"
+#include "ra/pnm.hpp"
+#include "ra/thread_pool.hpp"
+
+using ra::fractal_logic::henon_map;
+using ra::fractal_logic::band_view;
+
+namespace {
+
+    /**
+     * A fixed view, so results of different builds are comparable
+     */
+    struct scenario {
+        const char * name;
+        const char * fractal;
+        long double a, b;
+        long double min_x, max_x, min_y, max_y;
+        int threshold;
+        int max_its;
+        int width, height;
+
+        henon_map<long double> map() const {
+            henon_map<long double> m(a, b, min_x, max_x, min_y, max_y, threshold, max_its, width, height);
+            if(!m.set_fractal_type(fractal)) {
+                throw std::invalid_argument(std::string("Unknown fractal type ") + fractal);
+            }
+            return m;
+        }
+    };
+
+    const scenario scenarios[] = {
+        {"henon_default", "henon", 0.2L, 0.9991L, -5, 5, -5, 5, 512, 512, 512, 512},
+        {"henon_classic", "henon", 1.4L, 0.3L, -2, 2, -2, 2, 512, 512, 512, 512},
+        {"henon_classic_expr", "expr:1 - a*x^2 + y, b*x", 1.4L, 0.3L, -2, 2, -2, 2, 512, 512, 512, 512},
+        {"mandelbrot_classic", "mandelbrot", 0, 0, -2, 1, -1.25L, 1.25L, 2, 256, 640, 480},
+        {"mandelbrot_classic_hd", "mandelbrot", 0, 0, -2, 1, -1.25L, 1.25L, 2, 1024, 1280, 960},
+        {"mandelbrot_seahorse", "mandelbrot", 0, 0, -0.7480L, -0.7440L, 0.0980L, 0.1010L, 2, 1024, 640, 480},
+        {"mandelbrot_deep", "mandelbrot", 0, 0, -0.743643900L, -0.743643800L, 0.131825880L, 0.131825955L, 2, 8192, 320, 240},
+        {"burningship", "burningship", 0, 0, -2.2L, 1.3L, -2.0L, 1.0L, 2, 512, 640, 480},
+    };
+
+    const scenario& find_scenario(const std::string& name) {
+        return *std::find_if(std::begin(scenarios), std::end(scenarios), [&](const scenario& s) {return s.name == name;});
+    }
+
+    /**
+     * Band sink which sums iteration counts instead of encoding
+     */
+    struct counting_sink {
+        using chunk_type = std::uint64_t;
+
+        void begin(int, int, int) {iterations = 0;}
+
+        chunk_type encode(const band_view& band) const {
+            std::uint64_t sum = 0;
+            for(int i=0; i<band.num_rows*band.width; ++i) {
+                sum += band.its[i];
+            }
+            return sum;
+        }
+
+        void write(chunk_type&& sum) {iterations += sum;}
+        void end() {}
+
+        std::uint64_t iterations = 0;
+    };
+
+    struct timing {
+        double best;        //Fastest repeat, seconds
+        double median;
+        std::uint64_t iterations;
+    };
+
+    template<class RUN>
+    timing time_runs(int repeats, RUN&& run) {
+        std::vector<double> seconds;
+        std::uint64_t iterations = 0;
+        for(int r=0; r<repeats; ++r) {
+            auto start = std::chrono::steady_clock::now();
+            iterations = run();
+            seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        std::sort(seconds.begin(), seconds.end());
+        return {seconds.front(), seconds[seconds.size()/2], iterations};
+    }
+
+    timing time_render(const henon_map<long double>& map, ra::concurrency::thread_pool& pool, int band_height, int repeats) {
+        return time_runs(repeats, [&]() {
+            counting_sink sink;
+            ra::fractal_logic::band_renderer<long double>(map, pool, band_height).render(sink);
+            return sink.iterations;
+        });
+    }
+
+    std::string json_string(const std::string& s) {
+        std::string out = "\"";
+        for(char c: s) {
+            if(c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    int usage(const char * name) {
+        std::cerr << "Usage: " << name << " <options>\n"
+            << "Options:\n"
+            << "\t-r [repeats]\tTimed repeats of each measurement, the fastest is reported (default 3)\n"
+            << "\t-j [threads]\tLargest thread count of the scaling runs (0 for all hardware threads)\n"
+            << "\t-s [name]\tOnly scenarios whose name contains this\n";
+        return -1;
+    }
+}
+
+int main(int argc, char ** argv) {
+    int repeats = 3;
+    unsigned max_threads = 0;
+    std::string filter;
+
+    for(int i=1; i<argc; i+=2) {
+        const std::string option = argv[i];
+        if(i+1 >= argc) return usage(argv[0]);
+        if(option == "-r") {
+            repeats = std::max(1, std::atoi(argv[i+1]));
+        } else if(option == "-j") {
+            max_threads = std::max(0, std::atoi(argv[i+1]));
+        } else if(option == "-s") {
+            filter = argv[i+1];
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if(max_threads == 0) {
+        max_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::ostringstream json;
+    json << std::setprecision(6);
+    json << "{\n  \"build\": {\"compiler\": " << json_string(__VERSION__)
+        << ", \"optimized\": "
+#ifdef __OPTIMIZE__
+        << "true"
+#else
+        << "false"
+#endif
+        << ", \"hardware_threads\": " << std::thread::hardware_concurrency()
+        << ", \"max_threads\": " << max_threads << ", \"repeats\": " << repeats << "},\n";
+
+    ra::concurrency::thread_pool pool(max_threads);
+
+    //Kernels: each scenario on all threads with the default band height
+    json << "  \"scenarios\": [";
+    bool first = true;
+    for(const auto& s: scenarios) {
+        if(std::string(s.name).find(filter) == std::string::npos) continue;
+        std::cerr << "Scenario " << s.name << std::endl;
+
+        auto map = s.map();
+        auto t = time_render(map, pool, 16, repeats);
+        const double pixels = static_cast<double>(s.width)*s.height;
+
+        json << (first ? "\n" : ",\n") << "    {\"name\": " << json_string(s.name) << ", \"fractal\": " << json_string(s.fractal)
+            << ", \"width\": " << s.width << ", \"height\": " << s.height << ", \"max_its\": " << s.max_its
+            << ", \"threads\": " << max_threads << ", \"seconds\": " << t.best << ", \"median_seconds\": " << t.median
+            << ", \"iterations\": " << t.iterations
+            << ", \"pixels_per_second\": " << pixels/t.best << ", \"iterations_per_second\": " << t.iterations/t.best << "}";
+        first = false;
+    }
+    json << "\n  ],\n";
+
+    //Thread scaling of the larger classic Mandelbrot view, 1, 2, 4, ... threads and the maximum
+    const scenario& scaling = find_scenario("mandelbrot_classic_hd");
+    const auto scaling_map = scaling.map();
+    std::vector<unsigned> thread_counts;
+    for(unsigned n=1; n<max_threads; n*=2) thread_counts.push_back(n);
+    thread_counts.push_back(max_threads);
+
+    json << "  \"scaling\": {\"scenario\": " << json_string(scaling.name) << ", \"runs\": [";
+    double single = 0.0;
+    for(std::size_t i=0; i<thread_counts.size(); ++i) {
+        std::cerr << "Scaling " << thread_counts[i] << " threads" << std::endl;
+        ra::concurrency::thread_pool threads(thread_counts[i]);
+        auto t = time_render(scaling_map, threads, 16, repeats);
+        if(i == 0) single = t.best;
+
+        json << (i ? ",\n" : "\n") << "    {\"threads\": " << thread_counts[i] << ", \"seconds\": " << t.best
+            << ", \"speedup\": " << single/t.best << ", \"efficiency\": " << single/t.best/thread_counts[i] << "}";
+    }
+    json << "\n  ]},\n";
+
+    //Scheduling: rows per band task on all threads, over a view whose cost varies by row
+    const scenario& scheduling = find_scenario("mandelbrot_seahorse");
+    const auto scheduling_map = scheduling.map();
+    json << "  \"schedulers\": {\"scenario\": " << json_string(scheduling.name) << ", \"runs\": [";
+    const int band_heights[] = {1, 4, 16, 64, 480};
+    for(std::size_t i=0; i<std::size(band_heights); ++i) {
+        std::cerr << "Band height " << band_heights[i] << std::endl;
+        auto t = time_render(scheduling_map, pool, band_heights[i], repeats);
+        json << (i ? ",\n" : "\n") << "    {\"band_height\": " << band_heights[i] << ", \"seconds\": " << t.best << "}";
+    }
+    json << "\n  ]},\n";
+
+    //Encoders: one thread encoding and writing a rendered image, in MB/s of 24 bit pixels
+    std::cerr << "Encoders" << std::endl;
+    const scenario& encoding = find_scenario("mandelbrot_classic_hd");
+    const auto encoder_map = encoding.map();
+    const int width = encoder_map.get_x_pixels(), height = encoder_map.get_y_pixels(), max_its = encoder_map.get_max_iterations();
+    std::vector<int> its(static_cast<std::size_t>(width)*height);
+    encoder_map.render_rows(0, height, its.data());
+    const double rgb_bytes = 3.0*width*height;
+
+    auto encode = [&](auto& sink) {
+        sink.begin(width, height, max_its);
+        for(int row=0; row<height; row+=16) {
+            const int rows = std::min(16, height-row);
+            sink.write(sink.encode(band_view{row, rows, width, max_its, its.data() + static_cast<std::size_t>(row)*width}));
+        }
+        sink.end();
+    };
+
+    struct encoder {
+        const char * name;
+        int png_level;      //-2 for pnm
+    };
+    const encoder encoders[] = {{"pnm", -2}, {"png_1", 1}, {"png_default", -1}, {"png_9", 9}};
+
+    json << "  \"encoders\": {\"scenario\": " << json_string(encoding.name) << ", \"runs\": [";
+    for(std::size_t i=0; i<std::size(encoders); ++i) {
+        std::size_t bytes = 0;
+        auto t = time_runs(repeats, [&]() {
+            std::ostringstream os;
+            if(encoders[i].png_level == -2) {
+                ra::io::pnm_sink sink(os);
+                encode(sink);
+            } else {
+                ra::io::png_sink sink(os, encoders[i].png_level);
+                encode(sink);
+            }
+            bytes = os.str().size();
+            return std::uint64_t(0);
+        });
+        json << (i ? ",\n" : "\n") << "    {\"name\": " << json_string(encoders[i].name) << ", \"seconds\": " << t.best
+            << ", \"bytes\": " << bytes << ", \"mb_per_second\": " << rgb_bytes/t.best/1e6 << "}";
+    }
+    json << "\n  ]}\n}\n";
+
+    std::cout << json.str();
+    return 0;
+}
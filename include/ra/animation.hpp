@@ -0,0 +1,340 @@
+/**
+ * Batch rendering of zoom animations:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_ANIMATION_HPP
+#define RA_FRACTAL_LOGIC_ANIMATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <future>
+#include <istream>
+#include <thread>
+#include <vector>
+
+#include "ra/band_renderer.hpp"
+#include "ra/bounded_queue.hpp"
+#include "ra/henon.hpp"
+#include "ra/profile.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Viewing rectangle, lower left and upper right corners
+     */
+    template<class FLOAT_T>
+    struct view {
+        point<FLOAT_T> min, max;
+    };
+
+    /**
+     * Interpolate between two views for t in [0,1].
+     *
+     * The width and height change exponentially, so the zoom speed is
+     * constant. The center moves in proportion to the change in size,
+     * which keeps the point the zoom converges on fixed on screen rather
+     * than letting it drift during deep zooms.
+     */
+    template<class FLOAT_T>
+    view<FLOAT_T> interpolate_view(const view<FLOAT_T>& start, const view<FLOAT_T>& end, double t) {
+        auto interpolate_axis = [t](FLOAT_T min0, FLOAT_T max0, FLOAT_T min1, FLOAT_T max1,
+            FLOAT_T& min_out, FLOAT_T& max_out) {
+
+            FLOAT_T w0 = max0-min0, w1 = max1-min1;
+            FLOAT_T c0 = (max0+min0)/2, c1 = (max1+min1)/2;
+
+            FLOAT_T w = w0*std::pow(w1/w0, static_cast<FLOAT_T>(t));
+
+            //Same size: plain pan
+            FLOAT_T s = (std::abs(w0-w1) > std::abs(w0)*1e-12) ? (w-w1)/(w0-w1) : 1-static_cast<FLOAT_T>(t);
+            FLOAT_T c = c1 + (c0-c1)*s;
+
+            min_out = c - w/2;
+            max_out = c + w/2;
+        };
+
+        view<FLOAT_T> result;
+        interpolate_axis(start.min.x, start.max.x, end.min.x, end.max.x, result.min.x, result.max.x);
+        interpolate_axis(start.min.y, start.max.y, end.min.y, end.max.y, result.min.y, result.max.y);
+
+        return result;
+    }
+
+    /**
+     * Views for num_frames frames passing through every keyframe. Each pair of
+     * consecutive keyframes gets an equal share of the frames; the first and
+     * last frames are exactly the first and last keyframes.
+     */
+    template<class FLOAT_T>
+    std::vector<view<FLOAT_T>> zoom_path(const std::vector<view<FLOAT_T>>& keyframes, int num_frames) {
+        std::vector<view<FLOAT_T>> views;
+        if(keyframes.empty() || num_frames <= 0) {
+            return views;
+        }
+
+        views.reserve(num_frames);
+        const int segments = static_cast<int>(keyframes.size())-1;
+
+        for(int i=0; i<num_frames; ++i) {
+            if(segments == 0 || num_frames == 1) {
+                views.push_back(keyframes.front());
+                continue;
+            }
+
+            double position = static_cast<double>(i)*segments/(num_frames-1);
+            int segment = std::min(static_cast<int>(position), segments-1);
+
+            views.push_back(interpolate_view(keyframes[segment], keyframes[segment+1], position-segment));
+        }
+
+        return views;
+    }
+
+    /**
+     * Read keyframes, one per line as "[min x],[min y] [max x],[max y]".
+     * Blank lines and lines starting with # are skipped.
+     */
+    template<class FLOAT_T>
+    std::vector<view<FLOAT_T>> read_keyframes(std::istream& is) {
+        const std::regex keyframe_regex(
+            "\\s*(-?\\d*\\.?\\d+(?:[eE][-+]?\\d+)?),(-?\\d*\\.?\\d+(?:[eE][-+]?\\d+)?)"
+            "\\s+(-?\\d*\\.?\\d+(?:[eE][-+]?\\d+)?),(-?\\d*\\.?\\d+(?:[eE][-+]?\\d+)?)\\s*");
+
+        std::vector<view<FLOAT_T>> keyframes;
+        std::string line;
+        while(std::getline(is, line)) {
+            if(line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            std::smatch match;
+            if(!std::regex_match(line, match, keyframe_regex)) {
+                throw std::invalid_argument("Could not process keyframe: " + line);
+            }
+
+            keyframes.push_back({
+                {static_cast<FLOAT_T>(std::stold(match[1].str())), static_cast<FLOAT_T>(std::stold(match[2].str()))},
+                {static_cast<FLOAT_T>(std::stold(match[3].str())), static_cast<FLOAT_T>(std::stold(match[4].str()))}
+            });
+        }
+
+        return keyframes;
+    }
+
+    /**
+     * A rendered frame of iteration counts, row major with the top row first
+     */
+    struct frame {
+        int index;
+        int width, height;
+        int max_its;
+        std::vector<int> its;
+    };
+
+    /**
+     * Encode a whole frame with a band sink, encoding bands in parallel on
+     * the pool and writing them in order.
+     */
+    template<class SINK>
+    void encode_frame(SINK& sink, const frame& f, ra::concurrency::thread_pool& pool, int band_height = 64) {
+        using chunk_type = decltype(sink.encode(std::declval<const band_view&>()));
+
+        band_height = std::max(1, band_height);
+
+        sink.begin(f.width, f.height, f.max_its);
+
+        std::vector<std::future<chunk_type>> chunks;
+        for(int first_row=0; first_row<f.height; first_row+=band_height) {
+            int num_rows = std::min(band_height, f.height-first_row);
+            const int * its = f.its.data() + static_cast<std::size_t>(first_row)*f.width;
+
+            chunks.push_back(pool.submit([&sink, &f, first_row, num_rows, its]() {
+                return sink.encode(band_view{first_row, num_rows, f.width, f.max_its, its});
+            }));
+        }
+
+        try {
+            for(auto& chunk: chunks) {
+                sink.write(chunk.get());
+            }
+        } catch(...) {
+            for(auto& chunk: chunks) {
+                if(chunk.valid()) chunk.wait();
+            }
+            throw;
+        }
+        sink.end();
+    }
+
+    /**
+     * Class: frame_pipeline
+     *
+     * Description: Computes a sequence of frames in bands on a shared thread
+     * pool. Bands of the next frames are queued while earlier frames are
+     * still being computed, so the pool does not idle at frame boundaries.
+     * Completed frames are passed through a bounded queue to a separate
+     * writer thread, which handles them in frame order while computation
+     * continues.
+     */
+    class frame_pipeline {
+
+        public:
+
+        /**
+         * queue_size: number of completed frames that may wait for the writer,
+         * also the number of frames being computed at once.
+         */
+        frame_pipeline(ra::concurrency::thread_pool& pool, int band_height = 16, int queue_size = 2):
+            pool_(pool), band_height_(std::max(1, band_height)),
+            queue_size_(std::max(1, queue_size)) {}
+
+        /**
+         * Compute num_frames frames of width*height pixels.
+         *
+         * prepare(index) is called on this thread before a frame is started and
+         * returns the function filling its bands, band(first_row, num_rows, its),
+         * which is called concurrently on the workers. writer(frame&) is called
+         * on the writer thread once per frame, in order. Exceptions from either
+         * stop the pipeline and are rethrown here.
+         */
+        template<class PREPARE, class WRITER>
+        void run(int num_frames, int width, int height, int max_its, PREPARE&& prepare, WRITER&& writer) {
+            ra::concurrency::bounded_queue<frame> completed(queue_size_);
+            std::exception_ptr writer_error;
+
+            std::thread writer_thread([&]() {
+                frame f;
+                try {
+                    while(completed.pop(f)) {
+                        writer(f);
+                        RA_PROFILE_FRAME("frame " + std::to_string(f.index));
+                    }
+                } catch(...) {
+                    writer_error = std::current_exception();
+                    completed.close();
+                }
+            });
+
+            struct pending_frame {
+                frame f;
+                std::vector<std::future<void>> bands;
+            };
+            std::deque<pending_frame> in_flight;
+
+            auto finish_front = [&]() {
+                pending_frame& front = in_flight.front();
+                for(auto& band: front.bands) {
+                    band.get();
+                }
+                bool accepted = completed.push(std::move(front.f));
+                in_flight.pop_front();
+                return accepted;
+            };
+
+            std::exception_ptr render_error;
+            try {
+                bool writing = true;
+                for(int i=0; i<num_frames && writing; ++i) {
+                    if(static_cast<int>(in_flight.size()) >= queue_size_) {
+                        writing = finish_front();
+                    }
+
+                    pending_frame& pending = in_flight.emplace_back();
+                    frame& f = pending.f;
+                    f.index = i;
+                    f.width = width;
+                    f.height = height;
+                    f.max_its = max_its;
+                    f.its.resize(static_cast<std::size_t>(width)*height);
+
+                    //Shared between the frame's bands
+                    auto band = std::make_shared<decltype(prepare(i))>(prepare(i));
+
+                    for(int first_row=0; first_row<height; first_row+=band_height_) {
+                        int num_rows = std::min(band_height_, height-first_row);
+                        int * its = f.its.data() + static_cast<std::size_t>(first_row)*width;
+
+                        pending.bands.push_back(pool_.submit([band, first_row, num_rows, its]() {
+                            (*band)(first_row, num_rows, its);
+                        }));
+                    }
+                }
+                while(!in_flight.empty() && writing) {
+                    writing = finish_front();
+                }
+            } catch(...) {
+                render_error = std::current_exception();
+            }
+
+            //Bands hold pointers into the frames, wait for them before they are freed
+            for(auto& pending: in_flight) {
+                for(auto& band: pending.bands) {
+                    if(band.valid()) band.wait();
+                }
+            }
+            in_flight.clear();
+
+            completed.close();
+            writer_thread.join();
+
+            if(render_error) std::rethrow_exception(render_error);
+            if(writer_error) std::rethrow_exception(writer_error);
+        }
+
+        private:
+
+        ra::concurrency::thread_pool& pool_;
+
+        int band_height_;
+        int queue_size_;
+    };
+
+    /**
+     * Class: animation_renderer
+     *
+     * Description: Renders a sequence of views of a henon_map through a
+     * frame_pipeline, so all frames share one thread pool and are written
+     * while later frames render.
+     */
+    template<class FLOAT_T>
+    class animation_renderer {
+
+        public:
+
+        animation_renderer(const henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool,
+            int band_height = 16, int queue_size = 2):
+            map_(map), pipeline_(pool, band_height, queue_size) {}
+
+        /**
+         * Render a frame per view. writer(frame&) is called on the writer
+         * thread once per frame, in order. Exceptions from rendering or from
+         * the writer stop the animation and are rethrown here.
+         */
+        template<class WRITER>
+        void render(const std::vector<view<FLOAT_T>>& views, WRITER&& writer) {
+            auto prepare = [this, &views](int index) {
+                henon_map<FLOAT_T> frame_map(map_);
+                frame_map.set_bottom_left(views[index].min);
+                frame_map.set_top_right(views[index].max);
+
+                return [frame_map](int first_row, int num_rows, int * its) {
+                    frame_map.render_rows(first_row, num_rows, its);
+                };
+            };
+
+            pipeline_.run(static_cast<int>(views.size()), map_.get_x_pixels(), map_.get_y_pixels(),
+                map_.get_max_iterations(), prepare, std::forward<WRITER>(writer));
+        }
+
+        private:
+
+        const henon_map<FLOAT_T>& map_;
+        frame_pipeline pipeline_;
+    };
+}
+
+#endif
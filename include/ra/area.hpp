@@ -0,0 +1,221 @@
+/**
+ * Stratified quasi-Monte Carlo area estimates of bounded sets:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_AREA_HPP
+#define RA_FRACTAL_LOGIC_AREA_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "ra/henon.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Point n of the two dimensional Sobol sequence, as 32 bit fractions of
+     * [0, 1). The first coordinate is the base 2 van der Corput sequence, the
+     * second uses the primitive polynomial x + 1, whose direction numbers
+     * follow v_i = v_(i-1) xor v_(i-1)/2.
+     */
+    inline std::pair<std::uint32_t, std::uint32_t> sobol_2d(std::uint32_t n) {
+        std::uint32_t u = 0, v = 0;
+        std::uint32_t direction = 1u << 31;
+
+        for(int bit=0; n != 0; ++bit, n >>= 1) {
+            if(n & 1) {
+                u ^= 1u << (31-bit);
+                v ^= direction;
+            }
+            direction ^= direction >> 1;
+        }
+        return {u, v};
+    }
+
+    /**
+     * Area estimate after some number of samples
+     */
+    struct area_estimate {
+        std::uint64_t samples;
+        double seconds;
+        double area;
+        double standard_error;
+    };
+
+    /**
+     * Class: area_estimator
+     *
+     * Description: Estimates the area of the points of a henon_map's view
+     * which stay bounded for max_iterations, for its current fractal type.
+     * The view is split into strata*strata equal strata. Each stratum takes
+     * successive points of its own randomly digit-shifted Sobol sequence,
+     * evaluated in batches with henon_map::compute_points.
+     *
+     * After a first round of equal samples per stratum, every round doubles
+     * the total, allocating the new samples in proportion to each stratum's
+     * estimated standard deviation (Neyman allocation). Strata entirely
+     * inside or outside the set get few new samples, so the budget goes to
+     * the boundary. The reported standard error uses the binomial variance
+     * within each stratum, which is conservative for the Sobol points.
+     */
+    template<class FLOAT_T>
+    class area_estimator {
+
+        public:
+
+        static constexpr std::size_t batch_size = 4096;
+
+        area_estimator(const henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool,
+            int strata = 64, std::uint64_t seed = 0):
+            map_(map), pool_(pool), strata_(std::max(1, strata)),
+            cells_(static_cast<std::size_t>(strata_)*strata_) {
+
+            std::mt19937_64 rng(seed);
+            for(auto& cell: cells_) {
+                cell.shift_u = static_cast<std::uint32_t>(rng());
+                cell.shift_v = static_cast<std::uint32_t>(rng());
+            }
+        }
+
+        /**
+         * Take up to total_samples samples (at least two per stratum), calling
+         * report(const area_estimate&) after every round
+         */
+        template<class REPORT>
+        area_estimate run(std::uint64_t total_samples, REPORT&& report) {
+            auto start = std::chrono::steady_clock::now();
+            auto elapsed = [&start]() {
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            };
+
+            //First round: a quarter of the budget spread evenly
+            std::uint64_t initial = std::max<std::uint64_t>(2, total_samples/4/cells_.size());
+            sample_round(std::vector<std::uint64_t>(cells_.size(), initial));
+
+            area_estimate result = estimate(elapsed());
+            report(result);
+
+            while(result.samples < total_samples) {
+                std::uint64_t budget = std::min(total_samples - result.samples, result.samples);
+                if(budget < cells_.size()) {
+                    //Too few left to spread over the strata
+                    break;
+                }
+
+                //Smoothed proportions keep some samples flowing to strata that look uniform
+                std::vector<double> weights(cells_.size());
+                double total_weight = 0;
+                for(std::size_t i=0; i<cells_.size(); ++i) {
+                    double p = (cells_[i].bounded + 0.5)/(cells_[i].samples + 1.0);
+                    weights[i] = std::sqrt(p*(1.0-p));
+                    total_weight += weights[i];
+                }
+
+                std::vector<std::uint64_t> counts(cells_.size());
+                for(std::size_t i=0; i<cells_.size(); ++i) {
+                    counts[i] = static_cast<std::uint64_t>(budget*weights[i]/total_weight);
+                }
+
+                sample_round(counts);
+                result = estimate(elapsed());
+                report(result);
+            }
+
+            return result;
+        }
+
+        /**
+         * Stratified estimate of the samples taken so far
+         */
+        area_estimate estimate(double seconds = 0.0) const {
+            const double cell_area = static_cast<double>((map_.get_top_right().x - map_.get_bottom_left().x)
+                *(map_.get_top_right().y - map_.get_bottom_left().y))/cells_.size();
+
+            area_estimate result{0, seconds, 0.0, 0.0};
+            double variance = 0;
+            for(const auto& cell: cells_) {
+                if(cell.samples == 0) continue;
+                double p = static_cast<double>(cell.bounded)/cell.samples;
+
+                result.samples += cell.samples;
+                result.area += cell_area*p;
+                if(cell.samples > 1) {
+                    variance += cell_area*cell_area*p*(1.0-p)/(cell.samples-1);
+                }
+            }
+            result.standard_error = std::sqrt(variance);
+            return result;
+        }
+
+        private:
+
+        struct stratum {
+            std::uint64_t samples = 0;
+            std::uint64_t bounded = 0;
+            std::uint32_t shift_u = 0, shift_v = 0;
+        };
+
+        /**
+         * Add counts[i] samples to stratum i, a row of strata per task
+         */
+        void sample_round(const std::vector<std::uint64_t>& counts) {
+            const FLOAT_T min_x = map_.get_bottom_left().x, min_y = map_.get_bottom_left().y;
+            const FLOAT_T width = (map_.get_top_right().x - min_x)/strata_;
+            const FLOAT_T height = (map_.get_top_right().y - min_y)/strata_;
+            const int max_its = map_.get_max_iterations();
+
+            std::vector<std::future<void>> rows;
+            for(int row=0; row<strata_; ++row) {
+                rows.push_back(pool_.submit([&, row]() {
+                    std::vector<point<FLOAT_T>> points(batch_size);
+                    std::vector<int> its(batch_size);
+
+                    for(int column=0; column<strata_; ++column) {
+                        std::size_t index = static_cast<std::size_t>(row)*strata_ + column;
+                        stratum& cell = cells_[index];
+
+                        const FLOAT_T x0 = min_x + column*width, y0 = min_y + row*height;
+                        std::uint64_t remaining = counts[index];
+
+                        while(remaining > 0) {
+                            std::size_t n = std::min<std::uint64_t>(remaining, batch_size);
+                            for(std::size_t i=0; i<n; ++i) {
+                                //Sequence index wraps after 2^32 samples in one stratum
+                                auto [u, v] = sobol_2d(static_cast<std::uint32_t>(cell.samples + i));
+                                points[i] = point<FLOAT_T>(
+                                    x0 + width*std::ldexp(static_cast<FLOAT_T>(u ^ cell.shift_u), -32),
+                                    y0 + height*std::ldexp(static_cast<FLOAT_T>(v ^ cell.shift_v), -32));
+                            }
+
+                            map_.compute_points(points.data(), n, its.data());
+
+                            cell.bounded += std::count(its.begin(), its.begin()+n, max_its);
+                            cell.samples += n;
+                            remaining -= n;
+                        }
+                    }
+                }));
+            }
+
+            for(auto& row: rows) {
+                row.get();
+            }
+        }
+
+        const henon_map<FLOAT_T>& map_;
+        ra::concurrency::thread_pool& pool_;
+
+        int strata_;
+        std::vector<stratum> cells_;
+    };
+}
+
+#endif
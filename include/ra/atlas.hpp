@@ -0,0 +1,189 @@
+/**
+ * Henon parameter plane atlas: summaries of the map over a grid of (a, b):
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_ATLAS_HPP
+#define RA_FRACTAL_LOGIC_ATLAS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <vector>
+
+#include "ra/animation.hpp"
+#include "ra/formulas.hpp"
+#include "ra/henon.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * The Henon map over its parameter plane: the pixel is (a, b), and the
+     * starting point is held in the formula_params' a and b
+     */
+    struct henon_parameter_formula {
+        static constexpr const char * name = "henonparameters";
+        static void init(double px, double py, const formula_params& p, double& x, double& y, double& cx, double& cy) {
+            x = p.a; y = p.b; cx = px; cy = py;
+        }
+        static void step(double& x, double& y, double cx, double cy, const formula_params&) {
+            double x_next = 1.0 - cx*x*x + y;
+            y = cy*x;
+            x = x_next;
+        }
+        static double bailout_squared(const formula_params& p) {return p.threshold_squared;}
+    };
+
+    /**
+     * Class: parameter_atlas
+     *
+     * Description: Sweeps a rectangle of Henon (a, b) parameters. For each
+     * pair the summary is the fraction of a samples*samples grid over the
+     * henon_map's view whose orbits stay within the threshold for max_its
+     * iterations. Pairs from the same row of the parameter image are packed
+     * into SIMD lanes, and rows are spread over the pool.
+     */
+    template<class FLOAT_T>
+    class parameter_atlas {
+
+        public:
+
+        static constexpr int lanes = 8;
+
+        /**
+         * param_min, param_max: corners of the rectangle, x holds a and y holds b
+         */
+        parameter_atlas(const henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool,
+            point<FLOAT_T> param_min, point<FLOAT_T> param_max, int width, int height, int samples = 32):
+            map_(map), pool_(pool), param_min_(param_min), param_max_(param_max),
+            width_(std::max(1, width)), height_(std::max(1, height)), samples_(std::max(1, samples)) {}
+
+        /**
+         * (a, b) at pixel (x, y) of the parameter image, y = 0 is the largest b
+         */
+        point<FLOAT_T> parameters(int x, int y) const {
+            FLOAT_T a = width_ > 1 ? param_min_.x + x*(param_max_.x-param_min_.x)/(width_-1) : param_min_.x;
+            FLOAT_T b = height_ > 1 ? param_max_.y - y*(param_max_.y-param_min_.y)/(height_-1) : param_max_.y;
+            return {a, b};
+        }
+
+        /**
+         * Bounded fraction for every pixel of the parameter image, top row first
+         */
+        std::vector<double> bounded_fractions() const {
+            std::vector<double> fractions(static_cast<std::size_t>(width_)*height_);
+
+            const int max_its = map_.get_max_iterations();
+            const double threshold_squared = static_cast<double>(map_.get_threshold())*map_.get_threshold();
+
+            //Starting points shared by every parameter pair
+            henon_map<FLOAT_T> sample_map(map_);
+            sample_map.set_x_pixels(samples_);
+            sample_map.set_y_pixels(samples_);
+
+            std::vector<point<double>> starts;
+            for(int sy=0; sy<samples_; ++sy) {
+                for(int sx=0; sx<samples_; ++sx) {
+                    auto p = samples_ > 1 ? sample_map.map_to_cartesian_plane(sx, sy) : map_.get_bottom_left();
+                    starts.push_back({static_cast<double>(p.x), static_cast<double>(p.y)});
+                }
+            }
+
+            std::vector<std::future<void>> rows;
+            for(int y=0; y<height_; ++y) {
+                rows.push_back(pool_.submit([&, y]() {
+                    std::vector<double> a(width_), b(width_);
+                    for(int x=0; x<width_; ++x) {
+                        auto p = parameters(x, y);
+                        a[x] = p.x;
+                        b[x] = p.y;
+                    }
+
+                    std::vector<int> bounded(width_), its(width_);
+                    for(const auto& start: starts) {
+                        formula_params params{start.x, start.y, threshold_squared, max_its};
+                        escape_lanes<henon_parameter_formula, lanes>(a.data(), b.data(), width_, params, its.data());
+                        for(int x=0; x<width_; ++x) {
+                            bounded[x] += its[x] == max_its;
+                        }
+                    }
+
+                    for(int x=0; x<width_; ++x) {
+                        fractions[static_cast<std::size_t>(y)*width_ + x] = static_cast<double>(bounded[x])/starts.size();
+                    }
+                }));
+            }
+            for(auto& row: rows) {
+                row.get();
+            }
+
+            return fractions;
+        }
+
+        /**
+         * Parameter image as a frame with max_its = levels, ready for the image sinks
+         */
+        frame parameter_image(int levels = 1024) const {
+            auto fractions = bounded_fractions();
+
+            frame f{0, width_, height_, levels, std::vector<int>(fractions.size())};
+            for(std::size_t i=0; i<fractions.size(); ++i) {
+                f.its[i] = static_cast<int>(std::lround(fractions[i]*levels));
+            }
+            return f;
+        }
+
+        /**
+         * Basin thumbnails of thumb*thumb pixels for a columns*rows grid of
+         * (a, b) pairs spread over the rectangle, laid out like the parameter
+         * image (a increasing to the right, b increasing upward). Thumbnails
+         * are of the Henon map whatever the map's fractal type.
+         */
+        frame contact_sheet(int columns, int rows, int thumb) const {
+            frame sheet{0, columns*thumb, rows*thumb, map_.get_max_iterations(),
+                std::vector<int>(static_cast<std::size_t>(columns)*thumb*rows*thumb)};
+
+            std::vector<std::future<void>> tiles;
+            for(int row=0; row<rows; ++row) {
+                for(int column=0; column<columns; ++column) {
+                    tiles.push_back(pool_.submit([&, row, column]() {
+                        FLOAT_T a = columns > 1 ? param_min_.x + column*(param_max_.x-param_min_.x)/(columns-1) : param_min_.x;
+                        FLOAT_T b = rows > 1 ? param_max_.y - row*(param_max_.y-param_min_.y)/(rows-1) : param_max_.y;
+
+                        henon_map<FLOAT_T> thumb_map(map_);
+                        thumb_map.set_fractal_type("henon");
+                        thumb_map.set_a(a);
+                        thumb_map.set_b(b);
+                        thumb_map.set_x_pixels(thumb);
+                        thumb_map.set_y_pixels(thumb);
+
+                        std::vector<int> its(static_cast<std::size_t>(thumb)*thumb);
+                        thumb_map.render_rows(0, thumb, its.data());
+
+                        for(int y=0; y<thumb; ++y) {
+                            std::copy(its.begin() + y*thumb, its.begin() + (y+1)*thumb,
+                                sheet.its.begin() + (static_cast<std::size_t>(row*thumb + y)*sheet.width + column*thumb));
+                        }
+                    }));
+                }
+            }
+            for(auto& tile: tiles) {
+                tile.get();
+            }
+
+            return sheet;
+        }
+
+        private:
+
+        const henon_map<FLOAT_T>& map_;
+        ra::concurrency::thread_pool& pool_;
+
+        point<FLOAT_T> param_min_, param_max_;
+        int width_, height_;
+        int samples_;
+    };
+}
+
+#endif
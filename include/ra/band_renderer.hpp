@@ -0,0 +1,156 @@
+/**
+ * Streaming renderer which produces an image as a sequence of row bands:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_BAND_RENDERER_HPP
+#define RA_FRACTAL_LOGIC_BAND_RENDERER_HPP
+
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ra/color.hpp"
+#include "ra/henon.hpp"
+#include "ra/profile.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * A band of rendered rows handed to a sink's encode function.
+     * its holds num_rows*width iteration counts, row major, top row first.
+     * rgb, when not null, holds the band's colors in the same order, for
+     * values whose color is not the palette's color of its (e.g. the mean of
+     * supersamples).
+     */
+    struct band_view {
+        int first_row;
+        int num_rows;
+        int width;
+        int max_its;
+        const int * its;
+        const unsigned char * rgb = nullptr;
+    };
+
+    /**
+     * The band's colors as three bytes per pixel
+     */
+    inline void colorize(const band_view& band, unsigned char * rgb) {
+        const std::size_t num_pixels = static_cast<std::size_t>(band.num_rows)*band.width;
+        if(band.rgb) {
+            std::copy(band.rgb, band.rgb + 3*num_pixels, rgb);
+        } else {
+            colorize(band.its, num_pixels, band.max_its, rgb);
+        }
+    }
+
+    /**
+     * Class: band_renderer
+     * 
+     * Description: Renders the view of a henon_map in horizontal bands on a
+     * thread pool, and passes them to a sink in top to bottom order. At most
+     * max_in_flight bands exist at once, so memory use is proportional to
+     * width*band_height rather than to the size of the image.
+     * 
+     * A sink provides:
+     *   void begin(int width, int height, int max_its);
+     *   chunk_type encode(const band_view&) const; //Called concurrently on workers
+     *   void write(chunk_type&&);                  //Called in row order
+     *   void end();
+     */
+    template<class FLOAT_T>
+    class band_renderer {
+
+        public:
+
+        /**
+         * max_in_flight of 0 keeps two bands per worker thread queued
+         */
+        band_renderer(const henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool,
+            int band_height = 16, int max_in_flight = 0):
+            map_(map), pool_(pool),
+            band_height_(std::max(1, band_height)),
+            max_in_flight_(max_in_flight > 0 ? max_in_flight : 2*static_cast<int>(pool.size())) {}
+
+        template<class SINK>
+        void render(SINK& sink) {
+            render(sink, [this](int first_row, int num_rows, int * its) {
+                map_.render_rows(first_row, num_rows, its);
+            }, map_.get_max_iterations());
+        }
+
+        /**
+         * Render the map's view with rows(first_row, num_rows, its) in place of
+         * henon_map::render_rows, for other per-pixel quantities quantized to
+         * [0, max_its]. With rows(first_row, num_rows, its, rgb) the rows also
+         * give the colors of the band, three bytes per pixel.
+         */
+        template<class SINK, class ROWS>
+        void render(SINK& sink, ROWS rows, int max_its) {
+            using chunk_type = decltype(sink.encode(std::declval<const band_view&>()));
+            constexpr bool with_rgb = std::is_invocable_v<ROWS&, int, int, int *, unsigned char *>;
+
+            const int width = map_.get_x_pixels();
+            const int height = map_.get_y_pixels();
+
+            sink.begin(width, height, max_its);
+
+            std::deque<std::future<chunk_type>> in_flight;
+
+            try {
+                for(int first_row=0; first_row<height; first_row+=band_height_) {
+                    //Emit the oldest band before starting a new one when the window is full
+                    if(static_cast<int>(in_flight.size()) >= max_in_flight_) {
+                        RA_PROFILE_SCOPE("write");
+                        sink.write(in_flight.front().get());
+                        in_flight.pop_front();
+                    }
+
+                    int num_rows = std::min(band_height_, height-first_row);
+
+                    in_flight.push_back(pool_.submit([&sink, &rows, first_row, num_rows, width, max_its]() {
+                        std::vector<int> its(static_cast<std::size_t>(num_rows)*width);
+                        std::vector<unsigned char> rgb(with_rgb ? 3*its.size() : 0);
+                        if constexpr(with_rgb) {
+                            rows(first_row, num_rows, its.data(), rgb.data());
+                        } else {
+                            rows(first_row, num_rows, its.data());
+                        }
+
+                        RA_PROFILE_SCOPE("encode");
+                        return sink.encode(band_view{first_row, num_rows, width, max_its, its.data(),
+                            with_rgb ? rgb.data() : nullptr});
+                    }));
+                }
+
+                while(!in_flight.empty()) {
+                    RA_PROFILE_SCOPE("write");
+                    sink.write(in_flight.front().get());
+                    in_flight.pop_front();
+                }
+            } catch(...) {
+                //Tasks reference the sink, so they must finish before unwinding
+                for(auto& band: in_flight) {
+                    band.wait();
+                }
+                throw;
+            }
+
+            sink.end();
+        }
+
+        private:
+
+        const henon_map<FLOAT_T>& map_;
+        ra::concurrency::thread_pool& pool_;
+
+        int band_height_;
+        int max_in_flight_;
+    };
+}
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * Blocking queue with a fixed capacity, used between pipeline stages:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_CONCURRENCY_BOUNDED_QUEUE_HPP
+#define RA_CONCURRENCY_BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace ra::concurrency {
+
+    /**
+     * Class: bounded_queue
+     *
+     * Description: push blocks while the queue is full and pop blocks while
+     * it is empty, so a fast producer cannot run arbitrarily far ahead of
+     * its consumer. Closing the queue wakes both sides; items already queued
+     * can still be popped.
+     */
+    template<class T>
+    class bounded_queue {
+
+        public:
+
+        using size_type = std::size_t;
+
+        explicit bounded_queue(size_type capacity): capacity_(capacity > 0 ? capacity : 1), closed_(false) {}
+
+        /**
+         * Returns false, without queueing value, if the queue has been closed
+         */
+        bool push(T value) {
+            std::unique_lock lock(mutex_);
+            not_full_.wait(lock, [this](){return closed_ || items_.size() < capacity_;});
+
+            if(closed_) {
+                return false;
+            }
+
+            items_.push_back(std::move(value));
+            not_empty_.notify_one();
+            return true;
+        }
+
+        /**
+         * Returns false once the queue is closed and empty
+         */
+        bool pop(T& value) {
+            std::unique_lock lock(mutex_);
+            not_empty_.wait(lock, [this](){return closed_ || !items_.empty();});
+
+            if(items_.empty()) {
+                return false;
+            }
+
+            value = std::move(items_.front());
+            items_.pop_front();
+            not_full_.notify_one();
+            return true;
+        }
+
+        void close() {
+            std::scoped_lock lock(mutex_);
+            closed_ = true;
+            not_full_.notify_all();
+            not_empty_.notify_all();
+        }
+
+        bool is_closed() const {
+            std::scoped_lock lock(mutex_);
+            return closed_;
+        }
+
+        size_type capacity() const {return capacity_;}
+
+        private:
+
+        std::deque<T> items_;
+        size_type capacity_;
+        bool closed_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable not_full_, not_empty_;
+    };
+}
+
+#endif
@@ -0,0 +1,259 @@
+/**
+ * Buddhabrot and anti-Buddhabrot rendering with importance sampling:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_BUDDHABROT_HPP
+#define RA_FRACTAL_LOGIC_BUDDHABROT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <random>
+#include <vector>
+
+#include "ra/density.hpp"
+#include "ra/henon.hpp"
+#include "ra/profile.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Counts reported by a buddhabrot render
+     */
+    struct buddhabrot_stats {
+        std::uint64_t samples;      //c values tried
+        std::uint64_t accepted;     //c values whose orbit was splatted
+        double seconds;
+
+        double samples_per_second() const {return seconds > 0 ? samples/seconds : 0.0;}
+        double acceptance_rate() const {return samples > 0 ? static_cast<double>(accepted)/samples : 0.0;}
+    };
+
+    /**
+     * Class: buddhabrot
+     *
+     * Description: Density of the orbits z -> z^2 + c of the Mandelbrot set
+     * over a henon_map's view. The Buddhabrot splats orbits escaping within
+     * [min_its, max_its) iterations, the anti-Buddhabrot orbits which never
+     * escape.
+     *
+     * Few c values have orbits crossing a zoomed in view, so c is drawn from
+     * an importance map: a pilot pass estimates how many view hits the
+     * orbits from each cell of a grid over |Re c|,|Im c| <= 2 produce, and
+     * cells are then drawn with probability proportional to q = 2^k,
+     * k in [0, max_level], rising with the estimate. Splats are weighted by
+     * 2^max_level/q, which keeps the image an unbiased estimate of uniform
+     * sampling while the weights stay integers. Cells with no pilot hits
+     * keep q = 1, so no region is excluded.
+     */
+    template<class FLOAT_T>
+    class buddhabrot {
+
+        public:
+
+        static constexpr int grid_size = 256;
+        static constexpr int max_level = 6;
+        static_assert(max_level < 16, "Splat weights are 16 bit");
+
+        buddhabrot(const henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool,
+            bool anti = false, int min_its = 0):
+            map_(map), pool_(pool), anti_(anti), min_its_(min_its) {}
+
+        /**
+         * Draw num_samples values of c and return the resulting density
+         */
+        density_grid render(std::uint64_t num_samples, std::uint64_t seed = 0) {
+            auto start = std::chrono::steady_clock::now();
+
+            const int width = map_.get_x_pixels();
+            const int height = map_.get_y_pixels();
+            const int max_its = map_.get_max_iterations();
+            density_grid grid(width, height);
+
+            std::atomic<std::uint64_t> accepted(0);
+
+            //Pilot pass uses up to an eighth of the budget
+            std::uint64_t pilot_per_cell = std::clamp<std::uint64_t>(num_samples/8/(grid_size*grid_size), 1, 64);
+            build_importance_map(pilot_per_cell, seed);
+            std::uint64_t pilot_samples = pilot_per_cell*grid_size*grid_size;
+
+            //About 2^31 units of splat weight per chunk, so the pool has chunks to balance
+            const std::uint64_t chunk_samples = std::max<std::uint64_t>(1,
+                (std::uint64_t(1) << 31)/(static_cast<std::uint64_t>(max_its+1) << max_level));
+
+            std::uint64_t remaining = num_samples > pilot_samples ? num_samples - pilot_samples : 0;
+            std::uint64_t num_chunks = (remaining + chunk_samples - 1)/chunk_samples;
+
+            grid.accumulate(pool_, num_chunks, [&](std::uint64_t chunk, density_grid::hit_buffer& hits) {
+                std::mt19937_64 rng(seed*0x9e3779b97f4a7c15ull + chunk + 1);
+                std::discrete_distribution<int> pick_cell(cell_weights_.begin(), cell_weights_.end());
+                std::uniform_real_distribution<double> offset(0.0, 1.0);
+
+                std::vector<double> orbit(2*max_its);
+                std::uint64_t count = std::min(chunk_samples, remaining - chunk*chunk_samples);
+                std::uint64_t chunk_accepted = 0;
+
+                for(std::uint64_t i=0; i<count; ++i) {
+                    int cell = pick_cell(rng);
+                    double cx = cell_coordinate(cell%grid_size, offset(rng));
+                    double cy = cell_coordinate(cell/grid_size, offset(rng));
+
+                    std::uint16_t weight = static_cast<std::uint16_t>((1u << max_level)/cell_weights_[cell]);
+                    if(splat(cx, cy, orbit, &hits, weight) > 0) {
+                        ++chunk_accepted;
+                    }
+                }
+                accepted += chunk_accepted;
+            });
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            stats_ = {pilot_samples + remaining, accepted + pilot_accepted_, elapsed.count()};
+
+            return grid;
+        }
+
+        const buddhabrot_stats& stats() const {return stats_;}
+
+        private:
+
+        static double cell_coordinate(int cell, double offset) {
+            return -2.0 + 4.0*(cell + offset)/grid_size;
+        }
+
+        /**
+         * Points of the main cardioid and period 2 bulb never escape
+         */
+        static bool in_main_bulbs(double cx, double cy) {
+            double q = (cx-0.25)*(cx-0.25) + cy*cy;
+            if(q*(q + (cx-0.25)) <= 0.25*cy*cy) return true;
+            return (cx+1.0)*(cx+1.0) + cy*cy <= 0.0625;
+        }
+
+        /**
+         * Iterate c and, if its orbit qualifies, add weight to the pixels it
+         * visits inside the view. Without a hit_buffer the hits are only counted.
+         *
+         * Returns: number of orbit points inside the view, 0 if not splatted
+         */
+        std::uint64_t splat(double cx, double cy, std::vector<double>& orbit,
+            density_grid::hit_buffer * buffer, std::uint16_t weight) const {
+
+            const int max_its = map_.get_max_iterations();
+
+            int its = max_its;
+            if(!in_main_bulbs(cx, cy)) {
+                double x = 0.0, y = 0.0;
+                for(int i=0; i<max_its; ++i) {
+                    double x_next = x*x - y*y + cx;
+                    y = 2.0*x*y + cy;
+                    x = x_next;
+
+                    orbit[2*i] = x;
+                    orbit[2*i+1] = y;
+
+                    if(x*x + y*y > 4.0) {
+                        its = i;
+                        break;
+                    }
+                }
+            } else if(!anti_) {
+                RA_PROFILE_COUNT(bulb_skips, 1);
+                return 0;
+            } else {
+                //Known bounded, the orbit is still needed for the anti-Buddhabrot
+                double x = 0.0, y = 0.0;
+                for(int i=0; i<max_its; ++i) {
+                    double x_next = x*x - y*y + cx;
+                    y = 2.0*x*y + cy;
+                    x = x_next;
+                    orbit[2*i] = x;
+                    orbit[2*i+1] = y;
+                }
+            }
+
+            bool escaped = its < max_its;
+            if(anti_ ? escaped : (!escaped || its < min_its_)) {
+                return 0;
+            }
+
+            const int width = map_.get_x_pixels(), height = map_.get_y_pixels();
+            const double min_x = map_.get_bottom_left().x, min_y = map_.get_bottom_left().y;
+            const double scale_x = width/static_cast<double>(map_.get_top_right().x - map_.get_bottom_left().x);
+            const double scale_y = height/static_cast<double>(map_.get_top_right().y - map_.get_bottom_left().y);
+
+            std::uint64_t hits = 0;
+            int points = escaped ? its : max_its;
+            for(int i=0; i<points; ++i) {
+                double px = (orbit[2*i]-min_x)*scale_x;
+                double py = (orbit[2*i+1]-min_y)*scale_y;
+                if(px >= 0.0 && px < width && py >= 0.0 && py < height) {
+                    ++hits;
+                    if(buffer) {
+                        buffer->add(static_cast<int>(px), height-1-static_cast<int>(py), weight);
+                    }
+                }
+            }
+            return hits;
+        }
+
+        /**
+         * Estimate the view hits of each cell with samples_per_cell uniform
+         * samples, and turn them into power of two sampling weights
+         */
+        void build_importance_map(std::uint64_t samples_per_cell, std::uint64_t seed) {
+            const int max_its = map_.get_max_iterations();
+            std::vector<std::uint64_t> hits(grid_size*grid_size);
+            std::atomic<std::uint64_t> accepted(0);
+
+            std::vector<std::future<void>> rows;
+            for(int row=0; row<grid_size; ++row) {
+                rows.push_back(pool_.submit([&, row]() {
+                    std::mt19937_64 rng(seed*0x9e3779b97f4a7c15ull ^ (0x5bd1e995ull*(row+1)));
+                    std::uniform_real_distribution<double> offset(0.0, 1.0);
+                    std::vector<double> orbit(2*max_its);
+
+                    std::uint64_t row_accepted = 0;
+                    for(int column=0; column<grid_size; ++column) {
+                        for(std::uint64_t i=0; i<samples_per_cell; ++i) {
+                            std::uint64_t h = splat(cell_coordinate(column, offset(rng)), cell_coordinate(row, offset(rng)),
+                                orbit, nullptr, 0);
+                            hits[row*grid_size + column] += h;
+                            row_accepted += h > 0;
+                        }
+                    }
+                    accepted += row_accepted;
+                }));
+            }
+            for(auto& row: rows) {
+                row.get();
+            }
+            pilot_accepted_ = accepted;
+
+            std::uint64_t max_hits = *std::max_element(hits.begin(), hits.end());
+
+            cell_weights_.assign(grid_size*grid_size, 1);
+            for(int i=0; i<grid_size*grid_size; ++i) {
+                if(max_hits == 0 || hits[i] == 0) continue;
+                int level = static_cast<int>(std::log2(1.0 + hits[i]*((1u << max_level)-1.0)/max_hits));
+                cell_weights_[i] = 1u << std::min(level, max_level);
+            }
+        }
+
+        const henon_map<FLOAT_T>& map_;
+        ra::concurrency::thread_pool& pool_;
+
+        bool anti_;
+        int min_its_;
+
+        std::vector<std::uint32_t> cell_weights_;
+        std::uint64_t pilot_accepted_ = 0;
+        buddhabrot_stats stats_{0, 0, 0.0};
+    };
+}
+
+#endif
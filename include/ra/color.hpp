@@ -0,0 +1,51 @@
+/**
+ * Iteration count to color conversion for the CPU renderers:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_COLOR_HPP
+#define RA_FRACTAL_LOGIC_COLOR_HPP
+
+#include <cmath>
+#include <cstddef>
+
+#include "ra/profile.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Same palette as set_rgb in the fragment shaders, so that images written
+     * to files look like the GUI.
+     * 
+     * normalized_scalar: iteration count divided by max iterations
+     * rgb: three output bytes
+     */
+    inline void set_rgb(double normalized_scalar, unsigned char * rgb) {
+        double r = 1.0-normalized_scalar/2.0;
+        double g = std::sin(static_cast<float>(normalized_scalar)*3.14f);
+        double b = normalized_scalar/2.0;
+
+        //Shader output is clamped to [0,1] before being stored
+        auto to_byte = [](double c) {
+            c = c < 0.0 ? 0.0 : (c > 1.0 ? 1.0 : c);
+            return static_cast<unsigned char>(c*255.0 + 0.5);
+        };
+
+        rgb[0] = to_byte(r);
+        rgb[1] = to_byte(g);
+        rgb[2] = to_byte(b);
+    }
+
+    /**
+     * Convert num_pixels iteration counts to packed 8 bit rgb triples
+     */
+    inline void colorize(const int * its, std::size_t num_pixels, int max_its, unsigned char * rgb) {
+        RA_PROFILE_SCOPE("colorize");
+        const double scale = 1.0/max_its;
+        for(std::size_t i=0; i<num_pixels; ++i) {
+            set_rgb(its[i]*scale, rgb + 3*i);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,330 @@
+/**
+ * Orbit density (hit count) rendering, including the Henon strange attractor:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_DENSITY_HPP
+#define RA_FRACTAL_LOGIC_DENSITY_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "ra/henon.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Class: density_grid
+     *
+     * Description: 64 bit hit counts for a width*height image. Counts are
+     * stored in tile_size*tile_size tiles, each contiguous in memory. Workers
+     * bin their hits by tile in a hit_buffer, a few cache lines per tile, and
+     * a full bin is added to its tile under that tile's lock, so every flush
+     * touches one 32 KiB tile and several workers can flush at once as long
+     * as they are on different tiles.
+     */
+    class density_grid {
+
+        public:
+
+        using size_type = std::size_t;
+
+        static constexpr int tile_size = 64;
+
+        /**
+         * Class: hit_buffer
+         *
+         * Description: One worker's hits waiting to be added to a grid, in a
+         * bin of bin_size (offset in tile, weight) pairs per tile. Hits are
+         * added to the grid when their bin fills and by flush.
+         */
+        class hit_buffer {
+
+            public:
+
+            static constexpr int bin_size = 128;
+
+            explicit hit_buffer(density_grid& grid):
+                grid_(grid), hits_(grid.num_tiles()*bin_size), fill_(grid.num_tiles()) {}
+
+            /**
+             * Count image pixel (x, y), y = 0 is the top row, weight times
+             */
+            void add(int x, int y, std::uint16_t weight = 1) {
+                //Coordinates are never negative, unsigned division is a shift
+                unsigned ux = static_cast<unsigned>(x), uy = static_cast<unsigned>(y);
+                size_type tile = static_cast<size_type>(uy/tile_size)*grid_.tiles_x_ + ux/tile_size;
+                std::uint16_t offset = static_cast<std::uint16_t>((uy%tile_size)*tile_size + ux%tile_size);
+                hits_[tile*bin_size + fill_[tile]] = {offset, weight};
+                if(++fill_[tile] == bin_size) flush_tile(tile);
+            }
+
+            /**
+             * Add every waiting hit to the grid
+             */
+            void flush() {
+                for(size_type tile=0; tile<fill_.size(); ++tile) {
+                    if(fill_[tile] > 0) flush_tile(tile);
+                }
+            }
+
+            private:
+
+            struct hit {
+                std::uint16_t offset;
+                std::uint16_t weight;
+            };
+
+            void flush_tile(size_type tile) {
+                const hit * bin = hits_.data() + tile*bin_size;
+                std::scoped_lock lock(grid_.tile_locks_[tile]);
+                std::uint64_t * dst = grid_.counts_.data() + tile*tile_size*tile_size;
+                for(int i=0; i<fill_[tile]; ++i) {
+                    dst[bin[i].offset] += bin[i].weight;
+                }
+                fill_[tile] = 0;
+            }
+
+            density_grid& grid_;
+            std::vector<hit> hits_;
+            std::vector<int> fill_;
+        };
+
+        density_grid(int width, int height):
+            width_(width), height_(height),
+            tiles_x_((width+tile_size-1)/tile_size), tiles_y_((height+tile_size-1)/tile_size),
+            counts_(static_cast<size_type>(tiles_x_)*tiles_y_*tile_size*tile_size),
+            tile_locks_(new std::mutex[static_cast<size_type>(tiles_x_)*tiles_y_]) {}
+
+        int width() const {return width_;}
+        int height() const {return height_;}
+
+        //Number of entries including the padding of partial tiles
+        size_type size() const {return counts_.size();}
+
+        /**
+         * Position of image pixel (x, y) in the tiled layout, y = 0 is the top row
+         */
+        size_type index(int x, int y) const {
+            size_type tile = static_cast<size_type>(y/tile_size)*tiles_x_ + x/tile_size;
+            return tile*tile_size*tile_size + (y%tile_size)*tile_size + x%tile_size;
+        }
+
+        std::uint64_t at(int x, int y) const {return counts_[index(x, y)];}
+
+        std::uint64_t total() const {
+            std::uint64_t sum = 0;
+            for(auto count: counts_) sum += count;
+            return sum;
+        }
+
+        /**
+         * Run chunk(index, hit_buffer&) for index in [0, num_chunks) on the pool.
+         * The buffer is flushed after every chunk, and one buffer per worker
+         * is kept and reused. Counts are sums, so they do not depend on the
+         * order the chunks run in.
+         */
+        template<class CHUNK>
+        void accumulate(ra::concurrency::thread_pool& pool, std::uint64_t num_chunks, CHUNK&& chunk) {
+            std::mutex free_mutex;
+            std::vector<std::unique_ptr<hit_buffer>> free_buffers;
+
+            auto acquire = [&]() {
+                std::scoped_lock lock(free_mutex);
+                if(free_buffers.empty()) {
+                    return std::make_unique<hit_buffer>(*this);
+                }
+                auto b = std::move(free_buffers.back());
+                free_buffers.pop_back();
+                return b;
+            };
+
+            std::vector<std::future<void>> tasks;
+            tasks.reserve(num_chunks);
+            for(std::uint64_t i=0; i<num_chunks; ++i) {
+                tasks.push_back(pool.submit([&, i]() {
+                    auto local = acquire();
+                    chunk(i, *local);
+                    local->flush();
+
+                    std::scoped_lock lock(free_mutex);
+                    free_buffers.push_back(std::move(local));
+                }));
+            }
+
+            std::exception_ptr error;
+            for(auto& task: tasks) {
+                try {
+                    task.get();
+                } catch(...) {
+                    if(!error) error = std::current_exception();
+                }
+            }
+            if(error) std::rethrow_exception(error);
+        }
+
+        /**
+         * Log density tone mapping: log(1+count)/log(1+max count) scaled to
+         * [0, levels], in image order (top row first), so the result can be
+         * written by any of the iteration count sinks with max_its = levels.
+         */
+        std::vector<int> tone_map(int levels) const {
+            std::uint64_t max_count = *std::max_element(counts_.begin(), counts_.end());
+            double scale = max_count > 0 ? levels/std::log1p(static_cast<double>(max_count)) : 0.0;
+
+            std::vector<int> its(static_cast<size_type>(width_)*height_);
+            for(int y=0; y<height_; ++y) {
+                for(int x=0; x<width_; ++x) {
+                    its[static_cast<size_type>(y)*width_ + x] =
+                        static_cast<int>(std::lround(std::log1p(static_cast<double>(at(x, y)))*scale));
+                }
+            }
+            return its;
+        }
+
+        private:
+
+        size_type num_tiles() const {return static_cast<size_type>(tiles_x_)*tiles_y_;}
+
+        int width_, height_;
+        int tiles_x_, tiles_y_;
+
+        std::vector<std::uint64_t> counts_;
+        std::unique_ptr<std::mutex[]> tile_locks_;
+    };
+
+    /**
+     * Class: henon_attractor
+     *
+     * Description: Density image of the Henon strange attractor for the a
+     * and b of a henon_map, over its viewing rectangle. Random seeds near the
+     * origin are iterated in lanes of independent orbits, laid out as arrays
+     * so the map itself vectorizes; the first warmup iterations of each orbit
+     * are discarded so only points on the attractor are counted. Orbits
+     * leaving the threshold are restarted from a new seed.
+     */
+    template<class FLOAT_T>
+    class henon_attractor {
+
+        public:
+
+        static constexpr int lanes = 8;
+        static constexpr int warmup = 100;
+
+        //Points per chunk, each chunk seeding its own orbits
+        static constexpr std::uint64_t chunk_points = std::uint64_t(1) << 24;
+
+        henon_attractor(const henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool):
+            map_(map), pool_(pool), points_(0) {}
+
+        /**
+         * Iterate num_points points (after warmup) and return their hit counts.
+         * Results only depend on num_points and seed, not on the thread count.
+         * Fewer points are counted if most orbits escape, see points().
+         */
+        density_grid render(std::uint64_t num_points, std::uint64_t seed = 0) const {
+            const int width = map_.get_x_pixels();
+            const int height = map_.get_y_pixels();
+            density_grid grid(width, height);
+
+            const double min_x = map_.get_bottom_left().x, min_y = map_.get_bottom_left().y;
+            const double scale_x = width/static_cast<double>(map_.get_top_right().x - map_.get_bottom_left().x);
+            const double scale_y = height/static_cast<double>(map_.get_top_right().y - map_.get_bottom_left().y);
+
+            const std::uint64_t num_chunks = (num_points + chunk_points - 1)/chunk_points;
+
+            grid.accumulate(pool_, num_chunks, [&](std::uint64_t chunk, density_grid::hit_buffer& hits) {
+                points_ += iterate_chunk(num_points, chunk, seed, [&](double x, double y) {
+                    double px = (x-min_x)*scale_x;
+                    double py = (y-min_y)*scale_y;
+                    if(px >= 0.0 && px < width && py >= 0.0 && py < height) {
+                        hits.add(static_cast<int>(px), height-1-static_cast<int>(py));
+                    }
+                });
+            });
+
+            return grid;
+        }
+
+        /**
+         * Points counted by render so far, inside the view or not
+         */
+        std::uint64_t points() const {return points_.load();}
+
+        /**
+         * Pass the points of chunk (of num_points in chunks of chunk_points)
+         * to visit(x, y) and return how many there were, fewer than the
+         * chunk's share if orbits escape too often to find them in time.
+         * Chunks are independent of each other, so they can run on any
+         * thread, and only depend on seed and the chunk index.
+         */
+        template<class VISIT>
+        std::uint64_t iterate_chunk(std::uint64_t num_points, std::uint64_t chunk, std::uint64_t seed, VISIT&& visit) const {
+            const double a = map_.get_a(), b = map_.get_b();
+            const double threshold_squared = static_cast<double>(map_.get_threshold())*map_.get_threshold();
+
+            std::mt19937_64 rng(seed*0x9e3779b97f4a7c15ull + chunk);
+            std::uniform_real_distribution<double> start(-0.1, 0.1);
+
+            std::uint64_t points = std::min(chunk_points, num_points - chunk*chunk_points);
+            std::uint64_t steps = (points + lanes - 1)/lanes;
+            std::uint64_t remaining = points;
+
+            double x[lanes], y[lanes];
+            int skip[lanes];
+            for(int l=0; l<lanes; ++l) {
+                x[l] = start(rng);
+                y[l] = start(rng);
+                skip[l] = warmup;
+            }
+
+            //Bounded in case most orbits escape for these parameters
+            const std::uint64_t max_steps = 4*steps + 16*warmup;
+
+            for(std::uint64_t step=0; remaining > 0 && step < max_steps; ++step) {
+                //Advance every lane, independent so this vectorizes
+                for(int l=0; l<lanes; ++l) {
+                    double x_next = 1.0 - a*x[l]*x[l] + y[l];
+                    y[l] = b*x[l];
+                    x[l] = x_next;
+                }
+
+                for(int l=0; l<lanes && remaining > 0; ++l) {
+                    if(x[l]*x[l] + y[l]*y[l] > threshold_squared) {
+                        x[l] = start(rng);
+                        y[l] = start(rng);
+                        skip[l] = warmup;
+                        continue;
+                    }
+                    if(skip[l] > 0) {
+                        --skip[l];
+                        continue;
+                    }
+
+                    --remaining;
+                    visit(x[l], y[l]);
+                }
+            }
+
+            return points - remaining;
+        }
+
+        private:
+
+        const henon_map<FLOAT_T>& map_;
+        ra::concurrency::thread_pool& pool_;
+
+        mutable std::atomic<std::uint64_t> points_;
+    };
+}
+
+#endif
@@ -0,0 +1,271 @@
+/**
+ * Where the time of a render goes: per pixel cost, escape counts and band times:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_DIAGNOSTICS_HPP
+#define RA_FRACTAL_LOGIC_DIAGNOSTICS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ra/animation.hpp"
+#include "ra/band_renderer.hpp"
+#include "ra/henon.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Orbit steps a batch kernel runs for each of n points whose escape
+     * counts are its, added to steps. The lanes of a group step together
+     * until all have escaped, so every point of a group costs the steps of
+     * its slowest point.
+     */
+    inline void batch_steps(const int * its, std::size_t n, int lanes, int max_its, std::uint64_t * steps) {
+        for(std::size_t first=0; first<n; first+=lanes) {
+            const std::size_t last = std::min(n, first+lanes);
+            const int slowest = *std::max_element(its+first, its+last);
+            const std::uint64_t group = std::min(slowest+1, max_its);
+            for(std::size_t i=first; i<last; ++i) {
+                steps[i] += group;
+            }
+        }
+    }
+
+    /**
+     * Rows function of render_diagnostics::render for the map's own kernels,
+     * which iterate each row as one batch
+     */
+    template<class FLOAT_T>
+    auto cost_rows(const henon_map<FLOAT_T>& map) {
+        return [&map](int first_row, int num_rows, int * its, std::uint64_t * cost) {
+            map.render_rows(first_row, num_rows, its);
+
+            const int width = map.get_x_pixels();
+            for(int row=0; row<num_rows; ++row) {
+                const std::size_t offset = static_cast<std::size_t>(row)*width;
+                batch_steps(its + offset, width, map.batch_lanes(), map.get_max_iterations(), cost + offset);
+            }
+        };
+    }
+
+    /**
+     * Wall time of one band task, in seconds from the start of the render
+     */
+    struct band_timing {
+        int first_row;
+        int num_rows;
+        int thread;             //Worker which ran the band, numbered in order of first use
+        double start;
+        double seconds;
+        std::uint64_t steps;    //Orbit steps of the band's pixels
+    };
+
+    /**
+     * Class: render_diagnostics
+     *
+     * Description: Renders through a band_renderer while recording the orbit
+     * steps spent on each pixel, including those no escape count shows
+     * (lanes waiting on the slowest lane of their batch, extra supersamples),
+     * the histogram of escape counts and the wall time of every band. Values
+     * given to the sink are escape counts times value_scale.
+     */
+    class render_diagnostics {
+
+        public:
+
+        using clock = std::chrono::steady_clock;
+
+        render_diagnostics(int width, int height, int max_its, int value_scale = 1):
+            width_(width), height_(height), max_its_(max_its), value_scale_(std::max(1, value_scale)),
+            cost_(static_cast<std::size_t>(width)*height), histogram_(max_its+1),
+            bounded_steps_(0), escape_steps_(0) {}
+
+        /**
+         * Render to sink with rows(first_row, num_rows, its, cost), which
+         * writes values like band_renderer's rows and adds each pixel's
+         * steps to cost, zeroed beforehand. With rows(first_row, num_rows,
+         * its, cost, rgb) the rows also give the band's colors.
+         */
+        template<class FLOAT_T, class SINK, class ROWS>
+        void render(band_renderer<FLOAT_T>& renderer, SINK& sink, ROWS rows) {
+            start_ = clock::now();
+            if constexpr(std::is_invocable_v<ROWS&, int, int, int *, std::uint64_t *, unsigned char *>) {
+                renderer.render(sink, [this, &rows](int first_row, int num_rows, int * its, unsigned char * rgb) {
+                    band(first_row, num_rows, its, [&](std::uint64_t * cost) {
+                        rows(first_row, num_rows, its, cost, rgb);
+                    });
+                }, max_its_*value_scale_);
+            } else {
+                renderer.render(sink, [this, &rows](int first_row, int num_rows, int * its) {
+                    band(first_row, num_rows, its, [&](std::uint64_t * cost) {
+                        rows(first_row, num_rows, its, cost);
+                    });
+                }, max_its_*value_scale_);
+            }
+            seconds_ = std::chrono::duration<double>(clock::now() - start_).count();
+        }
+
+        int width() const {return width_;}
+        int height() const {return height_;}
+
+        //Orbit steps of each pixel, row major with the top row first
+        const std::vector<std::uint64_t>& cost() const {return cost_;}
+
+        //Pixels by escape count, max_its for those which never escaped
+        const std::vector<std::uint64_t>& histogram() const {return histogram_;}
+
+        //Band timings in row order
+        std::vector<band_timing> bands() const {
+            std::vector<band_timing> sorted = bands_;
+            std::sort(sorted.begin(), sorted.end(), [](const band_timing& a, const band_timing& b) {
+                return a.first_row < b.first_row;
+            });
+            return sorted;
+        }
+
+        std::uint64_t total_steps() const {return bounded_steps_ + escape_steps_;}
+
+        /**
+         * Cost as a frame of levels+1 levels, log scaled so that cheap regions
+         * stay visible next to the bounded ones
+         */
+        frame heatmap(int levels = 1024) const {
+            const std::uint64_t most = cost_.empty() ? 0 : *std::max_element(cost_.begin(), cost_.end());
+            const double scale = most > 0 ? levels/std::log1p(static_cast<double>(most)) : 0.0;
+
+            frame f{0, width_, height_, levels, std::vector<int>(cost_.size())};
+            for(std::size_t i=0; i<cost_.size(); ++i) {
+                f.its[i] = static_cast<int>(std::lround(std::log1p(static_cast<double>(cost_[i]))*scale));
+            }
+            return f;
+        }
+
+        /**
+         * CSV of the escape counts which occur, and their pixels
+         */
+        void write_histogram(std::ostream& os) const {
+            os << "escape_count,pixels\n";
+            for(int its=0; its<=max_its_; ++its) {
+                if(histogram_[its]) os << its << ',' << histogram_[its] << '\n';
+            }
+        }
+
+        /**
+         * CSV of the band timings in row order
+         */
+        void write_bands(std::ostream& os) const {
+            os << "first_row,rows,thread,start_ms,ms,steps\n" << std::fixed << std::setprecision(3);
+            for(const auto& b: bands()) {
+                os << b.first_row << ',' << b.num_rows << ',' << b.thread << ',' << b.start*1e3 << ','
+                    << b.seconds*1e3 << ',' << b.steps << '\n';
+            }
+        }
+
+        /**
+         * Where the cost lies: steps the escape counts do not account for,
+         * the share of bounded pixels, and the slowest bands
+         */
+        void write_summary(std::ostream& os) const {
+            const double pixels = static_cast<double>(width_)*height_;
+            const double steps = static_cast<double>(total_steps());
+
+            //Steps each escape count needs on its own
+            double counted = 0.0;
+            for(int its=0; its<=max_its_; ++its) {
+                counted += static_cast<double>(histogram_[its])*std::min(its+1, max_its_);
+            }
+
+            os << std::fixed << std::setprecision(2)
+                << "Render: " << seconds_*1e3 << " ms, " << total_steps() << " steps, " << steps/pixels << " per pixel, "
+                << (steps > 0.0 ? 100.0*(steps-counted)/steps : 0.0) << "% beyond the escape counts" << '\n'
+                << "Bounded pixels: " << 100.0*histogram_[max_its_]/pixels << "% of pixels, "
+                << (steps > 0.0 ? 100.0*bounded_steps_/steps : 0.0) << "% of steps" << '\n';
+
+            auto sorted = bands_;
+            if(sorted.empty()) return;
+            std::sort(sorted.begin(), sorted.end(), [](const band_timing& a, const band_timing& b) {
+                return a.seconds > b.seconds;
+            });
+
+            double total = 0.0, slowest_tenth = 0.0;
+            const std::size_t tenth = std::max<std::size_t>(1, sorted.size()/10);
+            for(std::size_t i=0; i<sorted.size(); ++i) {
+                total += sorted[i].seconds;
+                if(i < tenth) slowest_tenth += sorted[i].seconds;
+            }
+            const double median = sorted[sorted.size()/2].seconds;
+
+            os << "Bands: " << sorted.size() << ", median " << median*1e3 << " ms, slowest rows "
+                << sorted.front().first_row << '-' << sorted.front().first_row + sorted.front().num_rows - 1
+                << " at " << sorted.front().seconds*1e3 << " ms (" << (median > 0.0 ? sorted.front().seconds/median : 0.0)
+                << "x median), slowest " << tenth << " take " << (total > 0.0 ? 100.0*slowest_tenth/total : 0.0)
+                << "% of band time" << '\n';
+        }
+
+        private:
+
+        //Render one band with rows(cost) and record its cost and time
+        template<class ROWS>
+        void band(int first_row, int num_rows, const int * its, ROWS rows) {
+            const auto begin = clock::now();
+            std::uint64_t * cost = cost_.data() + static_cast<std::size_t>(first_row)*width_;
+            std::fill(cost, cost + static_cast<std::size_t>(num_rows)*width_, 0);
+
+            rows(cost);
+            record(first_row, num_rows, its, cost, begin, clock::now());
+        }
+
+        void record(int first_row, int num_rows, const int * its, const std::uint64_t * cost,
+            clock::time_point begin, clock::time_point end) {
+
+            const std::size_t n = static_cast<std::size_t>(num_rows)*width_;
+            std::vector<std::uint64_t> counts(max_its_+1);
+            std::uint64_t bounded = 0, escaped = 0;
+            for(std::size_t i=0; i<n; ++i) {
+                const int escape = std::min(max_its_, static_cast<int>(std::lround(static_cast<double>(its[i])/value_scale_)));
+                ++counts[escape];
+                (escape == max_its_ ? bounded : escaped) += cost[i];
+            }
+
+            std::scoped_lock lock(mutex_);
+            for(int escape=0; escape<=max_its_; ++escape) {
+                histogram_[escape] += counts[escape];
+            }
+            bounded_steps_ += bounded;
+            escape_steps_ += escaped;
+
+            auto [thread, added] = threads_.emplace(std::this_thread::get_id(), static_cast<int>(threads_.size()));
+            (void)added;
+            bands_.push_back({first_row, num_rows, thread->second,
+                std::chrono::duration<double>(begin - start_).count(),
+                std::chrono::duration<double>(end - begin).count(), bounded + escaped});
+        }
+
+        int width_, height_;
+        int max_its_;
+        int value_scale_;
+
+        std::vector<std::uint64_t> cost_;
+
+        std::mutex mutex_;
+        std::vector<std::uint64_t> histogram_;
+        std::uint64_t bounded_steps_, escape_steps_;
+        std::vector<band_timing> bands_;
+        std::map<std::thread::id, int> threads_;
+
+        clock::time_point start_;
+        double seconds_ = 0.0;
+    };
+}
+
+#endif
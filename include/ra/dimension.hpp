@@ -0,0 +1,293 @@
+/**
+ * Box counting (capacity) dimension of the Henon strange attractor:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_DIMENSION_HPP
+#define RA_FRACTAL_LOGIC_DIMENSION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "ra/density.hpp"
+#include "ra/henon.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Occupied boxes at one level: the view split into 2^level by 2^level boxes
+     */
+    struct box_count {
+        int level;
+        std::uint64_t boxes;
+        bool complete;      //false if a hashed level ran out of room
+    };
+
+    /**
+     * Least squares fit of log(boxes) against level*log(2)
+     */
+    struct dimension_fit {
+        double dimension;
+        double standard_error;
+        double r_squared;
+        int first_level, last_level;    //Levels used, last_level < first_level if none
+    };
+
+    /**
+     * Class: box_occupancy
+     *
+     * Description: Occupied boxes of a 2^max_level by 2^max_level grid and of
+     * every coarser grid, each box of level k being a 2x2 block of level k+1.
+     * Levels up to bitset_levels are bitsets of 4^level bits; finer levels
+     * are lock-free open addressing hash sets of at most max_hashed_boxes
+     * boxes, so memory stays bounded however fine the grid. Insertion is
+     * thread safe.
+     */
+    class box_occupancy {
+
+        public:
+
+        box_occupancy(int max_level = 16, int bitset_levels = 12, std::uint64_t max_hashed_boxes = 1u << 20):
+            max_level_(max_level), bitset_levels_(std::min(bitset_levels, max_level)) {
+
+            if(max_level_ < 1 || max_level_ > 31 || bitset_levels_ > 14) {
+                throw std::invalid_argument("Unsupported box counting levels");
+            }
+
+            levels_.reserve(max_level_+1);
+            for(int level=0; level<=max_level_; ++level) {
+                auto& l = levels_.emplace_back();
+                if(level <= bitset_levels_) {
+                    std::uint64_t words = std::max<std::uint64_t>(1, (std::uint64_t(1) << 2*level)/64);
+                    l.size_bits = 0;
+                    l.slots.reset(new std::atomic<std::uint64_t>[words]);
+                    std::fill(l.slots.get(), l.slots.get()+words, 0);
+                } else {
+                    //Table twice the size of its limit keeps probe sequences short
+                    int bits = 1;
+                    while((std::uint64_t(1) << bits) < 2*max_hashed_boxes) ++bits;
+                    l.size_bits = bits;
+                    l.limit = max_hashed_boxes;
+                    l.slots.reset(new std::atomic<std::uint64_t>[std::uint64_t(1) << bits]);
+                    std::fill(l.slots.get(), l.slots.get()+(std::uint64_t(1) << bits), 0);
+                }
+            }
+        }
+
+        int max_level() const {return max_level_;}
+
+        /**
+         * Mark box (x, y) of the finest level, 0 <= x, y < 2^max_level, and
+         * the boxes containing it at every coarser level
+         */
+        void insert(std::uint32_t x, std::uint32_t y) {
+            //A box seen before has all its parents marked, so stop at the first known one
+            for(int level=max_level_; level>=0; --level) {
+                int shift = max_level_-level;
+                std::uint64_t key = (static_cast<std::uint64_t>(x >> shift) << level) | (y >> shift);
+                if(insert(levels_[level], key) == present) {
+                    return;
+                }
+            }
+        }
+
+        std::vector<box_count> counts() const {
+            std::vector<box_count> result;
+            for(int level=0; level<=max_level_; ++level) {
+                const auto& l = levels_[level];
+                if(level <= bitset_levels_) {
+                    std::uint64_t words = std::max<std::uint64_t>(1, (std::uint64_t(1) << 2*level)/64);
+                    std::uint64_t boxes = 0;
+                    for(std::uint64_t w=0; w<words; ++w) {
+                        boxes += __builtin_popcountll(l.slots[w].load(std::memory_order_relaxed));
+                    }
+                    result.push_back({level, boxes, true});
+                } else {
+                    result.push_back({level, l.count.load(), !l.full.load()});
+                }
+            }
+            return result;
+        }
+
+        private:
+
+        enum insert_result {inserted, present, unknown};
+
+        struct level_set {
+            int size_bits = 0;  //log2 of the hash table size, 0 for bitsets
+            std::uint64_t limit = 0;
+            std::unique_ptr<std::atomic<std::uint64_t>[]> slots;
+            std::atomic<std::uint64_t> count{0};
+            std::atomic<bool> full{false};
+
+            level_set() = default;
+            level_set(level_set&& other) noexcept:
+                size_bits(other.size_bits), limit(other.limit), slots(std::move(other.slots)),
+                count(other.count.load()), full(other.full.load()) {}
+        };
+
+        insert_result insert(level_set& l, std::uint64_t key) {
+            if(l.size_bits == 0) {
+                std::uint64_t bit = std::uint64_t(1) << (key%64);
+                auto& word = l.slots[key/64];
+                //Plain load first, most boxes are already marked
+                if(word.load(std::memory_order_relaxed) & bit) return present;
+                return (word.fetch_or(bit, std::memory_order_relaxed) & bit) ? present : inserted;
+            }
+
+            //Keys are stored plus one so that zero marks an empty slot
+            const std::uint64_t stored = key+1;
+            const std::uint64_t mask = (std::uint64_t(1) << l.size_bits) - 1;
+            std::uint64_t slot = (key*0x9e3779b97f4a7c15ull) >> (64-l.size_bits);
+
+            for(;;) {
+                std::uint64_t current = l.slots[slot].load(std::memory_order_relaxed);
+                if(current == stored) return present;
+                if(current == 0) {
+                    //A new box with no room left makes the level's count a lower bound
+                    if(l.count.load(std::memory_order_relaxed) >= l.limit) {
+                        l.full.store(true, std::memory_order_relaxed);
+                        return unknown;
+                    }
+                    if(l.slots[slot].compare_exchange_strong(current, stored, std::memory_order_relaxed)) {
+                        l.count.fetch_add(1, std::memory_order_relaxed);
+                        return inserted;
+                    }
+                    if(current == stored) return present;
+                }
+                slot = (slot+1) & mask;
+            }
+        }
+
+        int max_level_;
+        int bitset_levels_;
+        std::vector<level_set> levels_;
+    };
+
+    /**
+     * Class: box_dimension
+     *
+     * Description: Estimates the box counting dimension of the Henon
+     * attractor for the a and b of a henon_map. Orbit points are generated
+     * in parallel chunks by henon_attractor and recorded in a box_occupancy
+     * over the henon_map's view, which should enclose the attractor.
+     */
+    template<class FLOAT_T>
+    class box_dimension {
+
+        public:
+
+        box_dimension(const henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool,
+            int max_level = 16, int bitset_levels = 12, std::uint64_t max_hashed_boxes = 1u << 20):
+            map_(map), pool_(pool), attractor_(map, pool),
+            max_level_(max_level), bitset_levels_(bitset_levels), max_hashed_boxes_(max_hashed_boxes), points_(0) {}
+
+        /**
+         * Box counts at every level after num_points orbit points, or fewer
+         * if most orbits escape, see points()
+         */
+        std::vector<box_count> count(std::uint64_t num_points, std::uint64_t seed = 0) const {
+            box_occupancy boxes(max_level_, bitset_levels_, max_hashed_boxes_);
+
+            const double cells = std::ldexp(1.0, max_level_);
+            const double min_x = map_.get_bottom_left().x, min_y = map_.get_bottom_left().y;
+            const double scale_x = cells/static_cast<double>(map_.get_top_right().x - map_.get_bottom_left().x);
+            const double scale_y = cells/static_cast<double>(map_.get_top_right().y - map_.get_bottom_left().y);
+
+            const std::uint64_t chunk_points = henon_attractor<FLOAT_T>::chunk_points;
+            const std::uint64_t num_chunks = (num_points + chunk_points - 1)/chunk_points;
+
+            std::vector<std::future<void>> chunks;
+            chunks.reserve(num_chunks);
+            for(std::uint64_t chunk=0; chunk<num_chunks; ++chunk) {
+                chunks.push_back(pool_.submit([&, chunk]() {
+                    points_ += attractor_.iterate_chunk(num_points, chunk, seed, [&](double x, double y) {
+                        double px = (x-min_x)*scale_x;
+                        double py = (y-min_y)*scale_y;
+                        if(px >= 0.0 && px < cells && py >= 0.0 && py < cells) {
+                            boxes.insert(static_cast<std::uint32_t>(px), static_cast<std::uint32_t>(py));
+                        }
+                    });
+                }));
+            }
+            for(auto& chunk: chunks) {
+                chunk.get();
+            }
+
+            return boxes.counts();
+        }
+
+        /**
+         * Orbit points counted so far
+         */
+        std::uint64_t points() const {return points_.load();}
+
+        /**
+         * Fit the slope of log(boxes) against log(2^level) over the levels with
+         * at least min_boxes boxes, complete counts, and at least
+         * points_per_box points per box on average so they are not undersampled.
+         * The standard error is that of the least squares slope.
+         */
+        static dimension_fit fit(const std::vector<box_count>& counts, std::uint64_t num_points,
+            std::uint64_t min_boxes = 64, double points_per_box = 16.0) {
+
+            std::vector<double> xs, ys;
+            dimension_fit result{0.0, 0.0, 0.0, 0, -1};
+            for(const auto& c: counts) {
+                if(!c.complete || c.boxes < min_boxes || c.boxes*points_per_box > num_points) continue;
+                if(xs.empty()) result.first_level = c.level;
+                result.last_level = c.level;
+                xs.push_back(c.level*std::log(2.0));
+                ys.push_back(std::log(static_cast<double>(c.boxes)));
+            }
+
+            const std::size_t n = xs.size();
+            if(n < 2) {
+                result.dimension = std::nan("");
+                result.standard_error = std::nan("");
+                result.r_squared = std::nan("");
+                return result;
+            }
+
+            double mean_x = 0, mean_y = 0;
+            for(std::size_t i=0; i<n; ++i) {
+                mean_x += xs[i]/n;
+                mean_y += ys[i]/n;
+            }
+
+            double sxx = 0, sxy = 0, syy = 0;
+            for(std::size_t i=0; i<n; ++i) {
+                sxx += (xs[i]-mean_x)*(xs[i]-mean_x);
+                sxy += (xs[i]-mean_x)*(ys[i]-mean_y);
+                syy += (ys[i]-mean_y)*(ys[i]-mean_y);
+            }
+
+            result.dimension = sxy/sxx;
+            double residual = std::max(0.0, syy - result.dimension*sxy);
+            result.standard_error = n > 2 ? std::sqrt(residual/(n-2)/sxx) : 0.0;
+            result.r_squared = syy > 0 ? 1.0 - residual/syy : 1.0;
+            return result;
+        }
+
+        private:
+
+        const henon_map<FLOAT_T>& map_;
+        ra::concurrency::thread_pool& pool_;
+        henon_attractor<FLOAT_T> attractor_;
+
+        int max_level_;
+        int bitset_levels_;
+        std::uint64_t max_hashed_boxes_;
+
+        mutable std::atomic<std::uint64_t> points_;
+    };
+}
+
+#endif
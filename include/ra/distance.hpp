@@ -0,0 +1,240 @@
+/**
+ * Distance estimate images and edge-adaptive supersampling:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_DISTANCE_HPP
+#define RA_FRACTAL_LOGIC_DISTANCE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "ra/area.hpp"
+#include "ra/color.hpp"
+#include "ra/henon.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Class: distance_field
+     *
+     * Description: Distance estimates of the pixels of a henon_map's view,
+     * in pixel widths, quantized for the image sinks with max_its = levels:
+     * escaping points map to the upper half, bounded points with an interior
+     * estimate to the lower half, both moving away from levels/2 on a log
+     * scale as the distance to the boundary grows.
+     */
+    template<class FLOAT_T>
+    class distance_field {
+
+        public:
+
+        //Distance in pixels mapped to either end of the palette
+        static constexpr double max_pixels = 256.0;
+
+        distance_field(const henon_map<FLOAT_T>& map, int levels = 1024):
+            map_(map), levels_(std::max(2, levels)) {}
+
+        void render_rows(int first_row, int num_rows, int * its) const {
+            const double pixel = pixel_size(map_);
+            const int half = levels_/2;
+
+            for(int row=first_row; row<first_row+num_rows; ++row) {
+                int y = map_.get_y_pixels()-1-row;
+                for(int x=0; x<map_.get_x_pixels(); ++x) {
+                    auto e = map_.compute_distance(map_.map_to_cartesian_plane(x, y));
+                    double s = std::min(1.0, std::log1p(e.distance/pixel)/std::log1p(max_pixels));
+                    int offset = static_cast<int>(std::lround(s*half));
+                    *its++ = (e.its < map_.get_max_iterations()) ? half + offset : half - offset;
+                }
+            }
+        }
+
+        int levels() const {return levels_;}
+
+        /**
+         * Smaller of the horizontal and vertical spacing of pixel centers
+         */
+        static double pixel_size(const henon_map<FLOAT_T>& map) {
+            return std::min(
+                static_cast<double>(map.get_top_right().x - map.get_bottom_left().x)/std::max(1, map.get_x_pixels()-1),
+                static_cast<double>(map.get_top_right().y - map.get_bottom_left().y)/std::max(1, map.get_y_pixels()-1));
+        }
+
+        private:
+
+        const henon_map<FLOAT_T>& map_;
+        int levels_;
+    };
+
+    /**
+     * Class: adaptive_supersampler
+     *
+     * Description: Anti-aliased iteration counts of a henon_map's view. Every
+     * pixel center is sampled once with its distance estimate. A pixel is
+     * an edge if a 4-neighbour differs by more than contrast*max_its or lies
+     * on the other side of the boundary, or if its distance estimate puts the
+     * boundary within a pixel. Only edge pixels take more samples, at
+     * randomly shifted Sobol offsets within the pixel and four at a time,
+     * until the mean moves by at most tolerance*max_its or max_samples is
+     * reached. With adaptive off, every pixel takes max_samples samples at
+     * the same offsets, which is uniform supersampling.
+     *
+     * Values are mean iteration counts times scale, so render_rows can be
+     * streamed by band_renderer with max_its = levels(). Since the palette is
+     * not monotone in the count, the color of a mean count is not the mean
+     * color, so render_rows also gives each pixel's mean sample color in
+     * rgb for the image sinks.
+     *
+     * render_rows can also add the orbit steps spent on each pixel to cost:
+     * its center and extra samples, and for the first and last rows of the
+     * band the centers of the neighbour rows they were compared with.
+     */
+    template<class FLOAT_T>
+    class adaptive_supersampler {
+
+        public:
+
+        static constexpr int scale = 16;
+
+        adaptive_supersampler(const henon_map<FLOAT_T>& map, int max_samples = 64, bool adaptive = true,
+            double contrast = 0.01, double tolerance = 0.002):
+            map_(map), max_samples_(std::max(1, max_samples)), adaptive_(adaptive),
+            contrast_(contrast), tolerance_(tolerance), samples_(0) {}
+
+        void render_rows(int first_row, int num_rows, int * its, std::uint64_t * cost = nullptr,
+            unsigned char * rgb = nullptr) const {
+            const int width = map_.get_x_pixels();
+            const int height = map_.get_y_pixels();
+            const int max_its = map_.get_max_iterations();
+            const double inverse_max_its = 1.0/max_its;
+
+            const double dx = static_cast<double>(map_.get_top_right().x - map_.get_bottom_left().x)/std::max(1, width-1);
+            const double dy = static_cast<double>(map_.get_top_right().y - map_.get_bottom_left().y)/std::max(1, height-1);
+            const double pixel = std::min(dx, dy);
+
+            //Centers of the band plus a row above and below for the neighbour tests
+            const int halo_first = std::max(0, first_row-1);
+            const int halo_last = std::min(height, first_row+num_rows+1);
+            std::vector<escape_distance> centers(static_cast<std::size_t>(halo_last-halo_first)*width);
+
+            std::uint64_t samples = 0;
+            for(int row=halo_first; row<halo_last; ++row) {
+                for(int x=0; x<width; ++x) {
+                    centers[static_cast<std::size_t>(row-halo_first)*width + x] =
+                        (adaptive_ && max_samples_ > 1)
+                            ? map_.compute_distance(map_.map_to_cartesian_plane(x, height-1-row))
+                            : escape_distance{map_.compute_iterations(map_.map_to_cartesian_plane(x, height-1-row)), 0.0};
+                    ++samples;
+                }
+            }
+
+            auto center = [&](int x, int row) -> const escape_distance& {
+                return centers[static_cast<std::size_t>(row-halo_first)*width + x];
+            };
+
+            //The escape loop stops one step after the last counted iteration
+            auto steps = [max_its](int its) -> std::uint64_t {return std::min(its+1, max_its);};
+
+            if(cost) {
+                for(int x=0; x<width; ++x) {
+                    if(halo_first < first_row) {
+                        cost[x] += steps(center(x, halo_first).its);
+                    }
+                    if(halo_last > first_row+num_rows) {
+                        cost[static_cast<std::size_t>(num_rows-1)*width + x] += steps(center(x, halo_last-1).its);
+                    }
+                }
+            }
+
+            for(int row=first_row; row<first_row+num_rows; ++row) {
+                for(int x=0; x<width; ++x) {
+                    const escape_distance& c = center(x, row);
+
+                    bool edge = !adaptive_;
+                    if(adaptive_ && max_samples_ > 1) {
+                        edge = c.distance > 0.0 && c.distance < pixel;
+
+                        const int neighbours[4][2] = {{x-1, row}, {x+1, row}, {x, row-1}, {x, row+1}};
+                        for(const auto& n: neighbours) {
+                            if(n[0] < 0 || n[0] >= width || n[1] < halo_first || n[1] >= halo_last) continue;
+                            int other = center(n[0], n[1]).its;
+                            edge = edge || std::abs(other - c.its) > contrast_*max_its
+                                || ((other == max_its) != (c.its == max_its));
+                        }
+                    }
+
+                    double color[3] = {};
+                    auto add_color = [&](int sample) {
+                        if(!rgb) return;
+                        unsigned char sample_rgb[3];
+                        set_rgb(sample*inverse_max_its, sample_rgb);
+                        for(int i=0; i<3; ++i) color[i] += sample_rgb[i];
+                    };
+
+                    double mean = c.its;
+                    std::uint64_t pixel_cost = steps(c.its);
+                    int n = 1;
+                    add_color(c.its);
+                    if(edge && max_samples_ > 1) {
+                        auto p = map_.map_to_cartesian_plane(x, height-1-row);
+                        double sum = c.its;
+                        while(n < max_samples_) {
+                            int batch_end = std::min(max_samples_, n+4);
+                            for(; n<batch_end; ++n) {
+                                //Shift makes offset 0 the center, already sampled
+                                auto [u, v] = sobol_2d(static_cast<std::uint32_t>(n));
+                                double ox = std::ldexp(static_cast<double>(u ^ (1u << 31)), -32) - 0.5;
+                                double oy = std::ldexp(static_cast<double>(v ^ (1u << 31)), -32) - 0.5;
+                                int sample = map_.compute_iterations(point<FLOAT_T>(p.x + ox*dx, p.y + oy*dy));
+                                sum += sample;
+                                pixel_cost += steps(sample);
+                                add_color(sample);
+                            }
+
+                            double next = sum/n;
+                            bool converged = adaptive_ && n >= 8 && std::abs(next-mean) <= tolerance_*max_its;
+                            mean = next;
+                            if(converged) break;
+                        }
+                        samples += n-1;
+                    }
+
+                    if(cost) {
+                        cost[static_cast<std::size_t>(row-first_row)*width + x] += pixel_cost;
+                    }
+                    *its++ = static_cast<int>(std::lround(mean*scale));
+                    if(rgb) {
+                        for(int i=0; i<3; ++i) {
+                            *rgb++ = static_cast<unsigned char>(std::lround(color[i]/n));
+                        }
+                    }
+                }
+            }
+
+            samples_ += samples;
+        }
+
+        int levels() const {return map_.get_max_iterations()*scale;}
+
+        /**
+         * Kernel evaluations so far, including the neighbour rows of each band
+         */
+        std::uint64_t samples() const {return samples_.load();}
+
+        private:
+
+        const henon_map<FLOAT_T>& map_;
+        int max_samples_;
+        bool adaptive_;
+        double contrast_, tolerance_;
+
+        mutable std::atomic<std::uint64_t> samples_;
+    };
+}
+
+#endif
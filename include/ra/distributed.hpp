@@ -0,0 +1,413 @@
+/**
+ * Rendering bands of an image on worker processes over sockets:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_IO_DISTRIBUTED_HPP
+#define RA_IO_DISTRIBUTED_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include "ra/band_renderer.hpp"
+#include "ra/henon.hpp"
+#include "ra/socket.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::io {
+
+    /**
+     * Iteration counts of a band as zlib compressed little endian int32s,
+     * the payload of a worker's answer
+     */
+    inline std::string compress_band(const std::vector<int>& its) {
+        std::string raw(4*its.size(), '\0');
+        for(std::size_t i=0; i<its.size(); ++i) {
+            std::uint32_t v = static_cast<std::uint32_t>(its[i]);
+            raw[4*i] = static_cast<char>(v);
+            raw[4*i+1] = static_cast<char>(v >> 8);
+            raw[4*i+2] = static_cast<char>(v >> 16);
+            raw[4*i+3] = static_cast<char>(v >> 24);
+        }
+
+        uLongf length = compressBound(raw.size());
+        std::string packed(length, '\0');
+        if(compress2(reinterpret_cast<Bytef *>(packed.data()), &length,
+            reinterpret_cast<const Bytef *>(raw.data()), raw.size(), Z_BEST_SPEED) != Z_OK) {
+            throw std::runtime_error("Could not compress band");
+        }
+        packed.resize(length);
+        return packed;
+    }
+
+    inline std::vector<int> decompress_band(const std::string& packed, std::size_t num_pixels) {
+        std::string raw(4*num_pixels, '\0');
+        uLongf length = raw.size();
+        if(uncompress(reinterpret_cast<Bytef *>(raw.data()), &length,
+            reinterpret_cast<const Bytef *>(packed.data()), packed.size()) != Z_OK || length != raw.size()) {
+            throw std::runtime_error("Corrupt band from worker");
+        }
+
+        std::vector<int> its(num_pixels);
+        for(std::size_t i=0; i<num_pixels; ++i) {
+            const unsigned char * b = reinterpret_cast<const unsigned char *>(raw.data()) + 4*i;
+            its[i] = static_cast<int>(b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<std::uint32_t>(b[3]) << 24));
+        }
+        return its;
+    }
+
+    struct coordinator_stats {
+        std::uint64_t bands;        //Bands received from workers
+        std::uint64_t requeued;     //Bands handed out again after their worker was lost
+        std::uint64_t workers;      //Worker connections accepted
+        std::uint64_t lost;         //Workers which went away or timed out holding bands
+    };
+
+    /**
+     * Class: render_coordinator
+     *
+     * Description: Renders the view of a henon_map on worker processes and
+     * streams it to a band sink, like band_renderer does with threads.
+     *
+     * Workers (render_worker) connect to the coordinator's socket at any
+     * time. A worker is sent the view once, as the line
+     *   view <width> <height> <max_its> <a> <b> <threshold> <min x> <min y> <max x> <max y> <fractal>
+     * then bands as "band <first row> <rows>", at most per_worker at once so
+     * it never idles between bands. It answers each band in order with
+     * "<first row> ok <bytes>" and the compressed counts. A worker whose
+     * connection fails, or which answers nothing for worker_timeout seconds,
+     * is dropped and its bands are queued again for the others. Finished
+     * bands are encoded on the pool and written in row order, with at most
+     * window bands between the oldest unwritten band and the newest handed
+     * out, which bounds memory. When the image is done every worker gets
+     * "done". A coordinator listens for one render, and gives up with
+     * std::runtime_error once no worker has been connected for
+     * worker_timeout seconds.
+     */
+    template<class FLOAT_T>
+    class render_coordinator {
+
+        public:
+
+        render_coordinator(const ra::fractal_logic::henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool,
+            int band_height = 64, int window = 256, int per_worker = 2, double worker_timeout = 60.0):
+            map_(map), pool_(pool), band_height_(std::max(1, band_height)), window_(std::max(1, window)),
+            per_worker_(std::max(1, per_worker)), worker_timeout_(worker_timeout), stats_{0, 0, 0, 0} {}
+
+        void listen(const std::string& address) {
+            listener_ = stream_socket::listen(address);
+        }
+
+        coordinator_stats stats() const {
+            std::scoped_lock lock(mutex_);
+            return stats_;
+        }
+
+        template<class SINK>
+        void render(SINK& sink) {
+            using chunk_type = decltype(sink.encode(std::declval<const ra::fractal_logic::band_view&>()));
+
+            const int width = map_.get_x_pixels();
+            const int height = map_.get_y_pixels();
+            const int max_its = map_.get_max_iterations();
+            const int num_bands = (height + band_height_ - 1)/band_height_;
+            const std::string view = view_line();
+
+            //Shared with the worker handlers, guarded by mutex_
+            std::deque<int> queue;
+            std::map<int, std::future<chunk_type>> done;
+            int released = 0, written = 0;
+            bool finished = false;
+            std::vector<std::shared_ptr<stream_socket>> workers;
+            int connected = 0;
+            auto idle_since = std::chrono::steady_clock::now();     //Since connected became 0
+
+            auto release = [&]() {
+                for(; released < num_bands && released < written + window_; ++released) {
+                    queue.push_back(released);
+                }
+            };
+
+            auto handle = [&](std::shared_ptr<stream_socket> worker) {
+                std::deque<int> outstanding;
+                auto lose = [&]() {
+                    //A slow worker must not go on with bands now given to others
+                    worker->shutdown();
+                    std::scoped_lock lock(mutex_);
+                    if(!outstanding.empty()) ++stats_.lost;
+                    stats_.requeued += outstanding.size();
+                    queue.insert(queue.begin(), outstanding.begin(), outstanding.end());
+                    changed_.notify_all();
+                };
+
+                try {
+                    worker->set_receive_timeout(worker_timeout_);
+                    worker->write_all(view);
+
+                    for(;;) {
+                        std::string jobs;
+                        {
+                            std::unique_lock lock(mutex_);
+                            changed_.wait(lock, [&]() {return finished || !queue.empty() || !outstanding.empty();});
+                            if(finished && outstanding.empty()) break;
+                            while(static_cast<int>(outstanding.size()) < per_worker_ && !queue.empty()) {
+                                int band = queue.front();
+                                queue.pop_front();
+                                outstanding.push_back(band);
+                                jobs += "band " + std::to_string(band*band_height_) + " "
+                                    + std::to_string(std::min(band_height_, height - band*band_height_)) + "\n";
+                            }
+                        }
+                        worker->write_all(jobs);
+
+                        std::string line, payload;
+                        std::istringstream is;
+                        int first_row = -1;
+                        std::string status;
+                        std::size_t length = 0;
+                        if(!worker->read_line(line)) throw std::runtime_error("Worker lost");
+                        is.str(line);
+                        if(!(is >> first_row >> status >> length) || status != "ok"
+                            || first_row != outstanding.front()*band_height_ || !worker->read_exact(payload, length)) {
+                            throw std::runtime_error("Bad answer from worker");
+                        }
+
+                        const int band = outstanding.front();
+                        const int num_rows = std::min(band_height_, height - first_row);
+                        auto its = std::make_shared<std::vector<int>>(
+                            decompress_band(payload, static_cast<std::size_t>(num_rows)*width));
+
+                        std::scoped_lock lock(mutex_);
+                        outstanding.pop_front();
+                        ++stats_.bands;
+                        done[band] = pool_.submit([&sink, its, first_row, num_rows, width, max_its]() {
+                            return sink.encode(ra::fractal_logic::band_view{first_row, num_rows, width, max_its, its->data()});
+                        });
+                        changed_.notify_all();
+                    }
+                    worker->write_all("done\n");
+                } catch(std::exception&) {
+                    lose();
+                }
+
+                std::scoped_lock lock(mutex_);
+                if(--connected == 0) idle_since = std::chrono::steady_clock::now();
+                changed_.notify_all();
+            };
+
+            sink.begin(width, height, max_its);
+            {
+                std::scoped_lock lock(mutex_);
+                release();
+            }
+
+            std::vector<std::thread> handlers;
+            std::thread acceptor([&]() {
+                auto stopping = [&]() {
+                    std::scoped_lock lock(mutex_);
+                    return finished;
+                };
+                accept_connections(listener_, stopping, [&](stream_socket&& socket) {
+                    auto worker = std::make_shared<stream_socket>(std::move(socket));
+                    std::scoped_lock lock(mutex_);
+                    if(finished) return;
+                    ++stats_.workers;
+                    ++connected;
+                    workers.push_back(worker);
+                    handlers.emplace_back(handle, worker);
+                });
+            });
+
+            auto stop = [&](bool abort) {
+                {
+                    std::scoped_lock lock(mutex_);
+                    finished = true;
+                    if(abort) {
+                        for(auto& worker: workers) worker->shutdown();
+                    }
+                    changed_.notify_all();
+                }
+                listener_.shutdown();
+                acceptor.join();
+                for(auto& handler: handlers) {
+                    handler.join();
+                }
+                listener_ = stream_socket();
+            };
+
+            try {
+                for(int band=0; band<num_bands; ++band) {
+                    std::future<chunk_type> chunk;
+                    {
+                        std::unique_lock lock(mutex_);
+                        const auto timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(worker_timeout_));
+                        while(done.count(band) == 0) {
+                            if(connected > 0) {
+                                changed_.wait(lock);
+                            } else if(changed_.wait_until(lock, idle_since + timeout) == std::cv_status::timeout
+                                && connected == 0 && done.count(band) == 0) {
+                                throw std::runtime_error("No worker connected for " + std::to_string(worker_timeout_) + " s");
+                            }
+                        }
+                        chunk = std::move(done[band]);
+                        done.erase(band);
+                    }
+                    sink.write(chunk.get());
+
+                    std::scoped_lock lock(mutex_);
+                    ++written;
+                    release();
+                    changed_.notify_all();
+                }
+            } catch(...) {
+                //Encoders reference the sink, so they must finish before unwinding
+                stop(true);
+                for(auto& [band, chunk]: done) {
+                    chunk.wait();
+                }
+                throw;
+            }
+
+            stop(false);
+            sink.end();
+        }
+
+        private:
+
+        std::string view_line() const {
+            std::ostringstream os;
+            os << std::setprecision(std::numeric_limits<FLOAT_T>::max_digits10)
+                << "view " << map_.get_x_pixels() << ' ' << map_.get_y_pixels() << ' ' << map_.get_max_iterations() << ' '
+                << map_.get_a() << ' ' << map_.get_b() << ' ' << map_.get_threshold() << ' '
+                << map_.get_bottom_left().x << ' ' << map_.get_bottom_left().y << ' '
+                << map_.get_top_right().x << ' ' << map_.get_top_right().y << ' '
+                << (map_.get_expression() ? "expr:" + map_.get_expression()->source() : std::string(map_.get_fractal_name()))
+                << '\n';
+            return os.str();
+        }
+
+        const ra::fractal_logic::henon_map<FLOAT_T>& map_;
+        ra::concurrency::thread_pool& pool_;
+        int band_height_;
+        int window_;
+        int per_worker_;
+        double worker_timeout_;
+
+        stream_socket listener_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable changed_;
+        coordinator_stats stats_;
+    };
+
+    /**
+     * Class: render_worker
+     *
+     * Description: Renders the bands a render_coordinator sends, each split
+     * into rows over the worker's pool
+     */
+    template<class FLOAT_T>
+    class render_worker {
+
+        public:
+
+        explicit render_worker(ra::concurrency::thread_pool& pool): pool_(pool) {}
+
+        /**
+         * Render bands for the coordinator at address until it says done or
+         * goes away. Returns the number of bands rendered.
+         */
+        std::uint64_t run(const std::string& address) {
+            stream_socket coordinator = stream_socket::connect(address);
+            ra::fractal_logic::henon_map<FLOAT_T> map;
+            std::uint64_t bands = 0;
+
+            std::string line;
+            while(coordinator.read_line(line)) {
+                std::istringstream is(line);
+                std::string command;
+                is >> command;
+
+                if(command == "done") {
+                    break;
+                } else if(command == "view") {
+                    read_view(is, map);
+                } else if(command == "band") {
+                    int first_row = 0, num_rows = 0;
+                    is >> first_row >> num_rows;
+                    if(!is || num_rows <= 0 || first_row < 0 || first_row + num_rows > map.get_y_pixels()) {
+                        throw std::runtime_error("Bad band from coordinator");
+                    }
+
+                    std::string payload = compress_band(render_band(map, first_row, num_rows));
+                    coordinator.write_all(std::to_string(first_row) + " ok " + std::to_string(payload.size()) + "\n");
+                    coordinator.write_all(payload);
+                    ++bands;
+                } else {
+                    throw std::runtime_error("Unknown command from coordinator: " + command);
+                }
+            }
+            return bands;
+        }
+
+        private:
+
+        static void read_view(std::istream& is, ra::fractal_logic::henon_map<FLOAT_T>& map) {
+            int width, height, max_its;
+            FLOAT_T a, b, threshold, min_x, min_y, max_x, max_y;
+            std::string fractal;
+            is >> width >> height >> max_its >> a >> b >> threshold >> min_x >> min_y >> max_x >> max_y;
+            std::getline(is >> std::ws, fractal);
+            if(!is || !map.set_fractal_type(fractal)) {
+                throw std::runtime_error("Bad view from coordinator");
+            }
+
+            map.set_x_pixels(width);
+            map.set_y_pixels(height);
+            map.set_max_iterations(max_its);
+            map.set_a(a);
+            map.set_b(b);
+            map.set_threshold(threshold);
+            map.set_bottom_left({min_x, min_y});
+            map.set_top_right({max_x, max_y});
+        }
+
+        std::vector<int> render_band(const ra::fractal_logic::henon_map<FLOAT_T>& map, int first_row, int num_rows) {
+            const int width = map.get_x_pixels();
+            std::vector<int> its(static_cast<std::size_t>(num_rows)*width);
+
+            std::vector<std::future<void>> rows;
+            for(int row=0; row<num_rows; ++row) {
+                rows.push_back(pool_.submit([&map, &its, first_row, row, width]() {
+                    map.render_rows(first_row+row, 1, its.data() + static_cast<std::size_t>(row)*width);
+                }));
+            }
+            for(auto& r: rows) {
+                r.get();
+            }
+            return its;
+        }
+
+        ra::concurrency::thread_pool& pool_;
+    };
+}
+
+#endif
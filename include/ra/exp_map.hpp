@@ -0,0 +1,237 @@
+/**
+ * Zoom videos synthesized from a single exponential map (log-polar strip):
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_EXP_MAP_HPP
+#define RA_FRACTAL_LOGIC_EXP_MAP_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "ra/animation.hpp"
+#include "ra/henon.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Class: exponential_map
+     *
+     * Description: Iteration counts sampled on a log-polar grid around a
+     * center point. Row j holds radius r_max*exp(-j*step) and column k angle
+     * 2*pi*k/angles, with step = 2*pi/angles so that samples are square at
+     * every radius. Any view centered on the same point and no smaller than
+     * r_min can then be resampled from the strip without iterating again.
+     */
+    template<class FLOAT_T>
+    class exponential_map {
+
+        public:
+
+        using size_type = std::size_t;
+
+        exponential_map(point<FLOAT_T> center, FLOAT_T r_max, FLOAT_T r_min, int angles):
+            center_(center), r_max_(r_max), angles_(std::max(8, angles)) {
+
+            step_ = 2.0*M_PI/angles_;
+            rows_ = static_cast<int>(std::ceil(std::log(static_cast<double>(r_max/r_min))/step_)) + 1;
+            rows_ = std::max(rows_, 2);
+
+            its_.resize(static_cast<size_type>(rows_)*angles_);
+        }
+
+        /**
+         * Fill the strip with the iteration counts of map's fractal, in bands
+         * of rows on the pool.
+         */
+        void render(const henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool, int band_height = 16) {
+            band_height = std::max(1, band_height);
+
+            std::vector<double> cos_table(angles_), sin_table(angles_);
+            for(int k=0; k<angles_; ++k) {
+                cos_table[k] = std::cos(k*step_);
+                sin_table[k] = std::sin(k*step_);
+            }
+
+            std::vector<std::future<void>> bands;
+            for(int first_row=0; first_row<rows_; first_row+=band_height) {
+                int last_row = std::min(rows_, first_row+band_height);
+
+                bands.push_back(pool.submit([&, first_row, last_row]() {
+                    for(int row=first_row; row<last_row; ++row) {
+                        FLOAT_T r = r_max_*std::exp(-row*static_cast<FLOAT_T>(step_));
+                        int * its = its_.data() + static_cast<size_type>(row)*angles_;
+
+                        for(int k=0; k<angles_; ++k) {
+                            its[k] = map.compute_iterations({center_.x + r*cos_table[k], center_.y + r*sin_table[k]});
+                        }
+                    }
+                }));
+            }
+
+            for(auto& band: bands) {
+                band.get();
+            }
+        }
+
+        /**
+         * Bilinear interpolation of the strip at offset (dx, dy) from the center.
+         * Radii outside the strip are clamped to its first or last row.
+         */
+        double sample(double dx, double dy) const {
+            double r = std::sqrt(dx*dx + dy*dy);
+            double row = r > 0.0 ? std::log(static_cast<double>(r_max_)/r)/step_ : rows_-1;
+            row = std::clamp(row, 0.0, rows_-1.0);
+
+            double column = std::atan2(dy, dx)/step_;
+            if(column < 0.0) column += angles_;
+
+            int r0 = std::min(static_cast<int>(row), rows_-2);
+            int c0 = static_cast<int>(column) % angles_;
+            int c1 = (c0+1) % angles_;
+            double fr = row-r0, fc = column-std::floor(column);
+
+            const int * near = its_.data() + static_cast<size_type>(r0)*angles_;
+            const int * far = near + angles_;
+
+            return (1-fr)*((1-fc)*near[c0] + fc*near[c1]) + fr*((1-fc)*far[c0] + fc*far[c1]);
+        }
+
+        /**
+         * Resample rows [first_row, first_row+num_rows) of a width*height image
+         * of view v, which must be centered on the strip's center. Image row 0
+         * is the top of the view.
+         */
+        void resample(const view<FLOAT_T>& v, int width, int height,
+            int first_row, int num_rows, int * its) const {
+
+            double dx = static_cast<double>(v.max.x-v.min.x)/(width-1);
+            double dy = static_cast<double>(v.max.y-v.min.y)/(height-1);
+            double x0 = static_cast<double>(v.min.x-center_.x);
+            double y0 = static_cast<double>(v.min.y-center_.y);
+
+            for(int row=first_row; row<first_row+num_rows; ++row) {
+                double y = y0 + (height-1-row)*dy;
+                for(int x=0; x<width; ++x) {
+                    *its++ = static_cast<int>(std::lround(sample(x0 + x*dx, y)));
+                }
+            }
+        }
+
+        int rows() const {return rows_;}
+        int angles() const {return angles_;}
+        size_type size() const {return its_.size();}
+        point<FLOAT_T> center() const {return center_;}
+
+        private:
+
+        point<FLOAT_T> center_;
+        FLOAT_T r_max_;
+        int angles_;
+        int rows_;
+        double step_;
+
+        std::vector<int> its_;
+    };
+
+    /**
+     * Class: exponential_zoom_renderer
+     *
+     * Description: Renders a zoom video by computing one exponential map
+     * around the zoom target, covering the radii from the corner of the
+     * first frame down to a pixel of the last frame, and resampling every
+     * frame from it. The number of iterated points is about
+     * 2*pi*(half diagonal in pixels)*(number of zoom e-foldings)/step,
+     * independent of the number of frames.
+     *
+     * Frames are centered on the end view's center, since a log-polar
+     * grid only serves views sharing its center.
+     */
+    template<class FLOAT_T>
+    class exponential_zoom_renderer {
+
+        public:
+
+        /**
+         * quality: angular samples relative to the pixels around the edge of a frame
+         */
+        exponential_zoom_renderer(const henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool,
+            int band_height = 16, int queue_size = 2, double quality = 1.0):
+            map_(map), pool_(pool), band_height_(band_height),
+            pipeline_(pool, band_height, queue_size), quality_(quality) {}
+
+        /**
+         * Views of num_frames frames zooming from the size of start to end,
+         * all centered on end's center
+         */
+        std::vector<view<FLOAT_T>> frame_views(const view<FLOAT_T>& start, const view<FLOAT_T>& end, int num_frames) const {
+            point<FLOAT_T> target((end.min.x+end.max.x)/2, (end.min.y+end.max.y)/2);
+            FLOAT_T half_x = (start.max.x-start.min.x)/2, half_y = (start.max.y-start.min.y)/2;
+
+            view<FLOAT_T> centered_start{{target.x-half_x, target.y-half_y}, {target.x+half_x, target.y+half_y}};
+            return zoom_path(std::vector<view<FLOAT_T>>{centered_start, end}, num_frames);
+        }
+
+        /**
+         * Render the strip for the zoom from start to end, then resample num_frames
+         * frames and pass them to writer(frame&) in order on a writer thread.
+         */
+        template<class WRITER>
+        void render(const view<FLOAT_T>& start, const view<FLOAT_T>& end, int num_frames, WRITER&& writer) {
+            const int width = map_.get_x_pixels();
+            const int height = map_.get_y_pixels();
+
+            auto views = frame_views(start, end, num_frames);
+            if(views.empty()) {
+                return;
+            }
+
+            //Largest radius seen is the corner of the largest frame, the smallest about half a pixel
+            FLOAT_T r_max = 0, r_min = 0;
+            for(const auto& v: views) {
+                FLOAT_T corner = std::hypot(v.max.x-v.min.x, v.max.y-v.min.y)/2;
+                FLOAT_T pixel = std::min((v.max.x-v.min.x)/width, (v.max.y-v.min.y)/height)/2;
+                r_max = std::max(r_max, corner);
+                r_min = (r_min == 0) ? pixel : std::min(r_min, pixel);
+            }
+
+            int angles = static_cast<int>(std::ceil(quality_*M_PI*std::hypot(width, height)));
+
+            point<FLOAT_T> target((end.min.x+end.max.x)/2, (end.min.y+end.max.y)/2);
+            strip_ = std::make_unique<exponential_map<FLOAT_T>>(target, r_max, r_min, angles);
+            strip_->render(map_, pool_, band_height_);
+
+            const exponential_map<FLOAT_T>& strip = *strip_;
+            auto prepare = [&strip, &views, width, height](int index) {
+                view<FLOAT_T> v = views[index];
+                return [&strip, v, width, height](int first_row, int num_rows, int * its) {
+                    strip.resample(v, width, height, first_row, num_rows, its);
+                };
+            };
+
+            pipeline_.run(num_frames, width, height, map_.get_max_iterations(), prepare, std::forward<WRITER>(writer));
+        }
+
+        /**
+         * Strip used by the last render, null before the first
+         */
+        const exponential_map<FLOAT_T> * strip() const {return strip_.get();}
+
+        private:
+
+        const henon_map<FLOAT_T>& map_;
+        ra::concurrency::thread_pool& pool_;
+        int band_height_;
+
+        frame_pipeline pipeline_;
+        double quality_;
+
+        std::unique_ptr<exponential_map<FLOAT_T>> strip_;
+    };
+}
+
+#endif
@@ -0,0 +1,423 @@
+/**
+ * User defined formulas compiled to register bytecode run over batches of pixels:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_EXPRESSION_HPP
+#define RA_FRACTAL_LOGIC_EXPRESSION_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "ra/formulas.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Class: expression_formula
+     *
+     * Description: A map (x, y) -> (f(x, y), g(x, y)) given as text, for
+     * example "1 - a*x^2 + y, b*x" for the Henon map. Expressions may use
+     * x and y (the current point, starting at the pixel), cx and cy (the
+     * pixel), a and b (-a/-b), pi, numbers, + - * / ^ with a constant
+     * integer exponent, and sin, cos, exp, log, sqrt, abs. Orbits escape
+     * when x^2 + y^2 exceeds the threshold squared, as for the Henon map.
+     *
+     * The text is parsed into a DAG in which equal subexpressions share a
+     * node and constant subexpressions are folded, then compiled to
+     * instructions over registers of batch_size lanes, with registers
+     * reused once their value is dead. Each instruction is dispatched once
+     * per iteration of a whole batch, and its loop over lanes vectorizes.
+     */
+    class expression_formula {
+
+        public:
+
+        static constexpr int batch_size = 64;
+
+        enum opcode : std::uint8_t {
+            op_add, op_sub, op_mul, op_div, op_neg,
+            op_sin, op_cos, op_exp, op_log, op_sqrt, op_abs
+        };
+
+        struct instruction {
+            opcode op;
+            std::uint16_t dst, a, b;
+        };
+
+        /**
+         * Compile source, throwing std::invalid_argument on syntax errors
+         */
+        explicit expression_formula(const std::string& source): source_(source), pos_(0) {
+            for(int v=0; v<num_variables; ++v) {
+                nodes_.push_back({node_variable, v, -1, 0.0});
+            }
+
+            int out_x = parse_expression();
+            expect(',');
+            int out_y = parse_expression();
+            skip_space();
+            if(pos_ != source_.size()) {
+                error("unexpected character");
+            }
+
+            generate(out_x, out_y);
+        }
+
+        /**
+         * Escape iteration counts of n points, the same contract as escape_lanes
+         */
+        void run(const double * px, const double * py, std::size_t n, const formula_params& p, int * its) const {
+            std::vector<double> registers(static_cast<std::size_t>(num_registers_)*batch_size);
+            auto reg = [&registers](int r) {return registers.data() + static_cast<std::size_t>(r)*batch_size;};
+
+            for(const auto& [r, value]: constants_) {
+                std::fill(reg(r), reg(r)+batch_size, value);
+            }
+            std::fill(reg(var_a), reg(var_a)+batch_size, p.a);
+            std::fill(reg(var_b), reg(var_b)+batch_size, p.b);
+
+            double * x = reg(var_x);
+            double * y = reg(var_y);
+            const double * out_x = reg(out_x_);
+            const double * out_y = reg(out_y_);
+
+            for(std::size_t first=0; first<n; first+=batch_size) {
+                int count[batch_size], done[batch_size];
+                for(int l=0; l<batch_size; ++l) {
+                    //Lanes past the end repeat the last point
+                    std::size_t i = std::min<std::size_t>(first+l, n-1);
+                    x[l] = reg(var_cx)[l] = px[i];
+                    y[l] = reg(var_cy)[l] = py[i];
+                    count[l] = 0;
+                    done[l] = 0;
+                }
+
+                for(int i=0; i<p.max_its; ++i) {
+                    for(const auto& inst: code_) {
+                        execute(inst, reg(inst.dst), reg(inst.a), reg(inst.b));
+                    }
+
+                    int all_done = 1;
+                    for(int l=0; l<batch_size; ++l) {
+                        double x_next = out_x[l], y_next = out_y[l];
+                        x[l] = x_next;
+                        y[l] = y_next;
+                        done[l] |= (x_next*x_next + y_next*y_next > p.threshold_squared);
+                        count[l] += 1 - done[l];
+                        all_done &= done[l];
+                    }
+                    if(all_done) break;
+                }
+
+                for(std::size_t l=0; l<batch_size && first+l<n; ++l) {
+                    its[first+l] = count[l];
+                }
+            }
+        }
+
+        const std::string& source() const {return source_;}
+        const std::vector<instruction>& code() const {return code_;}
+        int registers() const {return num_registers_;}
+
+        private:
+
+        enum variable {var_x, var_y, var_a, var_b, var_cx, var_cy, num_variables};
+
+        static constexpr int node_constant = -1;
+        static constexpr int node_variable = -2;
+
+        //op is an opcode, node_constant (value) or node_variable (a is the variable)
+        struct node {
+            int op;
+            int a, b;
+            double value;
+        };
+
+        static void execute(const instruction& inst, double * __restrict__ dst, const double * __restrict__ a, const double * __restrict__ b) {
+            switch(inst.op) {
+                case op_add: for(int l=0; l<batch_size; ++l) dst[l] = a[l] + b[l]; break;
+                case op_sub: for(int l=0; l<batch_size; ++l) dst[l] = a[l] - b[l]; break;
+                case op_mul: for(int l=0; l<batch_size; ++l) dst[l] = a[l] * b[l]; break;
+                case op_div: for(int l=0; l<batch_size; ++l) dst[l] = a[l] / b[l]; break;
+                case op_neg: for(int l=0; l<batch_size; ++l) dst[l] = -a[l]; break;
+                case op_sin: for(int l=0; l<batch_size; ++l) dst[l] = std::sin(a[l]); break;
+                case op_cos: for(int l=0; l<batch_size; ++l) dst[l] = std::cos(a[l]); break;
+                case op_exp: for(int l=0; l<batch_size; ++l) dst[l] = std::exp(a[l]); break;
+                case op_log: for(int l=0; l<batch_size; ++l) dst[l] = std::log(a[l]); break;
+                case op_sqrt: for(int l=0; l<batch_size; ++l) dst[l] = std::sqrt(a[l]); break;
+                case op_abs: for(int l=0; l<batch_size; ++l) dst[l] = std::abs(a[l]); break;
+            }
+        }
+
+        //Same arithmetic as execute, so folding cannot change results
+        static double evaluate(opcode op, double a, double b) {
+            double dst[batch_size], va[batch_size], vb[batch_size];
+            std::fill(va, va+batch_size, a);
+            std::fill(vb, vb+batch_size, b);
+            execute({op, 0, 0, 0}, dst, va, vb);
+            return dst[0];
+        }
+
+        /*
+         * DAG construction
+         */
+
+        int constant(double value) {
+            return intern({node_constant, -1, -1, value});
+        }
+
+        bool is_constant(int n, double value) const {
+            return nodes_[n].op == node_constant && nodes_[n].value == value;
+        }
+
+        int operation(opcode op, int a, int b = -1) {
+            bool unary = b < 0;
+
+            //Constant folding
+            if(nodes_[a].op == node_constant && (unary || nodes_[b].op == node_constant)) {
+                return constant(evaluate(op, nodes_[a].value, unary ? 0.0 : nodes_[b].value));
+            }
+
+            //Identities which hold for NaN and infinity too (x + 0 may keep a negative zero)
+            if(op == op_add && is_constant(a, 0.0)) return b;
+            if((op == op_add || op == op_sub) && is_constant(b, 0.0)) return a;
+            if(op == op_mul && is_constant(a, 1.0)) return b;
+            if((op == op_mul || op == op_div) && is_constant(b, 1.0)) return a;
+            if(op == op_neg && nodes_[a].op == op_neg) return nodes_[a].a;
+
+            //Commutative operations get a canonical operand order so they are shared
+            if((op == op_add || op == op_mul) && b < a) std::swap(a, b);
+
+            return intern({op, a, b, 0.0});
+        }
+
+        int intern(const node& n) {
+            auto key = std::make_tuple(n.op, n.a, n.b, n.value);
+            auto found = index_.find(key);
+            if(found != index_.end()) {
+                return found->second;
+            }
+            nodes_.push_back(n);
+            index_[key] = static_cast<int>(nodes_.size()-1);
+            return static_cast<int>(nodes_.size()-1);
+        }
+
+        /*
+         * Recursive descent parser
+         */
+
+        [[noreturn]] void error(const std::string& message) const {
+            throw std::invalid_argument("Formula \"" + source_ + "\": " + message + " at position " + std::to_string(pos_));
+        }
+
+        void skip_space() {
+            while(pos_ < source_.size() && std::isspace(static_cast<unsigned char>(source_[pos_]))) ++pos_;
+        }
+
+        bool accept(char c) {
+            skip_space();
+            if(pos_ < source_.size() && source_[pos_] == c) {
+                ++pos_;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c) {
+            if(!accept(c)) {
+                error(std::string("expected '") + c + "'");
+            }
+        }
+
+        //expression := term (('+' | '-') term)*
+        int parse_expression() {
+            int left = parse_term();
+            for(;;) {
+                if(accept('+')) {
+                    left = operation(op_add, left, parse_term());
+                } else if(accept('-')) {
+                    left = operation(op_sub, left, parse_term());
+                } else {
+                    return left;
+                }
+            }
+        }
+
+        //term := unary (('*' | '/') unary)*
+        int parse_term() {
+            int left = parse_unary();
+            for(;;) {
+                if(accept('*')) {
+                    left = operation(op_mul, left, parse_unary());
+                } else if(accept('/')) {
+                    left = operation(op_div, left, parse_unary());
+                } else {
+                    return left;
+                }
+            }
+        }
+
+        //unary := '-' unary | power
+        int parse_unary() {
+            if(accept('-')) {
+                return operation(op_neg, parse_unary());
+            }
+            return parse_power();
+        }
+
+        //power := primary ('^' unary)?, the exponent folding to an integer
+        int parse_power() {
+            int base = parse_primary();
+            if(!accept('^')) {
+                return base;
+            }
+
+            int exponent = parse_unary();
+            const node& e = nodes_[exponent];
+            if(e.op != node_constant || e.value != std::floor(e.value) || std::abs(e.value) > 64) {
+                error("exponent must be a constant integer up to 64");
+            }
+
+            //Square and multiply, sharing the squares
+            int n = static_cast<int>(std::abs(e.value));
+            int result = constant(1.0), square = base;
+            for(; n > 0; n >>= 1) {
+                if(n & 1) result = operation(op_mul, result, square);
+                if(n > 1) square = operation(op_mul, square, square);
+            }
+            return e.value < 0 ? operation(op_div, constant(1.0), result) : result;
+        }
+
+        //primary := number | variable | function '(' expression ')' | '(' expression ')'
+        int parse_primary() {
+            skip_space();
+            if(accept('(')) {
+                int inner = parse_expression();
+                expect(')');
+                return inner;
+            }
+
+            if(pos_ < source_.size() && (std::isdigit(static_cast<unsigned char>(source_[pos_])) || source_[pos_] == '.')) {
+                const char * begin = source_.c_str() + pos_;
+                char * end;
+                double value = std::strtod(begin, &end);
+                pos_ += end - begin;
+                return constant(value);
+            }
+
+            std::size_t start = pos_;
+            while(pos_ < source_.size() && std::isalpha(static_cast<unsigned char>(source_[pos_]))) ++pos_;
+            std::string name = source_.substr(start, pos_-start);
+
+            static const std::map<std::string, int> variables = {
+                {"x", var_x}, {"y", var_y}, {"a", var_a}, {"b", var_b}, {"cx", var_cx}, {"cy", var_cy}
+            };
+            static const std::map<std::string, opcode> functions = {
+                {"sin", op_sin}, {"cos", op_cos}, {"exp", op_exp}, {"log", op_log}, {"sqrt", op_sqrt}, {"abs", op_abs}
+            };
+
+            if(auto v = variables.find(name); v != variables.end()) {
+                return v->second;
+            }
+            if(name == "pi") {
+                return constant(M_PI);
+            }
+            if(auto f = functions.find(name); f != functions.end()) {
+                expect('(');
+                int argument = parse_expression();
+                expect(')');
+                return operation(f->second, argument);
+            }
+
+            pos_ = start;
+            error(name.empty() ? "expected a number, variable or function" : "unknown name " + name);
+        }
+
+        /*
+         * Code generation
+         */
+
+        void generate(int out_x, int out_y) {
+            //Nodes are created after their operands, so index order is a topological order
+            std::vector<bool> live(nodes_.size(), false);
+            live[out_x] = live[out_y] = true;
+            for(int n=static_cast<int>(nodes_.size())-1; n>=0; --n) {
+                if(!live[n] || nodes_[n].op < 0) continue;
+                live[nodes_[n].a] = true;
+                if(nodes_[n].b >= 0) live[nodes_[n].b] = true;
+            }
+
+            //Last instruction reading each node; outputs are read after the last one
+            const int end = static_cast<int>(nodes_.size());
+            std::vector<int> last_use(nodes_.size(), -1);
+            last_use[out_x] = last_use[out_y] = end;
+            for(int n=0; n<end; ++n) {
+                if(!live[n] || nodes_[n].op < 0) continue;
+                last_use[nodes_[n].a] = std::max(last_use[nodes_[n].a], n);
+                if(nodes_[n].b >= 0) last_use[nodes_[n].b] = std::max(last_use[nodes_[n].b], n);
+            }
+
+            //Variables keep their own registers, constants are loaded once per run
+            std::vector<int> reg(nodes_.size(), -1);
+            num_registers_ = num_variables;
+            for(int n=0; n<end; ++n) {
+                if(nodes_[n].op == node_variable) {
+                    reg[n] = nodes_[n].a;
+                } else if(nodes_[n].op == node_constant && live[n]) {
+                    reg[n] = num_registers_++;
+                    constants_.push_back({reg[n], nodes_[n].value});
+                }
+            }
+
+            std::vector<int> free_registers;
+            for(int n=0; n<end; ++n) {
+                if(!live[n] || nodes_[n].op < 0) continue;
+                const node& op = nodes_[n];
+
+                if(free_registers.empty()) {
+                    reg[n] = num_registers_++;
+                } else {
+                    reg[n] = free_registers.back();
+                    free_registers.pop_back();
+                }
+
+                //Operands dying here free their registers for later results, never
+                //this one, so an instruction's output does not alias its inputs
+                for(int operand: {op.a, op.b}) {
+                    if(operand >= 0 && last_use[operand] == n && nodes_[operand].op >= 0
+                        && std::find(free_registers.begin(), free_registers.end(), reg[operand]) == free_registers.end()) {
+                        free_registers.push_back(reg[operand]);
+                    }
+                }
+
+                code_.push_back({static_cast<opcode>(op.op), static_cast<std::uint16_t>(reg[n]),
+                    static_cast<std::uint16_t>(reg[op.a]), static_cast<std::uint16_t>(op.b >= 0 ? reg[op.b] : reg[op.a])});
+            }
+
+            out_x_ = reg[out_x];
+            out_y_ = reg[out_y];
+        }
+
+        std::string source_;
+        std::size_t pos_;
+
+        std::vector<node> nodes_;
+        std::map<std::tuple<int, int, int, double>, int> index_;
+
+        std::vector<instruction> code_;
+        std::vector<std::pair<int, double>> constants_;
+        int num_registers_ = 0;
+        int out_x_ = 0, out_y_ = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,250 @@
+/**
+ * Escape time formulas compiled into specialized CPU kernels:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_FORMULAS_HPP
+#define RA_FRACTAL_LOGIC_FORMULAS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <string>
+
+namespace ra::fractal_logic {
+
+    /**
+     * Values a formula may read, fixed for a whole frame
+     */
+    struct formula_params {
+        double a, b;                //Henon parameters, or c of a Julia set
+        double threshold_squared;   //Henon escape radius squared
+        int max_its;
+    };
+
+    /**
+     * A formula provides, as static inline functions:
+     *   void init(double px, double py, const formula_params&, double& x, double& y, double& cx, double& cy);
+     *   void step(double& x, double& y, double cx, double cy, const formula_params&);
+     *   double bailout_squared(const formula_params&);
+     * init maps the pixel's point to the starting z and the constant c; step
+     * is one iteration. The kernels below are instantiated per formula, so
+     * step is inlined and no formula pays for another's branches.
+     */
+
+    //x -> 1 - a x^2 + y, y -> b x, starting from the pixel
+    struct henon_formula {
+        static constexpr const char * name = "henon";
+        static void init(double px, double py, const formula_params&, double& x, double& y, double& cx, double& cy) {
+            x = px; y = py; cx = 0.0; cy = 0.0;
+        }
+        static void step(double& x, double& y, double, double, const formula_params& p) {
+            double x_next = 1.0 - p.a*x*x + y;
+            y = p.b*x;
+            x = x_next;
+        }
+        static double bailout_squared(const formula_params& p) {return p.threshold_squared;}
+    };
+
+    //z -> z^2 + c, starting from 0 with c at the pixel
+    struct mandelbrot_formula {
+        static constexpr const char * name = "mandelbrot";
+        static void init(double px, double py, const formula_params&, double& x, double& y, double& cx, double& cy) {
+            x = 0.0; y = 0.0; cx = px; cy = py;
+        }
+        static void step(double& x, double& y, double cx, double cy, const formula_params&) {
+            double x_next = x*x - y*y + cx;
+            y = 2.0*x*y + cy;
+            x = x_next;
+        }
+        static double bailout_squared(const formula_params&) {return 4.0;}
+    };
+
+    //z -> z^2 + c with c = a + bi, starting from the pixel
+    struct julia_formula {
+        static constexpr const char * name = "julia";
+        static void init(double px, double py, const formula_params& p, double& x, double& y, double& cx, double& cy) {
+            x = px; y = py; cx = p.a; cy = p.b;
+        }
+        static void step(double& x, double& y, double cx, double cy, const formula_params& p) {
+            mandelbrot_formula::step(x, y, cx, cy, p);
+        }
+        static double bailout_squared(const formula_params&) {return 4.0;}
+    };
+
+    //z -> (|Re z| + i|Im z|)^2 + c
+    struct burning_ship_formula {
+        static constexpr const char * name = "burningship";
+        static void init(double px, double py, const formula_params& p, double& x, double& y, double& cx, double& cy) {
+            mandelbrot_formula::init(px, py, p, x, y, cx, cy);
+        }
+        static void step(double& x, double& y, double cx, double cy, const formula_params&) {
+            double x_next = x*x - y*y + cx;
+            y = 2.0*std::abs(x*y) + cy;
+            x = x_next;
+        }
+        static double bailout_squared(const formula_params&) {return 4.0;}
+    };
+
+    //z -> conj(z)^2 + c
+    struct tricorn_formula {
+        static constexpr const char * name = "tricorn";
+        static void init(double px, double py, const formula_params& p, double& x, double& y, double& cx, double& cy) {
+            mandelbrot_formula::init(px, py, p, x, y, cx, cy);
+        }
+        static void step(double& x, double& y, double cx, double cy, const formula_params&) {
+            double x_next = x*x - y*y + cx;
+            y = -2.0*x*y + cy;
+            x = x_next;
+        }
+        static double bailout_squared(const formula_params&) {return 4.0;}
+    };
+
+    //z -> z^POWER + c, the power unrolled at compile time
+    template<int POWER>
+    struct multibrot_formula {
+        static_assert(POWER >= 3 && POWER <= 5, "Multibrot names cover powers 3 to 5");
+        static constexpr const char * name = POWER == 3 ? "multibrot3" : POWER == 4 ? "multibrot4" : "multibrot5";
+
+        static void init(double px, double py, const formula_params& p, double& x, double& y, double& cx, double& cy) {
+            mandelbrot_formula::init(px, py, p, x, y, cx, cy);
+        }
+        static void step(double& x, double& y, double cx, double cy, const formula_params&) {
+            double zx = x, zy = y;
+            for(int k=1; k<POWER; ++k) {
+                double zx_next = zx*x - zy*y;
+                zy = zx*y + zy*x;
+                zx = zx_next;
+            }
+            x = zx + cx;
+            y = zy + cy;
+        }
+        static double bailout_squared(const formula_params&) {return 4.0;}
+    };
+
+    /**
+     * Escape iteration count of one point: iterations before |z|^2 exceeds
+     * the formula's bailout, max_its if it never does
+     */
+    template<class FORMULA>
+    int escape_iterations(double px, double py, const formula_params& p) {
+        double x, y, cx, cy;
+        FORMULA::init(px, py, p, x, y, cx, cy);
+        const double bailout = FORMULA::bailout_squared(p);
+
+        int i;
+        for(i=0; i<p.max_its; ++i) {
+            FORMULA::step(x, y, cx, cy, p);
+            if(x*x + y*y > bailout) {
+                break;
+            }
+        }
+        return i;
+    }
+
+    //Points iterated together by escape_lanes, unless tuned otherwise
+    inline constexpr int formula_lanes = 8;
+
+    //Lanes of the batch kernel variants of each formula. Wider groups fill
+    //wider vector units but wait longer for their slowest lane.
+    inline constexpr std::array<int, 3> kernel_lanes = {4, 8, 16};
+
+    /**
+     * Index of the kernel variant of lanes in kernel_lanes, -1 if none
+     */
+    inline int find_kernel_variant(int lanes) {
+        for(std::size_t i=0; i<kernel_lanes.size(); ++i) {
+            if(kernel_lanes[i] == lanes) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Escape iteration counts of n points, in groups of LANES points iterated
+     * together: the loop over lanes has no branches so it vectorizes, escaped
+     * lanes keep iterating with their counts frozen, and a group stops once
+     * all its lanes have escaped. Gives the same counts as escape_iterations.
+     */
+    template<class FORMULA, int LANES = formula_lanes>
+    void escape_lanes(const double * px, const double * py, std::size_t n, const formula_params& p, int * its) {
+        constexpr int lanes = LANES;
+        const double bailout = FORMULA::bailout_squared(p);
+
+        for(std::size_t first=0; first<n; first+=lanes) {
+            double x[lanes], y[lanes], cx[lanes], cy[lanes];
+            int count[lanes], done[lanes];
+
+            for(int l=0; l<lanes; ++l) {
+                //Lanes past the end repeat the last point
+                std::size_t i = std::min(first+l, n-1);
+                FORMULA::init(px[i], py[i], p, x[l], y[l], cx[l], cy[l]);
+                count[l] = 0;
+                done[l] = 0;
+            }
+
+            for(int i=0; i<p.max_its; ++i) {
+                int all_done = 1;
+                for(int l=0; l<lanes; ++l) {
+                    FORMULA::step(x[l], y[l], cx[l], cy[l], p);
+                    done[l] |= (x[l]*x[l] + y[l]*y[l] > bailout);
+                    count[l] += 1 - done[l];
+                    all_done &= done[l];
+                }
+                if(all_done) break;
+            }
+
+            for(int l=0; l<lanes && first+l<n; ++l) {
+                its[first+l] = count[l];
+            }
+        }
+    }
+
+    /**
+     * Entry of the formula registry: the kernels of one formula
+     */
+    struct formula_entry {
+        using batch_kernel = void (*)(const double * px, const double * py, std::size_t n, const formula_params&, int * its);
+
+        const char * name;
+        int (*point)(double px, double py, const formula_params&);
+        batch_kernel batch;
+        std::array<batch_kernel, kernel_lanes.size()> variants;    //batch for each of kernel_lanes
+    };
+
+    template<class FORMULA>
+    constexpr formula_entry make_formula_entry() {
+        return {FORMULA::name, &escape_iterations<FORMULA>, &escape_lanes<FORMULA>,
+            {&escape_lanes<FORMULA, kernel_lanes[0]>, &escape_lanes<FORMULA, kernel_lanes[1]>, &escape_lanes<FORMULA, kernel_lanes[2]>}};
+    }
+
+    /**
+     * Every built in formula, in the order of henon_map::fractal_t
+     */
+    inline constexpr std::array<formula_entry, 8> formula_registry = {
+        make_formula_entry<henon_formula>(),
+        make_formula_entry<mandelbrot_formula>(),
+        make_formula_entry<julia_formula>(),
+        make_formula_entry<burning_ship_formula>(),
+        make_formula_entry<tricorn_formula>(),
+        make_formula_entry<multibrot_formula<3>>(),
+        make_formula_entry<multibrot_formula<4>>(),
+        make_formula_entry<multibrot_formula<5>>()
+    };
+
+    /**
+     * Index of the formula called name in formula_registry, -1 if none
+     */
+    inline int find_formula(const std::string& name) {
+        for(std::size_t i=0; i<formula_registry.size(); ++i) {
+            if(name == formula_registry[i].name) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+}
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * C interface of libfractal, rendering fractals into caller owned buffers:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_H
+#define RA_FRACTAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(FRACTAL_BUILD_LIBRARY)
+#define FRACTAL_API __attribute__((visibility("default")))
+#else
+#define FRACTAL_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A renderer with its own worker threads, fractal type, parameters and view.
+ * Functions of one context must not be called concurrently, except
+ * fractal_cancel and fractal_get_stats, which may be called from any thread
+ * while a render runs. Different contexts are independent.
+ */
+typedef struct fractal_context fractal_context;
+
+/**
+ * Return values: 0 on success, negative on failure
+ */
+enum fractal_status {
+    FRACTAL_OK = 0,
+    FRACTAL_INVALID_ARGUMENT = -1,
+    FRACTAL_CANCELLED = -2,
+    FRACTAL_OUT_OF_MEMORY = -3,
+    FRACTAL_ERROR = -4
+};
+
+/**
+ * Pixel formats of fractal_render
+ */
+enum fractal_pixel_format {
+    FRACTAL_ITERATIONS = 0,     /* int32_t escape iteration count, max_iterations if bounded */
+    FRACTAL_RGBA8 = 1           /* 4 bytes, the palette of the GUI with alpha 255 */
+};
+
+/**
+ * Totals over the life of a context
+ */
+typedef struct fractal_stats {
+    uint64_t renders;           /* Completed calls of fractal_render */
+    uint64_t cancelled;         /* Calls of fractal_render which returned FRACTAL_CANCELLED */
+    uint64_t pixels;            /* Pixels written */
+    uint64_t iterations;        /* Sum of the iteration counts of those pixels */
+    double seconds;             /* Wall time spent in fractal_render */
+} fractal_stats;
+
+/**
+ * Create a context rendering with threads worker threads (0 for all
+ * hardware threads). Defaults match main: the Henon map with a = 0.2,
+ * b = 0.9991, threshold 512 and 512 iterations over [-5, 5]^2 at 512x512.
+ * Returns NULL if the context cannot be created.
+ */
+FRACTAL_API fractal_context * fractal_create(int threads);
+
+FRACTAL_API void fractal_destroy(fractal_context * context);
+
+/**
+ * Set the fractal type by the names accepted by -f, including
+ * "expr:<x expression>, <y expression>"
+ */
+FRACTAL_API int fractal_set_type(fractal_context * context, const char * type);
+
+/**
+ * Set the Henon (or Julia) parameters, escape threshold and iteration limit
+ */
+FRACTAL_API int fractal_set_parameters(fractal_context * context, double a, double b,
+    double threshold, int max_iterations);
+
+/**
+ * Set the view: the rectangle [min_x, max_x] x [min_y, max_y] sampled at
+ * width x height pixel centers, the first and last on its edges. Pixel row
+ * 0 is the top of the view.
+ */
+FRACTAL_API int fractal_set_view(fractal_context * context, double min_x, double min_y,
+    double max_x, double max_y, int width, int height);
+
+/**
+ * Render pixels [x, x+width) x [y, y+height) of the view into buffer, each
+ * row starting stride bytes after the previous one. Tiles of a view give
+ * the same pixels as rendering the whole view at once. Blocks until done,
+ * returning FRACTAL_CANCELLED if fractal_cancel was called meanwhile, in
+ * which case some rows may not have been written.
+ */
+FRACTAL_API int fractal_render(fractal_context * context, int x, int y, int width, int height,
+    int format, void * buffer, size_t stride);
+
+/**
+ * Make the render running in context, if any, stop as soon as possible
+ */
+FRACTAL_API void fractal_cancel(fractal_context * context);
+
+FRACTAL_API int fractal_get_stats(const fractal_context * context, fractal_stats * stats);
+
+/**
+ * Message describing the last failure of a call on context
+ */
+FRACTAL_API const char * fractal_last_error(const fractal_context * context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,676 @@
+/**
+ * Streaming the interactive view to a remote client as tile deltas:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_IO_FRAME_STREAM_HPP
+#define RA_IO_FRAME_STREAM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <future>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include "ra/henon.hpp"
+#include "ra/profile.hpp"
+#include "ra/socket.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::io {
+
+    namespace detail {
+
+        inline void put_varint(std::string& out, std::uint32_t v) {
+            while(v >= 0x80) {
+                out += static_cast<char>(v | 0x80);
+                v >>= 7;
+            }
+            out += static_cast<char>(v);
+        }
+
+        inline std::uint32_t get_varint(const unsigned char *& p, const unsigned char * end) {
+            std::uint32_t v = 0;
+            for(int shift=0; shift<35; shift+=7) {
+                if(p == end) break;
+                unsigned char c = *p++;
+                v |= static_cast<std::uint32_t>(c & 0x7f) << shift;
+                if(!(c & 0x80)) return v;
+            }
+            throw std::runtime_error("Corrupt frame");
+        }
+
+        inline std::uint32_t zigzag(int v) {
+            return (static_cast<std::uint32_t>(v) << 1) ^ static_cast<std::uint32_t>(v >> 31);
+        }
+
+        inline int unzigzag(std::uint32_t v) {
+            return static_cast<int>((v >> 1) ^ (~(v & 1) + 1));
+        }
+    }
+
+    /**
+     * Class: frame_delta
+     *
+     * Description: The geometry shared by frame_encoder and frame_decoder.
+     * A frame is split into tile x tile squares. Each frame is coded against
+     * a base frame on the same pixel grid, shifted so that pixel (i, j) of the
+     * frame is pixel (i+dx, j+dy) of the base: only tiles which differ from
+     * the shifted base, or reach past its edges, are sent. Each sent pixel is
+     * predicted by the shifted base where there is one, otherwise by the
+     * previous pixel of its tile, and the residuals are written as runs of
+     * zeros and zigzag varint literals. The tiles of a frame are deflated
+     * together.
+     */
+    class frame_delta {
+
+        public:
+
+        frame_delta(int width, int height, int tile):
+            width_(width), height_(height), tile_(std::max(1, tile)),
+            tiles_x_((width + tile_ - 1)/tile_), tiles_y_((height + tile_ - 1)/tile_) {
+            if(width <= 0 || height <= 0) {
+                throw std::invalid_argument("Frames need at least one pixel");
+            }
+        }
+
+        int width() const {return width_;}
+        int height() const {return height_;}
+        int tile() const {return tile_;}
+        int num_tiles() const {return tiles_x_*tiles_y_;}
+
+        /**
+         * Visit the pixels of tile t in raster order as f(index into the frame,
+         * index into the base or -1 where the shifted base has no pixel)
+         */
+        template<class F>
+        void for_each_pixel(int t, const std::vector<int> * base, int dx, int dy, F&& f) const {
+            const int x0 = (t % tiles_x_)*tile_, y0 = (t / tiles_x_)*tile_;
+            for(int y=y0; y<std::min(height_, y0+tile_); ++y) {
+                for(int x=x0; x<std::min(width_, x0+tile_); ++x) {
+                    const int bx = x+dx, by = y+dy;
+                    const bool inside = base && bx >= 0 && bx < width_ && by >= 0 && by < height_;
+                    f(static_cast<std::size_t>(y)*width_ + x, inside ? static_cast<long>(by)*width_ + bx : -1L);
+                }
+            }
+        }
+
+        protected:
+
+        int width_, height_, tile_;
+        int tiles_x_, tiles_y_;
+    };
+
+    struct frame_stream_stats {
+        std::uint64_t frames;       //Frames sent
+        std::uint64_t tiles;        //Tiles of those frames
+        std::uint64_t tiles_sent;   //Tiles which differed from the client's base
+        std::uint64_t bytes;        //Bytes sent, headers included
+        std::uint64_t rendered;     //Pixels rendered rather than reused from the previous frame
+    };
+
+    /**
+     * Class: frame_encoder
+     *
+     * Description: Server side of a frame stream. Frames are placed on grids
+     * (a grid being the pixel lattice of one zoom level) at integer origins.
+     * Each frame is coded against the last frame the client acknowledged;
+     * frames sent since are kept until an acknowledgement supersedes them,
+     * at most max_unacked of them. Older ones are dropped, so a client which
+     * never acknowledges costs bounded memory, and acknowledgements of
+     * dropped frames are ignored.
+     *
+     * A message is the line
+     *   frame <seq> <base seq> <width> <height> <tile> <dx> <dy> <tiles sent> <raw bytes> <bytes>
+     * followed by bytes of deflated tile data. Base 0 means no base.
+     */
+    class frame_encoder: public frame_delta {
+
+        public:
+
+        static constexpr std::size_t max_unacked = 8;
+
+        frame_encoder(int width, int height, int tile = 32):
+            frame_delta(width, height, tile), seq_(0), acked_(0), stats_{0, 0, 0, 0, 0} {}
+
+        /**
+         * Message for the frame its with its origin at (x, y) of grid
+         */
+        std::string encode(std::vector<int> its, std::uint64_t grid, int x, int y) {
+            if(its.size() != static_cast<std::size_t>(width_)*height_) {
+                throw std::invalid_argument("Frame size does not match the stream");
+            }
+
+            const record * base = nullptr;
+            auto found = sent_.find(acked_);
+            if(found != sent_.end() && found->second.grid == grid) {
+                base = &found->second;
+            }
+            const int dx = base ? x - base->x : 0, dy = base ? y - base->y : 0;
+            const std::vector<int> * base_its = base ? &base->its : nullptr;
+
+            std::string raw;
+            int sent = 0, last = -1;
+            for(int t=0; t<num_tiles(); ++t) {
+                bool changed = false;
+                for_each_pixel(t, base_its, dx, dy, [&](std::size_t i, long b) {
+                    changed = changed || b < 0 || (*base_its)[b] != its[i];
+                });
+                if(!changed) continue;
+
+                detail::put_varint(raw, t - last - 1);
+                last = t;
+                ++sent;
+
+                std::uint32_t zeros = 0;
+                int previous = 0;
+                for_each_pixel(t, base_its, dx, dy, [&](std::size_t i, long b) {
+                    const int residual = its[i] - (b < 0 ? previous : (*base_its)[b]);
+                    previous = its[i];
+                    if(residual == 0) {
+                        ++zeros;
+                        return;
+                    }
+                    detail::put_varint(raw, zeros);
+                    detail::put_varint(raw, detail::zigzag(residual));
+                    zeros = 0;
+                });
+                if(zeros > 0) detail::put_varint(raw, zeros);
+            }
+
+            uLongf length = compressBound(raw.size());
+            std::string packed(length, '\0');
+            if(compress2(reinterpret_cast<Bytef *>(packed.data()), &length,
+                reinterpret_cast<const Bytef *>(raw.data()), raw.size(), Z_BEST_SPEED) != Z_OK) {
+                throw std::runtime_error("Could not compress frame");
+            }
+            packed.resize(length);
+
+            const std::uint64_t seq = ++seq_;
+            std::ostringstream header;
+            header << "frame " << seq << ' ' << (base ? acked_ : 0) << ' ' << width_ << ' ' << height_ << ' ' << tile_
+                << ' ' << dx << ' ' << dy << ' ' << sent << ' ' << raw.size() << ' ' << packed.size() << '\n';
+            sent_[seq] = record{grid, x, y, std::move(its)};
+            if(sent_.size() > max_unacked + sent_.count(acked_)) {
+                sent_.erase(sent_.upper_bound(acked_));
+            }
+
+            ++stats_.frames;
+            stats_.tiles += num_tiles();
+            stats_.tiles_sent += sent;
+            stats_.bytes += header.str().size() + packed.size();
+            return header.str() + packed;
+        }
+
+        /**
+         * The client has frame seq, later frames are coded against it
+         */
+        void acknowledge(std::uint64_t seq) {
+            if(seq <= acked_ || sent_.count(seq) == 0) return;
+            acked_ = seq;
+            sent_.erase(sent_.begin(), sent_.find(seq));
+        }
+
+        const frame_stream_stats& stats() const {return stats_;}
+
+        private:
+
+        struct record {
+            std::uint64_t grid;
+            int x, y;
+            std::vector<int> its;
+        };
+
+        std::uint64_t seq_, acked_;
+        std::map<std::uint64_t, record> sent_;  //The acknowledged frame and those sent after it
+        frame_stream_stats stats_;
+    };
+
+    /**
+     * Class: frame_decoder
+     *
+     * Description: Client side of a frame stream, rebuilding frames from
+     * frame_encoder messages. Keeps each frame the server may still use as
+     * a base, which is every frame from the base of the last message on.
+     */
+    class frame_decoder {
+
+        public:
+
+        /**
+         * Rebuild the frame of a message from its header line and payload,
+         * returning its sequence number
+         */
+        std::uint64_t apply(const std::string& header, const std::string& payload) {
+            std::istringstream is(header);
+            std::string command;
+            std::uint64_t seq, base_seq;
+            int width, height, tile, dx, dy, sent;
+            std::size_t raw_size, packed_size;
+            if(!(is >> command >> seq >> base_seq >> width >> height >> tile >> dx >> dy >> sent >> raw_size >> packed_size)
+                || command != "frame" || packed_size != payload.size()) {
+                throw std::runtime_error("Malformed frame header");
+            }
+
+            const std::vector<int> * base = nullptr;
+            if(base_seq != 0) {
+                auto found = frames_.find(base_seq);
+                if(found == frames_.end() || found->second.size() != static_cast<std::size_t>(width)*height) {
+                    throw std::runtime_error("Frame refers to an unknown base");
+                }
+                base = &found->second;
+            }
+
+            std::string raw(raw_size, '\0');
+            uLongf length = raw_size;
+            if(raw_size > 0 && (uncompress(reinterpret_cast<Bytef *>(raw.data()), &length,
+                reinterpret_cast<const Bytef *>(payload.data()), payload.size()) != Z_OK || length != raw_size)) {
+                throw std::runtime_error("Corrupt frame");
+            }
+
+            frame_delta g(width, height, tile);
+            std::vector<int> its(static_cast<std::size_t>(width)*height);
+            std::vector<bool> present(g.num_tiles(), false);
+
+            const unsigned char * p = reinterpret_cast<const unsigned char *>(raw.data());
+            const unsigned char * end = p + raw.size();
+            int t = -1;
+            for(int n=0; n<sent; ++n) {
+                t += detail::get_varint(p, end) + 1;
+                if(t >= g.num_tiles()) {
+                    throw std::runtime_error("Corrupt frame");
+                }
+                present[t] = true;
+
+                //A run of zeros, then a literal unless the run reaches the end of the tile
+                std::uint32_t zeros = 0;
+                bool in_run = false;
+                int previous = 0;
+                g.for_each_pixel(t, base, dx, dy, [&](std::size_t i, long b) {
+                    if(!in_run) {
+                        zeros = detail::get_varint(p, end);
+                        in_run = true;
+                    }
+                    int residual = 0;
+                    if(zeros > 0) {
+                        --zeros;
+                    } else {
+                        residual = detail::unzigzag(detail::get_varint(p, end));
+                        in_run = false;
+                    }
+                    its[i] = residual + (b < 0 ? previous : (*base)[b]);
+                    previous = its[i];
+                });
+            }
+
+            for(int u=0; u<g.num_tiles(); ++u) {
+                if(present[u]) continue;
+                g.for_each_pixel(u, base, dx, dy, [&](std::size_t i, long b) {
+                    if(b < 0) throw std::runtime_error("Frame leaves pixels undefined");
+                    its[i] = (*base)[b];
+                });
+            }
+
+            frames_.erase(frames_.begin(), frames_.lower_bound(base_seq));
+            frames_[seq] = std::move(its);
+            current_ = seq;
+            tiles_sent_ = sent;
+            return seq;
+        }
+
+        const std::vector<int>& frame() const {return frames_.at(current_);}
+        int tiles_sent() const {return tiles_sent_;}
+
+        private:
+
+        std::map<std::uint64_t, std::vector<int>> frames_;
+        std::uint64_t current_ = 0;
+        int tiles_sent_ = 0;
+    };
+
+    /**
+     * Zoom the view of map, whose frame has its origin at (x, y) of the
+     * map's grid, by factor about frame pixel (px, py) counted from the top
+     * left: the point under that pixel stays put. The map then holds the new
+     * grid, with the frame at its origin.
+     */
+    template<class FLOAT_T>
+    void zoom_view(ra::fractal_logic::henon_map<FLOAT_T>& map, int x, int y, double factor, int px, int py) {
+        const int w = map.get_x_pixels(), h = map.get_y_pixels();
+        const auto c = map.map_to_cartesian_plane(x+px, h-1-(y+py));
+        const FLOAT_T span_x = (map.get_top_right().x - map.get_bottom_left().x)/factor;
+        const FLOAT_T span_y = (map.get_top_right().y - map.get_bottom_left().y)/factor;
+        const FLOAT_T left = c.x - span_x*px/(w-1), bottom = c.y - span_y*(h-1-py)/(h-1);
+        map.set_bottom_left({left, bottom});
+        map.set_top_right({left + span_x, bottom + span_y});
+    }
+
+    /**
+     * Class: frame_server
+     *
+     * Description: Streams the interactive view of a henon_map to remote
+     * clients. Each connection gets a session with its own copy of the view,
+     * at first the server's, sent as a frame_encoder message on connecting
+     * and after each command:
+     *   pan <dx> <dy>          move the view dx pixels right and dy down
+     *   zoom <factor> <x> <y>  zoom in by factor about pixel (x, y)
+     *   ack <seq>              the client has frame seq (answered with nothing)
+     * Malformed commands are answered with "error <bytes>" and a message, as
+     * are pans taking the view's origin beyond max_origin pixels.
+     *
+     * Pixel centers of a pan lie on the lattice of the previous frame, so a
+     * pan renders only the exposed pixels and, as the client has the rest,
+     * sends only the tiles they touch.
+     */
+    template<class FLOAT_T>
+    class frame_server {
+
+        public:
+
+        //Furthest pan from the first frame, so origins and their differences fit an int
+        static constexpr int max_origin = std::numeric_limits<int>::max()/2;
+
+        frame_server(const ra::fractal_logic::henon_map<FLOAT_T>& view, ra::concurrency::thread_pool& pool, int tile = 32):
+            view_(view), pool_(pool), tile_(tile), stats_{0, 0, 0, 0, 0}, sessions_(0), stopping_(false) {}
+
+        ~frame_server() {
+            stop();
+            std::unique_lock lock(mutex_);
+            for(auto& weak: connections_) {
+                if(auto c = weak.lock()) c->shutdown();
+            }
+            idle_.wait(lock, [this]() {return sessions_ == 0;});
+        }
+
+        void listen(const std::string& address) {
+            listener_ = stream_socket::listen(address);
+        }
+
+        /**
+         * Accept connections until stop, then end the sessions
+         */
+        void run() {
+            accept_connections(listener_, [this]() {return stopping_.load();}, [this](stream_socket&& socket) {
+                auto c = std::make_shared<stream_socket>(std::move(socket));
+                {
+                    std::scoped_lock lock(mutex_);
+                    connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+                        [](const auto& weak) {return weak.expired();}), connections_.end());
+                    connections_.push_back(c);
+                    ++sessions_;
+                }
+
+                std::thread([this, c]() {
+                    serve(*c);
+                    std::scoped_lock lock(mutex_);
+                    --sessions_;
+                    idle_.notify_all();
+                }).detach();
+            });
+
+            std::unique_lock lock(mutex_);
+            for(auto& weak: connections_) {
+                if(auto c = weak.lock()) c->shutdown();
+            }
+            idle_.wait(lock, [this]() {return sessions_ == 0;});
+        }
+
+        /**
+         * Make run return, may be called from any thread
+         */
+        void stop() {
+            stopping_ = true;
+            listener_.shutdown();
+        }
+
+        frame_stream_stats stats() const {
+            std::scoped_lock lock(mutex_);
+            return stats_;
+        }
+
+        /**
+         * Frame of map with its origin at (x, y) of the map's grid. Pixels of
+         * previous, a frame at (previous_x, previous_y) of the same grid, are
+         * copied where the frames overlap; rendered counts the others.
+         */
+        std::vector<int> render(const ra::fractal_logic::henon_map<FLOAT_T>& map, int x, int y,
+            const std::vector<int> * previous, int previous_x, int previous_y, std::uint64_t& rendered) const {
+
+            const int w = map.get_x_pixels(), h = map.get_y_pixels();
+            const int dx = x - previous_x, dy = y - previous_y;
+            const auto params = map.get_formula_params();
+
+            std::vector<int> its(static_cast<std::size_t>(w)*h);
+            std::vector<double> px(w);
+            for(int i=0; i<w; ++i) {
+                px[i] = static_cast<double>(map.map_to_cartesian_plane(x+i, 0).x);
+            }
+
+            std::vector<std::future<std::uint64_t>> tasks;
+            for(int first=0; first<h; first+=rows_per_task) {
+                tasks.push_back(pool_.submit([&, first]() {
+                    std::vector<double> py(w);
+                    std::uint64_t count = 0;
+                    auto compute = [&](int row, int from, int to) {
+                        if(to <= from) return;
+                        map.compute_batch(px.data()+from, py.data()+from, to-from, params, its.data() + static_cast<std::size_t>(row)*w + from);
+                        count += to-from;
+                    };
+
+                    for(int row=first; row<std::min(h, first+rows_per_task); ++row) {
+                        std::fill(py.begin(), py.end(), static_cast<double>(map.map_to_cartesian_plane(0, h-1-(y+row)).y));
+
+                        const int source = row+dy;
+                        if(!previous || source < 0 || source >= h) {
+                            compute(row, 0, w);
+                            continue;
+                        }
+                        //Columns [from, to) are column i+dx of the previous frame
+                        const int from = std::clamp(-dx, 0, w), to = std::clamp(w-dx, 0, w);
+                        std::copy(previous->begin() + static_cast<std::size_t>(source)*w + from + dx,
+                            previous->begin() + static_cast<std::size_t>(source)*w + std::max(from, to) + dx,
+                            its.begin() + static_cast<std::size_t>(row)*w + from);
+                        compute(row, 0, from);
+                        compute(row, std::max(from, to), w);
+                    }
+                    return count;
+                }));
+            }
+
+            //Tasks read this frame's locals, so wait for all before any can throw
+            for(auto& task: tasks) {
+                task.wait();
+            }
+            rendered = 0;
+            for(auto& task: tasks) {
+                rendered += task.get();
+            }
+            return its;
+        }
+
+        private:
+
+        static constexpr int rows_per_task = 16;
+
+        void serve(stream_socket& client) {
+            ra::fractal_logic::henon_map<FLOAT_T> map(view_);
+            const int w = map.get_x_pixels(), h = map.get_y_pixels();
+            std::uint64_t grid = 0;
+            int x = 0, y = 0;
+
+            std::vector<int> last;
+            std::uint64_t last_grid = 0;
+            int last_x = 0, last_y = 0;
+
+            try {
+                frame_encoder encoder(w, h, tile_);
+
+                auto send_frame = [&]() {
+                    std::uint64_t rendered = 0;
+                    std::vector<int> its;
+                    {
+                        RA_PROFILE_SCOPE("stream_render");
+                        its = render(map, x, y, (!last.empty() && last_grid == grid) ? &last : nullptr, last_x, last_y, rendered);
+                    }
+                    last = its;
+                    last_grid = grid;
+                    last_x = x;
+                    last_y = y;
+
+                    const frame_stream_stats before = encoder.stats();
+                    {
+                        RA_PROFILE_SCOPE("frame_encode");
+                        client.write_all(encoder.encode(std::move(its), grid, x, y));
+                    }
+                    RA_PROFILE_FRAME("stream frame");
+                    const frame_stream_stats& after = encoder.stats();
+
+                    std::scoped_lock lock(mutex_);
+                    stats_.frames += after.frames - before.frames;
+                    stats_.tiles += after.tiles - before.tiles;
+                    stats_.tiles_sent += after.tiles_sent - before.tiles_sent;
+                    stats_.bytes += after.bytes - before.bytes;
+                    stats_.rendered += rendered;
+                };
+
+                send_frame();
+
+                std::string line;
+                while(client.read_line(line)) {
+                    std::istringstream is(line);
+                    std::string command;
+                    is >> command;
+
+                    if(command == "ack") {
+                        std::uint64_t seq = 0;
+                        if(is >> seq) {
+                            encoder.acknowledge(seq);
+                            continue;
+                        }
+                    } else if(command == "pan") {
+                        int dx = 0, dy = 0;
+                        if(is >> dx >> dy && std::abs(static_cast<long long>(x) + dx) <= max_origin
+                            && std::abs(static_cast<long long>(y) + dy) <= max_origin) {
+                            x += dx;
+                            y += dy;
+                            send_frame();
+                            continue;
+                        }
+                    } else if(command == "zoom") {
+                        double factor = 0.0;
+                        int px = 0, py = 0;
+                        if(is >> factor >> px >> py && factor > 0.0 && factor < 1e6 && px >= 0 && px < w && py >= 0 && py < h) {
+                            zoom_view(map, x, y, factor, px, py);
+                            ++grid;
+                            x = y = 0;
+                            send_frame();
+                            continue;
+                        }
+                    }
+
+                    const std::string message = "Bad command: " + line;
+                    client.write_all("error " + std::to_string(message.size()) + "\n" + message);
+                }
+            } catch(std::exception&) {
+                //The client went away
+            }
+        }
+
+        const ra::fractal_logic::henon_map<FLOAT_T> view_;
+        ra::concurrency::thread_pool& pool_;
+        int tile_;
+        stream_socket listener_;
+
+        mutable std::mutex mutex_;
+        std::vector<std::weak_ptr<stream_socket>> connections_;
+        frame_stream_stats stats_;
+        int sessions_;
+        std::condition_variable idle_;
+
+        std::atomic<bool> stopping_;
+    };
+
+    /**
+     * Class: frame_client
+     *
+     * Description: Client of a frame_server which keeps the view's iteration
+     * counts up to date, one command at a time
+     */
+    class frame_client {
+
+        public:
+
+        /**
+         * Connect and receive the initial frame
+         */
+        explicit frame_client(const std::string& address): socket_(stream_socket::connect(address)), bytes_(0) {
+            receive();
+        }
+
+        const std::vector<int>& pan(int dx, int dy) {
+            return command("pan " + std::to_string(dx) + " " + std::to_string(dy) + "\n");
+        }
+
+        const std::vector<int>& zoom(double factor, int px, int py) {
+            std::ostringstream os;
+            os << std::setprecision(std::numeric_limits<double>::max_digits10) << "zoom " << factor << ' ' << px << ' ' << py << '\n';
+            return command(os.str());
+        }
+
+        const std::vector<int>& frame() const {return decoder_.frame();}
+
+        int tiles_sent() const {return decoder_.tiles_sent();}
+
+        std::uint64_t bytes_received() const {return bytes_;}
+
+        private:
+
+        const std::vector<int>& command(const std::string& line) {
+            socket_.write_all(line);
+            receive();
+            return frame();
+        }
+
+        void receive() {
+            std::string header, payload;
+            if(!socket_.read_line(header)) {
+                throw std::runtime_error("Frame server closed the connection");
+            }
+
+            std::size_t length = 0;
+            try {
+                length = std::stoull(header.substr(header.rfind(' ') + 1));
+            } catch(std::exception&) {
+                throw std::runtime_error("Malformed frame server response");
+            }
+            if(!socket_.read_exact(payload, length)) {
+                throw std::runtime_error("Frame server closed the connection");
+            }
+            bytes_ += header.size() + 1 + payload.size();
+
+            if(header.compare(0, 6, "error ") == 0) {
+                throw std::runtime_error(payload);
+            }
+            socket_.write_all("ack " + std::to_string(decoder_.apply(header, payload)) + "\n");
+        }
+
+        stream_socket socket_;
+        frame_decoder decoder_;
+        std::uint64_t bytes_;
+    };
+}
+
+#endif
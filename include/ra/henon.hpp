@@ -7,6 +7,18 @@
 #define RA_FRACTAL_LOGIC_HENON_MAP_HPP
 
 #include <vector>
+#include <string>
+#include <string_view>
+#include <regex>
+#include <iostream>
+#include <stdexcept>
+#include <cmath>
+#include <complex>
+#include <memory>
+
+#include "ra/expression.hpp"
+#include "ra/formulas.hpp"
+#include "ra/profile.hpp"
 
 namespace ra::fractal_logic {
     
@@ -30,6 +42,15 @@ namespace ra::fractal_logic {
         return os;
     }
 
+    /**
+     * Escape iteration count of a point together with an estimate of its
+     * distance to the boundary of the set (0 where none is available)
+     */
+    struct escape_distance {
+        int its;
+        double distance;
+    };
+
     /**
      * Class: henon_map
      * 
@@ -44,11 +65,22 @@ namespace ra::fractal_logic {
 
         using size_type = std::size_t;
 
+        //In the order of formula_registry
         enum fractal_t {
             henon,
-            mandelbrot
+            mandelbrot,
+            julia,
+            burning_ship,
+            tricorn,
+            multibrot3,
+            multibrot4,
+            multibrot5,
+            expression      //User formula given as -f expr:...
         };
 
+        //Most worker threads -j accepts
+        static constexpr int max_threads = 4096;
+
         private:
         
         //Henon parameters
@@ -72,6 +104,61 @@ namespace ra::fractal_logic {
         //The type of fractal
         fractal_t fractal;
 
+        //Compiled user formula of the expression type, shared by copies of the map
+        std::shared_ptr<const expression_formula> expression_;
+
+        //Headless output file ("-" for stdout), empty to open the GUI
+        std::string output_file_;
+
+        //Number of image rows rendered per band in headless mode
+        int band_height_;
+
+        //Number of worker threads (0 uses all hardware threads)
+        int threads_;
+
+        //zlib level for png output (-1 is zlib's default)
+        int compression_level_;
+
+        //Number of animation frames, the view zooms from min_/max_ to end_min_/end_max_
+        int frames_;
+        point<FLOAT_T> end_min_, end_max_;
+
+        //File of keyframe views used instead of the start and end views
+        std::string keyframe_file_;
+
+        //Headless render mode, empty for plain images and animations
+        std::string mode_;
+
+        //Frames per second of streamed animations
+        int frame_rate_;
+
+        //Number of samples (orbit points) for density and statistics modes
+        unsigned long long samples_;
+
+        //Parameter rectangle of the atlas mode, x holds a and y holds b
+        point<FLOAT_T> param_min_, param_max_;
+
+        //Samples per side of the grid summarizing each (a, b) pair in the atlas
+        int atlas_samples_;
+
+        //Most samples per pixel of adaptively supersampled images (1 is off)
+        int supersample_;
+
+        //Socket of the tile, frame or render server and its clients
+        std::string socket_path_;
+
+        //Chrome trace written at exit by profiling builds
+        std::string trace_file_;
+
+        //Input events recorded by the GUI, or replayed headlessly
+        std::string event_file_;
+
+        //Index in kernel_lanes of the batch kernel variant
+        int kernel_variant_;
+
+        //Options given on the command line, which tuned settings do not override
+        std::string given_options_;
+
         public:
 
         //Constructor initializes a bunch of values with defaults
@@ -88,21 +175,50 @@ namespace ra::fractal_logic {
             start_min_(min_), start_max_(max_),
             threshold_(threshold), max_its_(max_its),
             x_pixels_(x_pixels), y_pixels_(y_pixels),
-            fractal(henon) {}
+            fractal(henon), output_file_(),
+            band_height_(16), threads_(0),
+            compression_level_(-1), frames_(1),
+            end_min_(min_), end_max_(max_), keyframe_file_(), mode_(),
+            frame_rate_(30), samples_(100000000ull),
+            param_min_({0.0, -1.0}), param_max_({1.5, 1.0}), atlas_samples_(16),
+            supersample_(1), socket_path_(), trace_file_(), event_file_(),
+            kernel_variant_(find_kernel_variant(formula_lanes)), given_options_() {}
 
         /**
-         * Function: sets fractal type to mandelbrot or henon
+         * Function: sets fractal type to any formula of formula_registry by name,
+         * or to a user formula written "expr:<x expression>, <y expression>"
          */
         bool set_fractal_type(std::string type) {
-            if(type == "henon") {
-                fractal = henon;
-                return true;
-            }else if(type == "mandelbrot") {
-                fractal = mandelbrot;
+            const std::string prefix = "expr:";
+            if(type.compare(0, prefix.size(), prefix) == 0) {
+                try {
+                    expression_ = std::make_shared<const expression_formula>(type.substr(prefix.size()));
+                } catch(std::invalid_argument& e) {
+                    std::cerr << e.what() << endl;
+                    return false;
+                }
+                fractal = expression;
                 return true;
             }
 
-            return false;
+            int index = find_formula(type);
+            if(index < 0) {
+                return false;
+            }
+
+            fractal = static_cast<fractal_t>(index);
+            return true;
+        }
+
+        const char * get_fractal_name() const {
+            return fractal == expression ? "expr" : formula_registry[fractal].name;
+        }
+
+        /**
+         * The compiled user formula, null unless the type is expression
+         */
+        const expression_formula * get_expression() const {
+            return fractal == expression ? expression_.get() : nullptr;
         }
 
         /**
@@ -126,6 +242,7 @@ namespace ra::fractal_logic {
 
         int process_command_line_args(int argc, char ** argv) {
             char * end;
+            bool end_min_set = false, end_max_set = false;
             for(int i=1; i<argc; i+=2){ 
                 std::string arg = argv[i];
 
@@ -196,38 +313,198 @@ namespace ra::fractal_logic {
                         max_ = cla_set_point(argv[i+1]);
                         break;  
                     }
+                    case 'o': //Render headlessly to a file
+                        output_file_ = argv[i+1];
+                        break;
+                    case 'B': //Set band height for headless rendering
+                        band_height_ = std::strtoull(argv[i+1], &end, 10);
+                        if(band_height_ <= 0) return -1;
+                        break;
+                    case 'j': { //Set number of worker threads, 0 for one per hardware thread
+                        long threads = std::strtol(argv[i+1], &end, 10);
+                        if(*end != '\0' || end == argv[i+1] || threads < 0 || threads > max_threads) return -1;
+                        threads_ = static_cast<int>(threads);
+                        break;
+                    }
+                    case 'F': //Set number of animation frames
+                        frames_ = std::strtoull(argv[i+1], &end, 10);
+                        if(frames_ <= 0) return -1;
+                        break;
+                    case 'l': //Set final lower left point of an animation
+                        end_min_ = cla_set_point(argv[i+1]);
+                        end_min_set = true;
+                        break;
+                    case 'u': //Set final upper right point of an animation
+                        end_max_ = cla_set_point(argv[i+1]);
+                        end_max_set = true;
+                        break;
+                    case 'K': //Set keyframe file of an animation
+                        keyframe_file_ = argv[i+1];
+                        break;
+                    case 'r': //Set frame rate of streamed animations
+                        frame_rate_ = std::strtoull(argv[i+1], &end, 10);
+                        if(frame_rate_ <= 0) return -1;
+                        break;
+                    case 'n': { //Set number of samples, accepts e.g. 1e10
+                        double samples = std::strtod(argv[i+1], &end);
+                        if(*end != '\0' || samples < 1.0) return -1;
+                        samples_ = static_cast<unsigned long long>(samples);
+                        break;
+                    }
+                    case 'M': //Set headless render mode
+                        mode_ = argv[i+1];
+                        break;
+                    case 'P': //Set lower left (a, b) of the parameter atlas
+                        param_min_ = cla_set_point(argv[i+1]);
+                        break;
+                    case 'Q': //Set upper right (a, b) of the parameter atlas
+                        param_max_ = cla_set_point(argv[i+1]);
+                        break;
+                    case 'S': //Set samples per side summarizing each atlas pixel
+                        atlas_samples_ = std::strtoull(argv[i+1], &end, 10);
+                        if(atlas_samples_ <= 0) return -1;
+                        break;
+                    case 'A': //Set most samples per pixel for adaptive supersampling
+                        supersample_ = std::strtoull(argv[i+1], &end, 10);
+                        if(supersample_ <= 0) return -1;
+                        break;
+                    case 's': //Set socket of the tile, frame or render server
+                        socket_path_ = argv[i+1];
+                        break;
+                    case 'T': //Set file for the Chrome trace of a profiling build
+                        trace_file_ = argv[i+1];
+                        break;
+                    case 'R': //Set file of recorded input events
+                        event_file_ = argv[i+1];
+                        break;
+                    case 'V': //Set lanes of the batch kernel
+                        if(!set_kernel_lanes(std::strtol(argv[i+1], &end, 10)) || *end != '\0') return -1;
+                        break;
+                    case 'z': //Set png compression level
+                        compression_level_ = std::strtol(argv[i+1], &end, 10);
+                        if(*end != '\0' || compression_level_ < -1 || compression_level_ > 9) return -1;
+                        break;
                     default:
                         return -1;
                 }
-                    
+                given_options_ += arg[1];
             }
 
+            //Keep stdout clean when the image itself is streamed there
+            std::ostream& info = (output_file_ == "-") ? std::cerr : cout;
+
             if(get_fractal_type() == henon) {
-                cout << "Displaying henon fractal:" << endl;
-                cout << "a: " << get_a() << endl;
-                cout << "b: " << get_b() << endl;
-                cout << "Threshold: " << get_threshold() << endl;
-            } else if(get_fractal_type() == mandelbrot) {
-                cout << "Displaying mandelbrot fractal:" << endl;
+                info << "Displaying henon fractal:" << endl;
+                info << "a: " << get_a() << endl;
+                info << "b: " << get_b() << endl;
+                info << "Threshold: " << get_threshold() << endl;
+            } else if(get_fractal_type() == expression) {
+                info << "Displaying formula " << expression_->source() << ":" << endl;
+                info << "Instructions per iteration: " << expression_->code().size()
+                    << ", registers: " << expression_->registers() << endl;
+            } else if(get_fractal_type() == julia) {
+                info << "Displaying julia fractal:" << endl;
+                info << "c: " << get_a() << " + " << get_b() << "i" << endl;
+            } else {
+                info << "Displaying " << get_fractal_name() << " fractal:" << endl;
             }
-            cout << "Number of vertical pixels on screen: " << get_y_pixels() << endl;
-            cout << "Number of vertical pixels on screen: " << get_x_pixels() << endl;
-            cout << "Max Iterations: " << get_max_iterations() << endl;
-            cout << "Lower Left Point: " << get_bottom_left() << endl;
-            cout << "Upper Right Point: " << get_top_right() << endl;
+            info << "Number of vertical pixels on screen: " << get_y_pixels() << endl;
+            info << "Number of vertical pixels on screen: " << get_x_pixels() << endl;
+            info << "Max Iterations: " << get_max_iterations() << endl;
+            info << "Lower Left Point: " << get_bottom_left() << endl;
+            info << "Upper Right Point: " << get_top_right() << endl;
 
             //Set start coordinates
             start_min_ = min_;
             start_max_ = max_;
 
+            //Animations without an end view stay on the start view
+            if(!end_min_set) end_min_ = min_;
+            if(!end_max_set) end_max_ = max_;
+
             return 0;
         }
 
 
-        fractal_t get_fractal_type() {
+        fractal_t get_fractal_type() const {
             return fractal;
         }
 
+        const std::string& get_output_file() const {return output_file_;}
+        void set_output_file(std::string output_file) {output_file_ = output_file;}
+
+        int get_band_height() const {return band_height_;}
+        void set_band_height(int band_height) {band_height_ = band_height;}
+
+        int get_threads() const {return threads_;}
+        void set_threads(int threads) {threads_ = threads;}
+
+        int get_compression_level() const {return compression_level_;}
+        void set_compression_level(int level) {compression_level_ = level;}
+
+        int get_frames() const {return frames_;}
+        void set_frames(int frames) {frames_ = frames;}
+
+        point<FLOAT_T> get_end_bottom_left() const {return end_min_;}
+        void set_end_bottom_left(point<FLOAT_T> end_min) {end_min_ = end_min;}
+
+        point<FLOAT_T> get_end_top_right() const {return end_max_;}
+        void set_end_top_right(point<FLOAT_T> end_max) {end_max_ = end_max;}
+
+        const std::string& get_keyframe_file() const {return keyframe_file_;}
+        void set_keyframe_file(std::string keyframe_file) {keyframe_file_ = keyframe_file;}
+
+        const std::string& get_mode() const {return mode_;}
+        void set_mode(std::string mode) {mode_ = mode;}
+
+        int get_frame_rate() const {return frame_rate_;}
+        void set_frame_rate(int frame_rate) {frame_rate_ = frame_rate;}
+
+        unsigned long long get_samples() const {return samples_;}
+        void set_samples(unsigned long long samples) {samples_ = samples;}
+
+        point<FLOAT_T> get_param_bottom_left() const {return param_min_;}
+        void set_param_bottom_left(point<FLOAT_T> param_min) {param_min_ = param_min;}
+
+        point<FLOAT_T> get_param_top_right() const {return param_max_;}
+        void set_param_top_right(point<FLOAT_T> param_max) {param_max_ = param_max;}
+
+        int get_atlas_samples() const {return atlas_samples_;}
+        void set_atlas_samples(int samples) {atlas_samples_ = samples;}
+
+        int get_supersample() const {return supersample_;}
+        void set_supersample(int samples) {supersample_ = samples;}
+
+        const std::string& get_socket_path() const {return socket_path_;}
+        void set_socket_path(std::string socket_path) {socket_path_ = socket_path;}
+
+        const std::string& get_trace_file() const {return trace_file_;}
+        void set_trace_file(std::string trace_file) {trace_file_ = trace_file;}
+
+        int get_kernel_lanes() const {return kernel_lanes[kernel_variant_];}
+
+        /**
+         * Use the batch kernel variant of lanes, false if there is none
+         */
+        bool set_kernel_lanes(int lanes) {
+            int variant = find_kernel_variant(lanes);
+            if(variant < 0) {
+                return false;
+            }
+            kernel_variant_ = variant;
+            return true;
+        }
+
+        /**
+         * Whether -option was given on the command line
+         */
+        bool is_option_given(char option) const {
+            return given_options_.find(option) != std::string::npos;
+        }
+
+        const std::string& get_event_file() const {return event_file_;}
+        void set_event_file(std::string event_file) {event_file_ = event_file;}
+
         void set_x_pixels(int x_pixels){x_pixels_ = x_pixels;}
         int get_x_pixels() const {return x_pixels_;}
         
@@ -264,13 +541,266 @@ namespace ra::fractal_logic {
          * Takes 
          * 
         */
-        point<FLOAT_T> map_to_cartesian_plane(int x, int y) {
+        point<FLOAT_T> map_to_cartesian_plane(int x, int y) const {
             return {
                 min_.x + static_cast<FLOAT_T>(x*(max_.x - min_.x))/(x_pixels_-1), 
                 min_.y + static_cast<FLOAT_T>(y*(max_.y - min_.y))/(y_pixels_-1)
             };
         }
+
+        /**
+         * CPU version of compute_henon from HENON_FRAGMENT_SHADER.
+         * Iterates in double precision, as the shader does.
+         * 
+         * Returns: number of iterations before the orbit leaves the threshold
+         */
+        int compute_henon(double x, double y) const {
+            return escape_iterations<henon_formula>(x, y, get_formula_params());
+        }
+
+        /**
+         * CPU version of compute_mandelbrot from MANDELBROT_FRAGMENT_SHADER.
+         * 
+         * Returns: number of iterations before |z| exceeds 2
+         */
+        int compute_mandelbrot(double cx, double cy) const {
+            return escape_iterations<mandelbrot_formula>(cx, cy, get_formula_params());
+        }
+
+        /**
+         * Parameters of the current view read by the formula kernels
+         */
+        formula_params get_formula_params() const {
+            return {static_cast<double>(a_), static_cast<double>(b_),
+                static_cast<double>(static_cast<double>(threshold_)*threshold_), max_its_};
+        }
+
+        /**
+         * Escape iteration count of a point for the current fractal type
+         */
+        int compute_iterations(point<FLOAT_T> p) const {
+            if(fractal == expression) {
+                double px = p.x, py = p.y;
+                int its;
+                expression_->run(&px, &py, 1, get_formula_params(), &its);
+                return its;
+            }
+            return formula_registry[fractal].point(p.x, p.y, get_formula_params());
+        }
+
+        /**
+         * Escape iteration counts of n points given by coordinates, through the
+         * batch kernel of the current fractal type
+         */
+        void compute_batch(const double * px, const double * py, std::size_t n, const formula_params& params, int * its) const {
+            if(fractal == expression) {
+                expression_->run(px, py, n, params, its);
+            } else {
+                formula_registry[fractal].variants[kernel_variant_](px, py, n, params, its);
+            }
+        }
+
+        /**
+         * Points compute_batch iterates together: each group runs until its
+         * slowest point escapes
+         */
+        int batch_lanes() const {
+            return fractal == expression ? expression_formula::batch_size : get_kernel_lanes();
+        }
+
+        /**
+         * compute_henon which also carries the Jacobian of the orbit with
+         * respect to the starting point. Like the Mandelbrot estimate, the
+         * distance of an escaping point to the basin boundary is taken as
+         * G/|grad G| with G ~ log(r_n)/2^n, giving 0.5*r^2*log(r)/|M^T z_n|
+         * where M is the product of the Jacobians [[-2ax, 1], [b, 0]].
+         * Bounded orbits get distance 0.
+         */
+        escape_distance compute_henon_distance(double x, double y) const {
+            const double a = a_, b = b_;
+            const double threshold_squared = static_cast<double>(threshold_)*threshold_;
+
+            //Columns of M: images of the unit tangent vectors
+            double ux = 1.0, uy = 0.0, vx = 0.0, vy = 1.0;
+
+            int i;
+            for(i=0; i<max_its_; ++i) {
+                double ux_next = -2.0*a*x*ux + uy, vx_next = -2.0*a*x*vx + vy;
+                uy = b*ux;
+                vy = b*vx;
+                ux = ux_next;
+                vx = vx_next;
+
+                double x_next = 1.0 - a*x*x + y;
+                y = b*x;
+                x = x_next;
+
+                if(x*x + y*y > threshold_squared) {
+                    break;
+                }
+            }
+            if(i == max_its_) {
+                return {i, 0.0};
+            }
+
+            double r_squared = x*x + y*y;
+            double gradient = std::hypot(ux*x + uy*y, vx*x + vy*y);
+            double distance = gradient > 0.0 ? 0.25*r_squared*std::log(r_squared)/gradient : 0.0;
+            return {i, distance};
+        }
+
+        /**
+         * compute_mandelbrot which also tracks the derivatives needed for a
+         * distance estimate. Escaping points use the exterior estimate
+         * 0.5*|z|*log|z|/|dz/dc|, iterating a few steps past the escape
+         * radius to sharpen it. Points which stay bounded use the interior
+         * estimate of their attracting cycle, found by period detection and
+         * Newton's method; the true distance lies between a quarter of it
+         * and the estimate itself. Distance is 0 when no cycle is found.
+         */
+        escape_distance compute_mandelbrot_distance(double cx, double cy) const {
+            using complex = std::complex<double>;
+            const complex c(cx, cy);
+
+            complex z = 0.0, dz = 0.0;
+            int i;
+            for(i=0; i<max_its_; ++i) {
+                dz = 2.0*z*dz + 1.0;
+                z = z*z + c;
+
+                if(std::norm(z) > 4.0) {
+                    break;
+                }
+            }
+
+            if(i < max_its_) {
+                for(int extra=0; extra<8 && std::norm(z) < 1e6; ++extra) {
+                    dz = 2.0*z*dz + 1.0;
+                    z = z*z + c;
+                }
+                double r = std::abs(z);
+                return {i, 0.5*r*std::log(r)/std::abs(dz)};
+            }
+
+            return {i, mandelbrot_interior_distance(c, z)};
+        }
+
+        /**
+         * Distance estimate of a point for the current fractal type
+         */
+        escape_distance compute_distance(point<FLOAT_T> p) const {
+            if(fractal == mandelbrot) {
+                return compute_mandelbrot_distance(p.x, p.y);
+            } else if(fractal == henon) {
+                return compute_henon_distance(p.x, p.y);
+            }
+            return {compute_iterations(p), 0.0};
+        }
+
+        /**
+         * Escape iteration counts of an arbitrary list of n points, written to its.
+         * The formula is looked up once per call, and points go through its
+         * vectorized batch kernel.
+         */
+        void compute_points(const point<FLOAT_T> * points, std::size_t n, int * its) const {
+            constexpr std::size_t chunk = 256;
+            const formula_params params = get_formula_params();
+
+            double px[chunk], py[chunk];
+            for(std::size_t first=0; first<n; first+=chunk) {
+                std::size_t count = std::min(chunk, n-first);
+                for(std::size_t i=0; i<count; ++i) {
+                    px[i] = points[first+i].x;
+                    py[i] = points[first+i].y;
+                }
+                compute_batch(px, py, count, params, its+first);
+            }
+        }
+
+        /**
+         * Interior distance estimate of c from z, a point of its orbit near
+         * the attracting cycle:
+         * (1-|dz|^2)/|dz/dc dz + d^2z/dz^2 (dz/dc)/(1-dz)| over one period
+         */
+        static double mandelbrot_interior_distance(std::complex<double> c, std::complex<double> z) {
+            using complex = std::complex<double>;
+            constexpr int max_period = 64;
+
+            //Period: first return close to z
+            complex w = z;
+            int period = 0;
+            for(int p=1; p<=max_period; ++p) {
+                w = w*w + c;
+                if(std::norm(w-z) < 1e-18 + 1e-12*std::norm(z)) {
+                    period = p;
+                    break;
+                }
+            }
+            if(period == 0) {
+                return 0.0;
+            }
+
+            //Newton's method on f^p(w) - w = 0 for a point of the cycle
+            w = z;
+            for(int step=0; step<8; ++step) {
+                complex f = w, df = 1.0;
+                for(int k=0; k<period; ++k) {
+                    df = 2.0*f*df;
+                    f = f*f + c;
+                }
+                if(df == 1.0) break;
+                w -= (f-w)/(df-1.0);
+            }
+
+            complex dz = 1.0, dc = 0.0, dzdz = 0.0, dcdz = 0.0;
+            for(int k=0; k<period; ++k) {
+                dcdz = 2.0*(w*dcdz + dc*dz);
+                dzdz = 2.0*(dz*dz + w*dzdz);
+                dc = 2.0*w*dc + 1.0;
+                dz = 2.0*w*dz;
+                w = w*w + c;
+            }
+
+            if(std::norm(dz) >= 1.0) {
+                return 0.0;
+            }
+            return (1.0-std::norm(dz))/std::abs(dcdz + dzdz*dc/(1.0-dz));
+        }
+
+        /**
+         * Render image rows [first_row, first_row+num_rows) into its, which must hold
+         * num_rows*x_pixels_ values. Image row 0 is the top of the view, matching
+         * the usual top-down layout of image files (the GUI's y axis is flipped).
+         */
+        void render_rows(int first_row, int num_rows, int * its) const {
+            //Each row is one call of the formula's batch kernel
+            RA_PROFILE_SCOPE("render_rows");
+            const formula_params params = get_formula_params();
+
+            std::vector<double> px(x_pixels_), py(x_pixels_);
+            for(int x=0; x<x_pixels_; ++x) {
+                px[x] = map_to_cartesian_plane(x, 0).x;
+            }
+
+            for(int row=first_row; row<first_row+num_rows; ++row) {
+                std::fill(py.begin(), py.end(), static_cast<double>(map_to_cartesian_plane(0, y_pixels_-1-row).y));
+                compute_batch(px.data(), py.data(), x_pixels_, params, its);
+                RA_PROFILE_ITERATIONS(its, x_pixels_, max_its_);
+                its += x_pixels_;
+            }
+        }
     };
+
+    //fractal_t indexes formula_registry, so the two orders must agree
+    static_assert(formula_registry.size() == henon_map<double>::expression);
+    static_assert(std::string_view(formula_registry[henon_map<double>::henon].name) == "henon");
+    static_assert(std::string_view(formula_registry[henon_map<double>::mandelbrot].name) == "mandelbrot");
+    static_assert(std::string_view(formula_registry[henon_map<double>::julia].name) == "julia");
+    static_assert(std::string_view(formula_registry[henon_map<double>::burning_ship].name) == "burningship");
+    static_assert(std::string_view(formula_registry[henon_map<double>::tricorn].name) == "tricorn");
+    static_assert(std::string_view(formula_registry[henon_map<double>::multibrot3].name) == "multibrot3");
+    static_assert(std::string_view(formula_registry[henon_map<double>::multibrot4].name) == "multibrot4");
+    static_assert(std::string_view(formula_registry[henon_map<double>::multibrot5].name) == "multibrot5");
 }
 
 #endif
@@ -0,0 +1,158 @@
+/**
+ * Largest Lyapunov exponent field of the Henon map:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_LYAPUNOV_HPP
+#define RA_FRACTAL_LOGIC_LYAPUNOV_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "ra/henon.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Largest Lyapunov exponent of the orbits of LANES starting points,
+     * iterated together so the loops over lanes vectorize. A tangent vector
+     * is carried through the Jacobian [[-2ax, 1], [b, 0]] alongside each
+     * orbit and renormalized every renormalize steps; the logs of its growth
+     * after the first transient steps, divided by the steps counted, give
+     * the exponent. Orbits leaving the threshold get NaN.
+     */
+    template<int LANES>
+    void henon_lyapunov_lanes(double a, double b, const double * x0, const double * y0,
+        double threshold_squared, int steps, int transient, int renormalize, double * exponents) {
+
+        double x[LANES], y[LANES], vx[LANES], vy[LANES], log_sum[LANES];
+        int done[LANES];
+        for(int l=0; l<LANES; ++l) {
+            x[l] = x0[l];
+            y[l] = y0[l];
+            vx[l] = 1.0;
+            vy[l] = 0.0;
+            log_sum[l] = 0.0;
+            done[l] = 0;
+        }
+
+        renormalize = std::max(1, renormalize);
+        transient = std::clamp(transient, 0, steps);
+
+        int counted = 0;
+        for(int step=0; step<steps; step+=renormalize) {
+            int block = std::min(renormalize, steps-step);
+
+            for(int i=0; i<block; ++i) {
+                for(int l=0; l<LANES; ++l) {
+                    double x_next = 1.0 - a*x[l]*x[l] + y[l];
+                    double vx_next = -2.0*a*x[l]*vx[l] + vy[l];
+                    vy[l] = b*vx[l];
+                    vx[l] = vx_next;
+                    y[l] = b*x[l];
+                    x[l] = x_next;
+
+                    done[l] |= !(x[l]*x[l] + y[l]*y[l] <= threshold_squared);
+                }
+            }
+
+            //Blocks which end inside the transient only renormalize
+            bool count = step+block > transient;
+            if(count) counted += block;
+
+            int all_done = 1;
+            for(int l=0; l<LANES; ++l) {
+                double norm = std::sqrt(vx[l]*vx[l] + vy[l]*vy[l]);
+                norm = done[l] ? 1.0 : std::max(norm, std::numeric_limits<double>::min());
+                log_sum[l] += count ? std::log(norm) : 0.0;
+                vx[l] /= norm;
+                vy[l] /= norm;
+                all_done &= done[l];
+            }
+            if(all_done) break;
+        }
+
+        for(int l=0; l<LANES; ++l) {
+            exponents[l] = (done[l] || counted == 0) ? std::numeric_limits<double>::quiet_NaN() : log_sum[l]/counted;
+        }
+    }
+
+    /**
+     * Class: lyapunov_field
+     *
+     * Description: Largest Lyapunov exponent of the Henon map for every pixel
+     * of a henon_map's view, using its a, b, threshold and max_iterations
+     * (the orbit length). Pixels are iterated in lanes along each row.
+     * render_rows has the same form as henon_map::render_rows, so bands can
+     * be streamed to any image sink by band_renderer: exponents in
+     * [lambda_min, lambda_max] map to 1..levels, and escaping orbits to 0.
+     */
+    template<class FLOAT_T>
+    class lyapunov_field {
+
+        public:
+
+        static constexpr int lanes = 8;
+        static constexpr int renormalize = 8;
+
+        lyapunov_field(const henon_map<FLOAT_T>& map, double lambda_min = -1.0, double lambda_max = 1.0,
+            int levels = 1024):
+            map_(map), lambda_min_(lambda_min), lambda_max_(lambda_max), levels_(std::max(1, levels)) {}
+
+        /**
+         * Exponents of rows [first_row, first_row+num_rows), image row 0 at the
+         * top of the view, NaN where the orbit escapes
+         */
+        void exponents(int first_row, int num_rows, double * out) const {
+            const int width = map_.get_x_pixels();
+            const int height = map_.get_y_pixels();
+            const double threshold_squared = static_cast<double>(map_.get_threshold())*map_.get_threshold();
+            const int steps = map_.get_max_iterations();
+
+            for(int row=first_row; row<first_row+num_rows; ++row) {
+                for(int x=0; x<width; x+=lanes) {
+                    double x0[lanes], y0[lanes], lambda[lanes];
+                    for(int l=0; l<lanes; ++l) {
+                        //Lanes past the end of the row repeat the last pixel
+                        auto p = map_.map_to_cartesian_plane(std::min(x+l, width-1), height-1-row);
+                        x0[l] = p.x;
+                        y0[l] = p.y;
+                    }
+
+                    henon_lyapunov_lanes<lanes>(map_.get_a(), map_.get_b(), x0, y0,
+                        threshold_squared, steps, steps/8, renormalize, lambda);
+
+                    std::copy(lambda, lambda + std::min(lanes, width-x), out);
+                    out += std::min(lanes, width-x);
+                }
+            }
+        }
+
+        /**
+         * Exponents quantized to iteration counts with max_its = levels()
+         */
+        void render_rows(int first_row, int num_rows, int * its) const {
+            const int width = map_.get_x_pixels();
+            std::vector<double> lambda(static_cast<std::size_t>(num_rows)*width);
+            exponents(first_row, num_rows, lambda.data());
+
+            const double scale = (levels_-1)/(lambda_max_-lambda_min_);
+            for(double l: lambda) {
+                *its++ = std::isnan(l) ? 0
+                    : 1 + static_cast<int>(std::lround((std::clamp(l, lambda_min_, lambda_max_)-lambda_min_)*scale));
+            }
+        }
+
+        int levels() const {return levels_;}
+
+        private:
+
+        const henon_map<FLOAT_T>& map_;
+        double lambda_min_, lambda_max_;
+        int levels_;
+    };
+}
+
+#endif
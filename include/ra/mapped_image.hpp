@@ -0,0 +1,225 @@
+/**
+ * Memory mapped raw image output (PPM/PFM) written in place by the workers:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_IO_MAPPED_IMAGE_HPP
+#define RA_IO_MAPPED_IMAGE_HPP
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ra/band_renderer.hpp"
+#include "ra/color.hpp"
+#include "ra/profile.hpp"
+
+namespace ra::io {
+
+    /**
+     * Class: mapped_image_sink
+     *
+     * Description: Preallocates a binary PPM (rgb bytes) or PFM (one little
+     * endian float per pixel holding iterations/max_its) file, maps it, and lets tiles be
+     * written straight into the mapping from any thread in any order. No
+     * copy of the image is kept outside the page cache.
+     *
+     * After each tile its pages are scheduled for write back and, if
+     * release_written is set, dropped from this process' mapping, so
+     * resident memory stays small for images larger than RAM.
+     */
+    class mapped_image_sink {
+
+        public:
+
+        enum format_t {
+            ppm,
+            pfm
+        };
+
+        //Tiles are written during encode, nothing is left to do in row order
+        using chunk_type = int;
+
+        mapped_image_sink(std::string file_name, format_t format, bool release_written = true):
+            file_name_(std::move(file_name)), format_(format), release_written_(release_written),
+            fd_(-1), data_(nullptr), size_(0), header_size_(0),
+            width_(0), height_(0), max_its_(1) {}
+
+        mapped_image_sink(const mapped_image_sink&) = delete;
+        mapped_image_sink& operator=(const mapped_image_sink&) = delete;
+
+        ~mapped_image_sink() {
+            unmap();
+        }
+
+        void begin(int width, int height, int max_its) {
+            unmap();
+
+            width_ = width;
+            height_ = height;
+            max_its_ = max_its;
+
+            //PFM has a negative scale for little endian data
+            std::string header = (format_ == ppm)
+                ? "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n"
+                : "Pf\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n-1.0\n";
+
+            header_size_ = header.size();
+            size_ = header_size_ + static_cast<std::size_t>(width)*height*pixel_bytes();
+
+            fd_ = ::open(file_name_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(fd_ < 0) {
+                throw_errno("Could not open " + file_name_);
+            }
+
+            //Reserve the blocks up front, so running out of space is an error here and
+            //not a SIGBUS while writing through the mapping
+            int status = ::posix_fallocate(fd_, 0, size_);
+            if(status == EOPNOTSUPP || status == EINVAL) {
+                status = ::ftruncate(fd_, size_) == 0 ? 0 : errno;
+            }
+            if(status != 0) {
+                errno = status;
+                throw_errno("Could not allocate " + file_name_);
+            }
+
+            void * data = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if(data == MAP_FAILED) {
+                throw_errno("Could not map " + file_name_);
+            }
+            data_ = static_cast<unsigned char *>(data);
+
+            //Tiles arrive in no particular order, read ahead would only waste I/O
+            ::madvise(data_, size_, MADV_RANDOM);
+
+            std::memcpy(data_, header.data(), header_size_);
+        }
+
+        /**
+         * Write a tile of w*h iteration counts (row major, top row first) whose
+         * top left pixel is (x, y). Safe to call concurrently for disjoint tiles.
+         * A ppm is written with the tile's colors from rgb if it is not null.
+         */
+        void write_tile(int x, int y, int w, int h, const int * its, const unsigned char * rgb = nullptr) const {
+            const std::size_t bytes = pixel_bytes();
+            RA_PROFILE_COUNT(bytes_written, bytes*w*h);
+            const float scale = 1.0f/max_its_;
+
+            std::vector<float> values(format_ == pfm ? w : 0);
+
+            for(int row=0; row<h; ++row) {
+                const int * src = its + static_cast<std::size_t>(row)*w;
+
+                if(format_ == ppm && rgb) {
+                    std::memcpy(pixel_address(x, y+row), rgb + 3*static_cast<std::size_t>(row)*w, 3*w);
+                } else if(format_ == ppm) {
+                    ra::fractal_logic::colorize(src, w, max_its_, pixel_address(x, y+row));
+                } else {
+                    //The header leaves the floats unaligned, so copy rows in whole
+                    for(int i=0; i<w; ++i) {
+                        values[i] = src[i]*scale;
+                    }
+                    std::memcpy(pixel_address(x, y+row), values.data(), w*bytes);
+                }
+            }
+
+            //Start write back of the finished rows and release them. Full width
+            //tiles are contiguous in the file
+            if(x == 0 && w == width_) {
+                unsigned char * first = pixel_address(0, format_ == ppm ? y : y+h-1);
+                flush_range(first, static_cast<std::size_t>(h)*w*bytes);
+            } else {
+                for(int row=0; row<h; ++row) {
+                    flush_range(pixel_address(x, y+row), w*bytes);
+                }
+            }
+        }
+
+        chunk_type encode(const ra::fractal_logic::band_view& band) const {
+            write_tile(0, band.first_row, band.width, band.num_rows, band.its, band.rgb);
+            return band.num_rows;
+        }
+
+        void write(chunk_type&&) {}
+
+        /**
+         * Wait for all data to reach the file and close it
+         */
+        void end() {
+            if(data_ && ::msync(data_, size_, MS_SYNC) != 0) {
+                throw_errno("Could not sync " + file_name_);
+            }
+            unmap();
+        }
+
+        private:
+
+        std::size_t pixel_bytes() const {
+            return format_ == ppm ? 3 : sizeof(float);
+        }
+
+        /**
+         * PFM stores rows bottom to top
+         */
+        unsigned char * pixel_address(int x, int y) const {
+            std::size_t file_row = (format_ == ppm) ? y : height_-1-y;
+            return data_ + header_size_ + (file_row*width_ + x)*pixel_bytes();
+        }
+
+        /**
+         * Schedule write back of the pages fully covered by [begin, begin+length)
+         * and drop them from the mapping. Partially covered pages may still be
+         * written by a neighbouring tile, and are handled by the msync in end.
+         */
+        void flush_range(unsigned char * begin, std::size_t length) const {
+            const std::size_t page = ::sysconf(_SC_PAGESIZE);
+
+            std::size_t first = (begin - data_ + page - 1)/page*page;
+            std::size_t last = (begin - data_ + length)/page*page;
+            if(first >= last) {
+                return;
+            }
+
+            ::msync(data_ + first, last-first, MS_ASYNC);
+            if(release_written_) {
+                //Dirty pages of a shared file mapping stay in the page cache
+                ::madvise(data_ + first, last-first, MADV_DONTNEED);
+            }
+        }
+
+        void unmap() {
+            if(data_) {
+                ::munmap(data_, size_);
+                data_ = nullptr;
+            }
+            if(fd_ >= 0) {
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        [[noreturn]] static void throw_errno(const std::string& what) {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        std::string file_name_;
+        format_t format_;
+        bool release_written_;
+
+        int fd_;
+        unsigned char * data_;
+        std::size_t size_;
+        std::size_t header_size_;
+
+        int width_, height_;
+        int max_its_;
+    };
+}
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * PNG output for the band renderer, compressed in parallel:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_IO_PNG_HPP
+#define RA_IO_PNG_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+#include "ra/band_renderer.hpp"
+#include "ra/color.hpp"
+#include "ra/profile.hpp"
+
+namespace ra::io {
+
+    /**
+     * Class: png_sink
+     *
+     * Description: Band sink writing an 8 bit rgb PNG image to a stream.
+     *
+     * Each band is colored, filtered and deflated independently on the
+     * worker threads. A band's deflate stream ends with a sync flush, which
+     * byte aligns it without marking the final block, so the bands
+     * concatenate into one valid zlib stream. The adler32 checksums of the
+     * bands are combined in row order when they are written.
+     */
+    class png_sink {
+
+        public:
+
+        struct chunk_type {
+            std::vector<unsigned char> data; //Raw deflate data
+            uLong adler;                     //adler32 of the filtered rows
+            z_off_t length;                  //Number of filtered bytes
+        };
+
+        /**
+         * level: zlib compression level, 0 stores the rows uncompressed,
+         * 1 is fastest and 9 smallest. Z_DEFAULT_COMPRESSION is 6.
+         */
+        explicit png_sink(std::ostream& os, int level = Z_DEFAULT_COMPRESSION):
+            os_(os), level_(level), height_(0), adler_(1) {
+
+            if(level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+                throw std::invalid_argument("Invalid png compression level");
+            }
+        }
+
+        void begin(int width, int height, int) {
+            height_ = height;
+            adler_ = adler32(0, Z_NULL, 0);
+
+            static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+            os_.write(reinterpret_cast<const char *>(signature), sizeof(signature));
+
+            unsigned char ihdr[13];
+            put_u32(ihdr, width);
+            put_u32(ihdr+4, height);
+            ihdr[8] = 8;  //Bit depth
+            ihdr[9] = 2;  //Color type: rgb
+            ihdr[10] = 0; //Deflate
+            ihdr[11] = 0; //Adaptive filtering
+            ihdr[12] = 0; //No interlace
+            write_chunk("IHDR", ihdr, sizeof(ihdr));
+
+            //zlib header: deflate with a 32K window, level hint, no dictionary
+            unsigned char zlib_header[2] = {0x78, 0x9c};
+            if(level_ == 0 || level_ == 1) {
+                zlib_header[1] = 0x01;
+            } else if(level_ >= 7) {
+                zlib_header[1] = 0xda;
+            }
+            write_chunk("IDAT", zlib_header, sizeof(zlib_header));
+        }
+
+        chunk_type encode(const ra::fractal_logic::band_view& band) const {
+            RA_PROFILE_SCOPE("png_encode");
+            const std::size_t row_bytes = 3*static_cast<std::size_t>(band.width);
+            const std::size_t num_pixels = static_cast<std::size_t>(band.num_rows)*band.width;
+
+            std::vector<unsigned char> rgb(3*num_pixels);
+            ra::fractal_logic::colorize(band, rgb.data());
+
+            //Each row is prefixed with its filter type
+            std::vector<unsigned char> filtered((row_bytes+1)*band.num_rows);
+            for(int row=0; row<band.num_rows; ++row) {
+                const unsigned char * cur = rgb.data() + row*row_bytes;
+                //The previous band's rows are not available, so a band's first row is never
+                //filtered against the row above it
+                const unsigned char * prev = row > 0 ? cur - row_bytes : nullptr;
+
+                filter_row(cur, prev, row_bytes, filtered.data() + row*(row_bytes+1));
+            }
+
+            chunk_type chunk;
+            chunk.adler = adler32(0, Z_NULL, 0);
+            chunk.adler = adler32_z(chunk.adler, filtered.data(), filtered.size());
+            chunk.length = filtered.size();
+
+            bool last = band.first_row + band.num_rows >= height_;
+            deflate_band(filtered, last, chunk.data);
+
+            return chunk;
+        }
+
+        void write(chunk_type&& chunk) {
+            adler_ = adler32_combine(adler_, chunk.adler, chunk.length);
+
+            if(!chunk.data.empty()) {
+                write_chunk("IDAT", chunk.data.data(), chunk.data.size());
+            }
+        }
+
+        void end() {
+            unsigned char adler[4];
+            put_u32(adler, adler_);
+            write_chunk("IDAT", adler, sizeof(adler));
+
+            write_chunk("IEND", nullptr, 0);
+
+            os_.flush();
+            if(!os_) {
+                throw std::runtime_error("Could not write png image");
+            }
+        }
+
+        private:
+
+        static void put_u32(unsigned char * out, std::uint32_t value) {
+            out[0] = value >> 24;
+            out[1] = value >> 16;
+            out[2] = value >> 8;
+            out[3] = value;
+        }
+
+        void write_chunk(const char * type, const unsigned char * data, std::size_t length) {
+            RA_PROFILE_COUNT(bytes_written, length + 12);
+            unsigned char header[8];
+            put_u32(header, length);
+            std::copy(type, type+4, header+4);
+
+            uLong crc = crc32(0, header+4, 4);
+            if(length > 0) { //A null buffer would reset the crc
+                crc = crc32_z(crc, data, length);
+            }
+
+            unsigned char footer[4];
+            put_u32(footer, crc);
+
+            os_.write(reinterpret_cast<const char *>(header), sizeof(header));
+            os_.write(reinterpret_cast<const char *>(data), length);
+            os_.write(reinterpret_cast<const char *>(footer), sizeof(footer));
+        }
+
+        static unsigned char paeth(int a, int b, int c) {
+            int p = a + b - c;
+            int pa = std::abs(p-a), pb = std::abs(p-b), pc = std::abs(p-c);
+            if(pa <= pb && pa <= pc) return a;
+            if(pb <= pc) return b;
+            return c;
+        }
+
+        /**
+         * Filtered value of byte i of a row for PNG filter type 1-4
+         * (Sub, Up, Average, Paeth). prev is null for the first row of a band.
+         */
+        static unsigned char filter_byte(unsigned char type, const unsigned char * cur,
+            const unsigned char * prev, std::size_t i) {
+
+            constexpr std::size_t bpp = 3;
+
+            int left = i >= bpp ? cur[i-bpp] : 0;
+            int up = prev ? prev[i] : 0;
+            int up_left = (prev && i >= bpp) ? prev[i-bpp] : 0;
+
+            switch(type) {
+                case 1: return cur[i] - left;
+                case 2: return cur[i] - up;
+                case 3: return cur[i] - (left+up)/2;
+                default: return cur[i] - paeth(left, up, up_left);
+            }
+        }
+
+        /**
+         * Filter one row, choosing the filter with the smallest sum of absolute
+         * values as libpng does. Rows stored without compression are not filtered.
+         */
+        void filter_row(const unsigned char * cur, const unsigned char * prev,
+            std::size_t row_bytes, unsigned char * out) const {
+
+            if(level_ == 0) {
+                out[0] = 0;
+                std::copy(cur, cur+row_bytes, out+1);
+                return;
+            }
+
+            //Without a previous row only Sub is useful
+            const unsigned char last_type = prev ? 4 : 1;
+
+            unsigned long best_sum = ~0ul;
+            for(unsigned char type=1; type<=last_type; ++type) {
+                unsigned long sum = 0;
+                for(std::size_t i=0; i<row_bytes; ++i) {
+                    unsigned char value = filter_byte(type, cur, prev, i);
+                    sum += value < 128 ? value : 256-value;
+                }
+
+                if(sum < best_sum) {
+                    best_sum = sum;
+                    out[0] = type;
+                }
+            }
+
+            for(std::size_t i=0; i<row_bytes; ++i) {
+                out[i+1] = filter_byte(out[0], cur, prev, i);
+            }
+        }
+
+        /**
+         * Raw deflate of one band, ended with a sync flush, or with the final
+         * block if this is the last band of the image
+         */
+        void deflate_band(std::vector<unsigned char>& in, bool last, std::vector<unsigned char>& out) const {
+            z_stream stream{};
+            if(deflateInit2(&stream, level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                throw std::runtime_error("Could not initialize deflate");
+            }
+
+            out.resize(deflateBound(&stream, in.size()) + 16);
+
+            stream.next_in = in.data();
+            stream.avail_in = in.size();
+            stream.next_out = out.data();
+            stream.avail_out = out.size();
+
+            int status = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+            out.resize(out.size() - stream.avail_out);
+            deflateEnd(&stream);
+
+            if(status != (last ? Z_STREAM_END : Z_OK) || stream.avail_in != 0) {
+                throw std::runtime_error("Could not deflate png band");
+            }
+        }
+
+        std::ostream& os_;
+        int level_;
+        int height_;
+        uLong adler_;
+    };
+}
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * Binary PNM (P6) output for the band renderer:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_IO_PNM_HPP
+#define RA_IO_PNM_HPP
+
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+#include "ra/band_renderer.hpp"
+#include "ra/color.hpp"
+#include "ra/profile.hpp"
+
+namespace ra::io {
+
+    /**
+     * Class: pnm_sink
+     * 
+     * Description: Band sink writing a binary rgb PNM image to a stream.
+     * Colors are computed on the worker threads, the stream is only
+     * written from the rendering thread.
+     */
+    class pnm_sink {
+
+        public:
+
+        using chunk_type = std::vector<unsigned char>;
+
+        explicit pnm_sink(std::ostream& os): os_(os) {}
+
+        void begin(int width, int height, int) {
+            os_ << "P6\n" << width << ' ' << height << "\n255\n";
+        }
+
+        chunk_type encode(const ra::fractal_logic::band_view& band) const {
+            std::size_t num_pixels = static_cast<std::size_t>(band.num_rows)*band.width;
+
+            chunk_type rgb(3*num_pixels);
+            ra::fractal_logic::colorize(band, rgb.data());
+
+            return rgb;
+        }
+
+        void write(chunk_type&& rgb) {
+            RA_PROFILE_COUNT(bytes_written, rgb.size());
+            os_.write(reinterpret_cast<const char *>(rgb.data()), rgb.size());
+        }
+
+        void end() {
+            os_.flush();
+            if(!os_) {
+                throw std::runtime_error("Could not write pnm image");
+            }
+        }
+
+        private:
+
+        std::ostream& os_;
+    };
+}
+
+#endif
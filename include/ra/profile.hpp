@@ -0,0 +1,320 @@
+/**
+ * Scoped timers and counters on the hot paths, compiled in with
+ * RA_ENABLE_PROFILING (cmake -DENABLE_PROFILING=true):
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_PROFILE_HPP
+#define RA_PROFILE_HPP
+
+#include <string>
+
+#ifdef RA_ENABLE_PROFILING
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#define RA_PROFILE_CONCAT_(a, b) a##b
+#define RA_PROFILE_CONCAT(a, b) RA_PROFILE_CONCAT_(a, b)
+
+//Time the rest of the enclosing block under name, a string literal
+#define RA_PROFILE_SCOPE(name) ::ra::profile::scope RA_PROFILE_CONCAT(ra_profile_scope_, __LINE__)(name)
+//Add n to a counter; n is not evaluated when profiling is compiled out
+#define RA_PROFILE_COUNT(counter, n) ::ra::profile::count(::ra::profile::counter, (n))
+//Count iterations, pixels and how they ended for n iteration counts
+#define RA_PROFILE_ITERATIONS(its, n, max_its) ::ra::profile::count_iterations((its), (n), (max_its))
+//End a frame: summarize everything since the previous frame on stderr
+#define RA_PROFILE_FRAME(label) ::ra::profile::frame_mark(label)
+
+#else
+
+#define RA_PROFILE_SCOPE(name) ((void)0)
+#define RA_PROFILE_COUNT(counter, n) ((void)0)
+#define RA_PROFILE_ITERATIONS(its, n, max_its) ((void)0)
+#define RA_PROFILE_FRAME(label) ((void)0)
+
+#endif
+
+namespace ra::profile {
+
+#ifdef RA_ENABLE_PROFILING
+    inline constexpr bool enabled = true;
+#else
+    inline constexpr bool enabled = false;
+#endif
+
+    enum counter {
+        iterations,         //Orbit steps of rendered pixels
+        pixels,             //Pixels rendered
+        pixels_escaped,     //Pixels whose orbit escaped before max_its
+        pixels_bounded,     //Pixels which ran to max_its
+        bulb_skips,         //Buddhabrot samples skipped as inside the main cardioid or period 2 bulb
+        tasks,              //Thread pool tasks run
+        tile_cache_hits,
+        tile_cache_misses,
+        bytes_written,      //Image and video bytes written
+        bytes_sent,         //Bytes written to sockets
+        num_counters
+    };
+
+    inline const char * counter_name(int c) {
+        static const char * names[num_counters] = {"iterations", "pixels", "pixels_escaped", "pixels_bounded",
+            "bulb_skips", "tasks", "tile_cache_hits", "tile_cache_misses", "bytes_written", "bytes_sent"};
+        return names[c];
+    }
+
+#ifdef RA_ENABLE_PROFILING
+
+    using clock = std::chrono::steady_clock;
+
+    struct event {
+        const char * name;
+        std::int64_t start;     //Nanoseconds since the registry was created
+        std::int64_t duration;
+    };
+
+    /**
+     * Events and counters of one thread. Only that thread appends, readers
+     * take the mutex, which is otherwise uncontended.
+     */
+    struct thread_log {
+        explicit thread_log(int id): tid(id), summarized(0), dropped(0) {
+            for(auto& c: counters) c.store(0, std::memory_order_relaxed);
+        }
+
+        static constexpr std::size_t max_events = std::size_t(1) << 20;
+
+        const int tid;
+        std::mutex mutex;
+        std::vector<event> events;
+        std::size_t summarized;     //Events already in a frame summary
+        std::uint64_t dropped;
+        std::atomic<std::uint64_t> counters[num_counters];
+    };
+
+    /**
+     * Class: registry
+     *
+     * Description: Every thread's log, kept after the thread exits, and
+     * the frames marked so far, for the summaries and the trace
+     */
+    class registry {
+
+        public:
+
+        struct frame {
+            std::string label;
+            std::int64_t start, end;
+            std::uint64_t counters[num_counters];   //Over the frame
+        };
+
+        static registry& get() {
+            static registry r;
+            return r;
+        }
+
+        std::int64_t now() const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - epoch_).count();
+        }
+
+        std::shared_ptr<thread_log> add_thread() {
+            std::scoped_lock lock(mutex_);
+            logs_.push_back(std::make_shared<thread_log>(static_cast<int>(logs_.size()) + 1));
+            return logs_.back();
+        }
+
+        /**
+         * End the current frame, printing where its time went: wall time,
+         * the time summed over threads in each scope, and counter changes
+         */
+        void mark_frame(const std::string& label) {
+            std::scoped_lock lock(mutex_);
+            frame f{label, last_mark_, now(), {}};
+
+            std::map<std::string, std::pair<std::int64_t, std::uint64_t>> scopes;
+            std::uint64_t totals[num_counters] = {};
+            for(auto& log: logs_) {
+                std::scoped_lock log_lock(log->mutex);
+                for(; log->summarized < log->events.size(); ++log->summarized) {
+                    const event& e = log->events[log->summarized];
+                    auto& s = scopes[e.name];
+                    s.first += e.duration;
+                    ++s.second;
+                }
+                for(int c=0; c<num_counters; ++c) {
+                    totals[c] += log->counters[c].load(std::memory_order_relaxed);
+                }
+            }
+            for(int c=0; c<num_counters; ++c) {
+                f.counters[c] = totals[c] - marked_totals_[c];
+                marked_totals_[c] = totals[c];
+            }
+
+            std::ostringstream os;
+            os << std::fixed << std::setprecision(2) << "[profile] " << label << ": " << (f.end - f.start)*1e-6 << " ms";
+            for(auto& [name, s]: scopes) {
+                os << " | " << name << ' ' << s.first*1e-6 << " ms x" << s.second;
+            }
+            for(int c=0; c<num_counters; ++c) {
+                if(f.counters[c]) os << " | " << counter_name(c) << ' ' << f.counters[c];
+            }
+            std::cerr << os.str() << std::endl;
+
+            frames_.push_back(std::move(f));
+            last_mark_ = frames_.back().end;
+        }
+
+        /**
+         * Chrome trace event JSON (chrome://tracing, ui.perfetto.dev): scopes
+         * as complete events on their threads, frames on thread 0 and the
+         * counters of each frame at its end
+         */
+        void write_chrome_trace(std::ostream& os) {
+            std::scoped_lock lock(mutex_);
+            os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+            os << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"frames\"}}";
+
+            auto escaped = [](const std::string& s) {
+                std::string out;
+                for(char c: s) {
+                    if(c == '"' || c == '\\') out += '\\';
+                    out += (static_cast<unsigned char>(c) < 0x20) ? ' ' : c;
+                }
+                return out;
+            };
+
+            os << std::fixed << std::setprecision(3);
+            for(auto& f: frames_) {
+                os << ",\n{\"name\": \"" << escaped(f.label) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": "
+                    << f.start*1e-3 << ", \"dur\": " << (f.end - f.start)*1e-3 << "}";
+                os << ",\n{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << f.end*1e-3 << ", \"args\": {";
+                for(int c=0; c<num_counters; ++c) {
+                    os << (c ? ", " : "") << '"' << counter_name(c) << "\": " << f.counters[c];
+                }
+                os << "}}";
+            }
+
+            for(auto& log: logs_) {
+                std::scoped_lock log_lock(log->mutex);
+                os << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << log->tid
+                    << ", \"args\": {\"name\": \"thread " << log->tid << (log->dropped ? " (events dropped)" : "") << "\"}}";
+                for(auto& e: log->events) {
+                    os << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << log->tid
+                        << ", \"ts\": " << e.start*1e-3 << ", \"dur\": " << e.duration*1e-3 << "}";
+                }
+            }
+            os << "\n]}\n";
+        }
+
+        /**
+         * Write the trace to path when the program exits
+         */
+        void write_trace_at_exit(const std::string& path) {
+            {
+                std::scoped_lock lock(mutex_);
+                trace_path_ = path;
+            }
+            //The registry already exists, so it is destroyed after the handler runs
+            std::atexit([]() {
+                registry& r = get();
+                std::ofstream os(r.trace_path_);
+                r.write_chrome_trace(os);
+                if(!os) std::cerr << "Could not write trace " << r.trace_path_ << std::endl;
+            });
+        }
+
+        private:
+
+        registry(): epoch_(clock::now()), last_mark_(0), marked_totals_{} {}
+
+        const clock::time_point epoch_;
+
+        std::mutex mutex_;
+        std::vector<std::shared_ptr<thread_log>> logs_;
+        std::vector<frame> frames_;
+        std::int64_t last_mark_;
+        std::uint64_t marked_totals_[num_counters];
+        std::string trace_path_;
+    };
+
+    inline thread_log& local_log() {
+        thread_local std::shared_ptr<thread_log> log = registry::get().add_thread();
+        return *log;
+    }
+
+    inline void count(counter c, std::uint64_t n) {
+        local_log().counters[c].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    inline void count_iterations(const int * its, std::size_t n, int max_its) {
+        std::uint64_t sum = 0, bounded = 0;
+        for(std::size_t i=0; i<n; ++i) {
+            sum += its[i];
+            bounded += its[i] >= max_its;
+        }
+        thread_log& log = local_log();
+        log.counters[iterations].fetch_add(sum, std::memory_order_relaxed);
+        log.counters[pixels].fetch_add(n, std::memory_order_relaxed);
+        log.counters[pixels_escaped].fetch_add(n - bounded, std::memory_order_relaxed);
+        log.counters[pixels_bounded].fetch_add(bounded, std::memory_order_relaxed);
+    }
+
+    inline void frame_mark(const std::string& label) {
+        registry::get().mark_frame(label);
+    }
+
+    /**
+     * Class: scope
+     *
+     * Description: Records the time from construction to destruction as an
+     * event of the current thread
+     */
+    class scope {
+
+        public:
+
+        explicit scope(const char * name): name_(name), start_(registry::get().now()) {}
+
+        ~scope() {
+            const std::int64_t end = registry::get().now();
+            thread_log& log = local_log();
+            std::scoped_lock lock(log.mutex);
+            if(log.events.size() < thread_log::max_events) {
+                log.events.push_back({name_, start_, end - start_});
+            } else {
+                ++log.dropped;
+            }
+        }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+        private:
+
+        const char * name_;
+        std::int64_t start_;
+    };
+
+    inline void write_trace_at_exit(const std::string& path) {
+        registry::get().write_trace_at_exit(path);
+    }
+
+#else
+
+    inline void write_trace_at_exit(const std::string&) {}
+
+#endif
+}
+
+#endif
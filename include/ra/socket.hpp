@@ -0,0 +1,313 @@
+/**
+ * Stream sockets for the render services, Unix domain or TCP:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_IO_SOCKET_HPP
+#define RA_IO_SOCKET_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ra/profile.hpp"
+
+namespace ra::io {
+
+    /**
+     * Class: stream_socket
+     *
+     * Description: Owner of a stream socket, with buffered line and fixed
+     * length reads. One thread may read while others write. Addresses of
+     * the form host:port (host may be empty or * when listening) are TCP,
+     * anything else is the path of a Unix domain socket.
+     */
+    class stream_socket {
+
+        public:
+
+        //Longest line read_line accepts, far beyond any request of the services
+        static constexpr std::size_t max_line = 4096;
+
+        stream_socket(): fd_(-1) {}
+        explicit stream_socket(int fd): fd_(fd) {}
+
+        stream_socket(stream_socket&& other) noexcept: fd_(other.fd_), buffer_(std::move(other.buffer_)) {
+            other.fd_ = -1;
+        }
+
+        stream_socket& operator=(stream_socket&& other) noexcept {
+            if(this != &other) {
+                close();
+                fd_ = other.fd_;
+                buffer_ = std::move(other.buffer_);
+                other.fd_ = -1;
+            }
+            return *this;
+        }
+
+        ~stream_socket() {close();}
+
+        static bool is_tcp(const std::string& address) {
+            auto colon = address.rfind(':');
+            return colon != std::string::npos && address.find('/') == std::string::npos
+                && colon+1 < address.size()
+                && std::all_of(address.begin()+colon+1, address.end(), [](char c) {return c >= '0' && c <= '9';});
+        }
+
+        /**
+         * Listening socket on address, replacing a stale Unix socket file
+         */
+        static stream_socket listen(const std::string& address) {
+            stream_socket s;
+            if(is_tcp(address)) {
+                s = tcp_socket(address, true);
+                if(::listen(s.fd_, SOMAXCONN) < 0) {
+                    throw std::system_error(errno, std::generic_category(), "Could not listen on " + address);
+                }
+                return s;
+            }
+
+            s = stream_socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+            sockaddr_un unix_address = make_address(address);
+            ::unlink(address.c_str());
+            if(s.fd_ < 0 || ::bind(s.fd_, reinterpret_cast<sockaddr *>(&unix_address), sizeof(unix_address)) < 0
+                || ::listen(s.fd_, SOMAXCONN) < 0) {
+                throw std::system_error(errno, std::generic_category(), "Could not listen on " + address);
+            }
+            return s;
+        }
+
+        static stream_socket connect(const std::string& address) {
+            if(is_tcp(address)) {
+                return tcp_socket(address, false);
+            }
+
+            stream_socket s(::socket(AF_UNIX, SOCK_STREAM, 0));
+            sockaddr_un unix_address = make_address(address);
+            if(s.fd_ < 0 || ::connect(s.fd_, reinterpret_cast<sockaddr *>(&unix_address), sizeof(unix_address)) < 0) {
+                throw std::system_error(errno, std::generic_category(), "Could not connect to " + address);
+            }
+            return s;
+        }
+
+        /**
+         * Next connection. Connections aborted before they were accepted are
+         * skipped, and while the process is out of descriptors or buffers
+         * accept backs off and retries. Throws std::system_error on other
+         * errors, which include the listener being shut down.
+         */
+        stream_socket accept() const {
+            for(;;) {
+                int fd = ::accept(fd_, nullptr, nullptr);
+                if(fd >= 0) {
+                    stream_socket s(fd);
+                    s.set_no_delay();
+                    return s;
+                }
+
+                switch(errno) {
+                    case EINTR:
+                    case ECONNABORTED:
+                    case EPROTO:
+                        break;
+                    case EMFILE:
+                    case ENFILE:
+                    case ENOBUFS:
+                    case ENOMEM:
+                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                        break;
+                    default:
+                        throw std::system_error(errno, std::generic_category(), "Could not accept a connection");
+                }
+            }
+        }
+
+        bool valid() const {return fd_ >= 0;}
+
+        /**
+         * Wake up threads blocked reading or accepting on the socket
+         */
+        void shutdown() const {
+            if(fd_ >= 0) ::shutdown(fd_, SHUT_RDWR);
+        }
+
+        /**
+         * Reads fail, as at the end of the stream, after seconds without data
+         */
+        void set_receive_timeout(double seconds) const {
+            timeval timeout{static_cast<time_t>(seconds), static_cast<suseconds_t>((seconds - static_cast<time_t>(seconds))*1e6)};
+            ::setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        }
+
+        void write_all(const char * data, std::size_t length) const {
+            while(length > 0) {
+                ssize_t sent = ::send(fd_, data, length, MSG_NOSIGNAL);
+                if(sent < 0) {
+                    if(errno == EINTR) continue;
+                    throw std::system_error(errno, std::generic_category(), "Could not write to socket");
+                }
+                RA_PROFILE_COUNT(bytes_sent, sent);
+                data += sent;
+                length -= sent;
+            }
+        }
+
+        void write_all(const std::string& data) const {write_all(data.data(), data.size());}
+
+        /**
+         * Read up to the next newline, which is dropped. False at end of stream,
+         * and once more than max_line bytes arrive without a newline, so a
+         * peer cannot make the buffer grow without bound.
+         */
+        bool read_line(std::string& line) {
+            std::size_t searched = 0;
+            for(;;) {
+                auto newline = buffer_.find('\n', searched);
+                if(newline != std::string::npos && newline <= max_line) {
+                    line.assign(buffer_, 0, newline);
+                    buffer_.erase(0, newline+1);
+                    return true;
+                }
+                if(newline != std::string::npos || buffer_.size() > max_line) {
+                    buffer_.clear();
+                    return false;
+                }
+                searched = buffer_.size();
+                if(!fill()) return false;
+            }
+        }
+
+        /**
+         * Read exactly length bytes. False at end of stream.
+         */
+        bool read_exact(std::string& data, std::size_t length) {
+            while(buffer_.size() < length) {
+                if(!fill()) return false;
+            }
+            data.assign(buffer_, 0, length);
+            buffer_.erase(0, length);
+            return true;
+        }
+
+        private:
+
+        static sockaddr_un make_address(const std::string& path) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if(path.size() >= sizeof(address.sun_path)) {
+                throw std::invalid_argument("Socket path too long: " + path);
+            }
+            std::copy(path.begin(), path.end(), address.sun_path);
+            return address;
+        }
+
+        static stream_socket tcp_socket(const std::string& address, bool passive) {
+            auto colon = address.rfind(':');
+            std::string host = address.substr(0, colon), port = address.substr(colon+1);
+            if(host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+                host = host.substr(1, host.size()-2);
+            }
+            if(host == "*") host.clear();
+
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+            addrinfo * found = nullptr;
+            if(int error = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found); error != 0) {
+                throw std::runtime_error("Could not resolve " + address + ": " + ::gai_strerror(error));
+            }
+
+            int last_error = 0;
+            for(addrinfo * a=found; a; a=a->ai_next) {
+                stream_socket s(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+                if(!s.valid()) {
+                    last_error = errno;
+                    continue;
+                }
+                if(passive) {
+                    int on = 1;
+                    ::setsockopt(s.fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                }
+                if((passive ? ::bind(s.fd_, a->ai_addr, a->ai_addrlen) : ::connect(s.fd_, a->ai_addr, a->ai_addrlen)) == 0) {
+                    ::freeaddrinfo(found);
+                    s.set_no_delay();
+                    return s;
+                }
+                last_error = errno;
+            }
+            ::freeaddrinfo(found);
+            throw std::system_error(last_error, std::generic_category(),
+                std::string(passive ? "Could not listen on " : "Could not connect to ") + address);
+        }
+
+        //Requests and replies are small messages, sent as soon as they are written.
+        //Unix sockets refuse the option, which does not matter to them.
+        void set_no_delay() const {
+            int on = 1;
+            ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+
+        bool fill() {
+            char chunk[65536];
+            for(;;) {
+                ssize_t received = ::recv(fd_, chunk, sizeof(chunk), 0);
+                if(received > 0) {
+                    buffer_.append(chunk, received);
+                    return true;
+                }
+                if(received < 0 && errno == EINTR) continue;
+                return false;
+            }
+        }
+
+        void close() {
+            if(fd_ >= 0) ::close(fd_);
+            fd_ = -1;
+        }
+
+        int fd_;
+        std::string buffer_;
+    };
+
+    /**
+     * Accept connections on listener and pass each to connected, until
+     * stopping() is true once accept returns or fails. Other failures are
+     * logged and retried after a pause, so a long lived service outlasts
+     * them; stop by setting what stopping() reads, then shutting the
+     * listener down.
+     */
+    template<class STOPPING, class CONNECTED>
+    void accept_connections(const stream_socket& listener, STOPPING stopping, CONNECTED connected) {
+        for(;;) {
+            stream_socket socket;
+            try {
+                socket = listener.accept();
+            } catch(std::system_error& e) {
+                if(stopping()) return;
+                std::cerr << e.what() << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            if(stopping()) return;
+            connected(std::move(socket));
+        }
+    }
+}
+
+#endif
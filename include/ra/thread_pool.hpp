@@ -0,0 +1,129 @@
+/**
+ * Fixed size pool of worker threads shared by the CPU renderers:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_CONCURRENCY_THREAD_POOL_HPP
+#define RA_CONCURRENCY_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ra/profile.hpp"
+
+namespace ra::concurrency {
+
+    /**
+     * Class: thread_pool
+     *
+     * Description: Starts a fixed number of worker threads which run tasks
+     * in the order they were submitted. Destroying the pool finishes all
+     * queued tasks before joining the workers.
+     */
+    class thread_pool {
+
+        public:
+
+        using size_type = std::size_t;
+
+        /**
+         * Creates a pool with num_threads workers, 0 uses one worker per
+         * hardware thread.
+         */
+        explicit thread_pool(size_type num_threads = 0): stopping_(false) {
+            if(num_threads == 0) {
+                num_threads = std::max<size_type>(1, std::thread::hardware_concurrency());
+            }
+
+            workers_.reserve(num_threads);
+            for(size_type i=0; i<num_threads; ++i) {
+                workers_.emplace_back([this](){worker_loop();});
+            }
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        ~thread_pool() {
+            {
+                std::scoped_lock lock(mutex_);
+                stopping_ = true;
+            }
+            cv_.notify_all();
+
+            for(auto& worker: workers_) {
+                worker.join();
+            }
+        }
+
+        /**
+         * Queue a task without a result
+         */
+        void schedule(std::function<void()> task) {
+            {
+                std::scoped_lock lock(mutex_);
+                tasks_.push(std::move(task));
+            }
+            cv_.notify_one();
+        }
+
+        /**
+         * Queue a task and return a future for its result. Exceptions thrown
+         * by the task are rethrown by future::get.
+         */
+        template<class FUNC>
+        auto submit(FUNC&& func) -> std::future<std::invoke_result_t<FUNC>> {
+            using result_t = std::invoke_result_t<FUNC>;
+
+            auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<FUNC>(func));
+            auto result = task->get_future();
+
+            schedule([task](){(*task)();});
+
+            return result;
+        }
+
+        //Number of worker threads
+        size_type size() const {return workers_.size();}
+
+        private:
+
+        void worker_loop() {
+            for(;;) {
+                std::function<void()> task;
+                {
+                    std::unique_lock lock(mutex_);
+                    cv_.wait(lock, [this](){return stopping_ || !tasks_.empty();});
+
+                    if(tasks_.empty()) {
+                        return; //Stopping and nothing left to run
+                    }
+
+                    task = std::move(tasks_.front());
+                    tasks_.pop();
+                }
+                RA_PROFILE_SCOPE("task");
+                RA_PROFILE_COUNT(tasks, 1);
+                task();
+            }
+        }
+
+        std::vector<std::thread> workers_;
+        std::queue<std::function<void()>> tasks_;
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+
+        bool stopping_;
+    };
+}
+
+#endif
@@ -0,0 +1,592 @@
+/**
+ * Long lived tile render service over a socket:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_IO_TILE_SERVER_HPP
+#define RA_IO_TILE_SERVER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ra/henon.hpp"
+#include "ra/png.hpp"
+#include "ra/profile.hpp"
+#include "ra/socket.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::io {
+
+    enum class tile_priority {interactive, batch};
+
+    /**
+     * A tile of a tile_server's view: at zoom z the view is split into
+     * 2^z by 2^z tiles, x counting from the left and y from the top.
+     *
+     * On the wire a request is one line:
+     *   tile <id> <interactive|batch> <zoom> <x> <y> <max_its> <a> <b> <threshold> <fractal>
+     * the fractal taking the rest of the line, so expr: formulas may hold spaces.
+     */
+    struct tile_request {
+        std::uint64_t id = 0;
+        tile_priority priority = tile_priority::interactive;
+        int zoom = 0;
+        std::int64_t x = 0, y = 0;
+        int max_its = 512;
+        double a = 0.2, b = 0.9991, threshold = 512.0;
+        std::string fractal = "henon";
+
+        static constexpr int max_zoom = 48;
+
+        /**
+         * Identifies the tile's pixels, whatever the id and priority
+         */
+        std::string key() const {
+            std::ostringstream os;
+            os << std::setprecision(std::numeric_limits<double>::max_digits10)
+                << zoom << ' ' << x << ' ' << y << ' ' << max_its << ' '
+                << a << ' ' << b << ' ' << threshold << ' ' << fractal;
+            return os.str();
+        }
+
+        std::string to_line() const {
+            return "tile " + std::to_string(id) + (priority == tile_priority::interactive ? " interactive " : " batch ")
+                + key() + "\n";
+        }
+
+        /**
+         * Parse a request line, throwing std::invalid_argument if malformed
+         */
+        static tile_request parse(const std::string& line) {
+            std::istringstream is(line);
+            std::string command, priority;
+            tile_request r;
+            is >> command >> r.id >> priority >> r.zoom >> r.x >> r.y >> r.max_its >> r.a >> r.b >> r.threshold;
+            std::getline(is >> std::ws, r.fractal);
+
+            if(!is || command != "tile" || (priority != "interactive" && priority != "batch")) {
+                throw std::invalid_argument("Malformed tile request");
+            }
+            r.priority = priority == "batch" ? tile_priority::batch : tile_priority::interactive;
+
+            if(r.zoom < 0 || r.zoom > max_zoom || r.x < 0 || r.y < 0
+                || r.x >= (std::int64_t(1) << r.zoom) || r.y >= (std::int64_t(1) << r.zoom)) {
+                throw std::invalid_argument("Tile outside the view");
+            }
+            if(r.max_its <= 0 || !(r.threshold > 0.0)) {
+                throw std::invalid_argument("Max iterations and threshold must be positive");
+            }
+            return r;
+        }
+    };
+
+    /**
+     * Class: tile_cache
+     *
+     * Description: Encoded tiles by key, evicting the least recently used
+     * beyond capacity tiles. Not thread safe.
+     */
+    class tile_cache {
+
+        public:
+
+        using tile_ptr = std::shared_ptr<const std::string>;
+
+        explicit tile_cache(std::size_t capacity): capacity_(capacity) {}
+
+        tile_ptr find(const std::string& key) {
+            auto found = index_.find(key);
+            if(found == index_.end()) {
+                return nullptr;
+            }
+            entries_.splice(entries_.begin(), entries_, found->second);
+            return found->second->second;
+        }
+
+        void insert(const std::string& key, tile_ptr tile) {
+            if(capacity_ == 0) return;
+
+            auto found = index_.find(key);
+            if(found != index_.end()) {
+                found->second->second = std::move(tile);
+                entries_.splice(entries_.begin(), entries_, found->second);
+                return;
+            }
+
+            entries_.emplace_front(key, std::move(tile));
+            index_[key] = entries_.begin();
+            if(entries_.size() > capacity_) {
+                index_.erase(entries_.back().first);
+                entries_.pop_back();
+            }
+        }
+
+        std::size_t size() const {return entries_.size();}
+
+        private:
+
+        std::size_t capacity_;
+        std::list<std::pair<std::string, tile_ptr>> entries_;
+        std::unordered_map<std::string, std::list<std::pair<std::string, tile_ptr>>::iterator> index_;
+    };
+
+    struct tile_server_stats {
+        std::uint64_t requests;     //Tile requests received
+        std::uint64_t cache_hits;   //Answered from the cache
+        std::uint64_t coalesced;    //Joined an identical request already queued or rendering
+        std::uint64_t rendered;     //Tiles rendered
+        std::uint64_t errors;       //Malformed requests
+    };
+
+    /**
+     * Class: tile_server
+     *
+     * Description: Renders tiles of the view of a henon_map, each tile_size
+     * (the map's x pixels) square and encoded as PNG, for clients connected
+     * to a stream_socket. Each connection may have any number of
+     * requests outstanding; answers are streamed back as tiles complete,
+     * each as a line "<id> ok <bytes>" (or "<id> error <bytes>") followed by
+     * that many bytes. The line "stats" is answered the same way with id 0
+     * and the counters as text.
+     *
+     * Requests for a tile in the cache are answered at once. A request for
+     * a tile already queued or rendering waits for that render instead of
+     * starting another. Otherwise the tile is queued and a task scheduled
+     * on the pool; each task renders the oldest interactive tile, or the
+     * oldest batch tile if none is waiting, so interactive requests overtake
+     * queued batch work. A batch tile joined by an interactive request is
+     * promoted.
+     *
+     * Answers are queued on their connection and sent by its own writer
+     * thread, so a client which stops reading never holds up the pool. A
+     * connection whose unsent answers exceed max_queued_bytes is dropped.
+     */
+    template<class FLOAT_T>
+    class tile_server {
+
+        public:
+
+        static constexpr std::size_t max_queued_bytes = 64 << 20;
+
+        tile_server(const ra::fractal_logic::henon_map<FLOAT_T>& view, ra::concurrency::thread_pool& pool,
+            std::size_t cache_tiles = 4096):
+            min_(view.get_bottom_left()), max_(view.get_top_right()),
+            tile_size_(std::max(1, view.get_x_pixels())), compression_level_(view.get_compression_level()),
+            pool_(pool), cache_(cache_tiles), stats_{0, 0, 0, 0, 0}, pending_(0), connection_threads_(0), stopping_(false) {}
+
+        ~tile_server() {
+            stop();
+            std::unique_lock lock(mutex_);
+            for(auto& weak: connections_) {
+                if(auto c = weak.lock()) c->socket.shutdown();
+            }
+            idle_.wait(lock, [this]() {return pending_ == 0 && connection_threads_ == 0;});
+        }
+
+        int tile_size() const {return tile_size_;}
+
+        void listen(const std::string& path) {
+            listener_ = stream_socket::listen(path);
+        }
+
+        /**
+         * Accept connections until stop, then wait for their threads and any
+         * tiles still rendering
+         */
+        void run() {
+            accept_connections(listener_, [this]() {return stopping_.load();}, [this](stream_socket&& socket) {
+                auto c = std::make_shared<connection>(std::move(socket));
+                {
+                    std::scoped_lock lock(mutex_);
+                    connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+                        [](const auto& weak) {return weak.expired();}), connections_.end());
+                    connections_.push_back(c);
+                    connection_threads_ += 2;
+                }
+
+                //Threads are detached and counted, so finished connections leave nothing behind
+                auto finished = [this]() {
+                    std::scoped_lock lock(mutex_);
+                    --connection_threads_;
+                    idle_.notify_all();
+                };
+                std::thread([this, c, finished]() {
+                    read_requests(c);
+                    {
+                        std::scoped_lock lock(c->mutex);
+                        c->reading = false;
+                    }
+                    c->ready.notify_all();
+                    finished();
+                }).detach();
+                std::thread([c, finished]() {
+                    write_responses(*c);
+                    finished();
+                }).detach();
+            });
+
+            std::unique_lock lock(mutex_);
+            for(auto& weak: connections_) {
+                if(auto c = weak.lock()) c->socket.shutdown();
+            }
+            idle_.wait(lock, [this]() {return pending_ == 0 && connection_threads_ == 0;});
+        }
+
+        /**
+         * Make run return, may be called from any thread
+         */
+        void stop() {
+            stopping_ = true;
+            listener_.shutdown();
+        }
+
+        tile_server_stats stats() const {
+            std::scoped_lock lock(mutex_);
+            return stats_;
+        }
+
+        /**
+         * Encoded pixels of a tile
+         */
+        std::string render(const tile_request& r) const {
+            namespace fl = ra::fractal_logic;
+
+            //Pixel centers tile_size apart across a tile, so neighbouring tiles do not overlap
+            const int n = tile_size_;
+            const FLOAT_T tiles = std::ldexp(FLOAT_T(1), r.zoom);
+            const FLOAT_T tile_w = (max_.x - min_.x)/tiles, tile_h = (max_.y - min_.y)/tiles;
+            const FLOAT_T left = min_.x + tile_w*r.x, top = max_.y - tile_h*r.y;
+
+            fl::henon_map<FLOAT_T> map(r.a, r.b, left, left + tile_w*(n-1)/n, top - tile_h*(n-1)/n, top,
+                512, r.max_its, n, n);
+            map.set_threshold(r.threshold);
+            if(!map.set_fractal_type(r.fractal)) {
+                throw std::invalid_argument("Unknown fractal type " + r.fractal);
+            }
+
+            std::vector<int> its(static_cast<std::size_t>(n)*n);
+            map.render_rows(0, n, its.data());
+
+            std::ostringstream os;
+            png_sink sink(os, compression_level_);
+            sink.begin(n, n, r.max_its);
+            sink.write(sink.encode(fl::band_view{0, n, n, r.max_its, its.data()}));
+            sink.end();
+            return os.str();
+        }
+
+        private:
+
+        struct response {
+            std::string header;
+            tile_cache::tile_ptr payload;
+        };
+
+        struct connection {
+            explicit connection(stream_socket&& s): socket(std::move(s)) {}
+            stream_socket socket;
+
+            std::mutex mutex;
+            std::condition_variable ready;
+            std::deque<response> responses;     //Answers not yet sent
+            std::size_t queued_bytes = 0;
+            int outstanding = 0;                //Requests read but not yet answered
+            bool reading = true;
+            bool dropped = false;
+        };
+
+        struct waiter {
+            std::shared_ptr<connection> client;
+            std::uint64_t id;
+        };
+
+        struct job {
+            tile_request request;
+            std::string key;
+            tile_priority priority;
+            bool taken = false;
+            std::vector<waiter> waiters;
+        };
+
+        /**
+         * Queue the answer to a request for the connection's writer
+         */
+        static void respond(connection& c, std::uint64_t id, bool ok, tile_cache::tile_ptr payload) {
+            std::string header = std::to_string(id) + (ok ? " ok " : " error ") + std::to_string(payload->size()) + "\n";
+            {
+                std::scoped_lock lock(c.mutex);
+                --c.outstanding;
+                if(c.dropped) return;
+
+                c.queued_bytes += header.size() + payload->size();
+                c.responses.push_back({std::move(header), std::move(payload)});
+                if(c.queued_bytes > max_queued_bytes) {
+                    drop(c);
+                }
+            }
+            c.ready.notify_all();
+        }
+
+        static void respond(connection& c, std::uint64_t id, bool ok, const std::string& payload) {
+            respond(c, id, ok, std::make_shared<const std::string>(payload));
+        }
+
+        //Called with c.mutex held. Shutting the socket down wakes its reader and writer.
+        static void drop(connection& c) {
+            c.dropped = true;
+            c.responses.clear();
+            c.queued_bytes = 0;
+            c.socket.shutdown();
+        }
+
+        /**
+         * Send a connection's answers in order until it is dropped, or its
+         * reader has finished and every request has been answered
+         */
+        static void write_responses(connection& c) {
+            std::unique_lock lock(c.mutex);
+            for(;;) {
+                c.ready.wait(lock, [&c]() {
+                    return c.dropped || !c.responses.empty() || (!c.reading && c.outstanding == 0);
+                });
+                if(c.dropped || c.responses.empty()) {
+                    return;
+                }
+
+                response r = std::move(c.responses.front());
+                c.responses.pop_front();
+                lock.unlock();
+                try {
+                    c.socket.write_all(r.header);
+                    c.socket.write_all(*r.payload);
+                } catch(std::system_error&) {
+                    //The client went away
+                    lock.lock();
+                    drop(c);
+                    return;
+                }
+                lock.lock();
+                c.queued_bytes -= std::min(c.queued_bytes, r.header.size() + r.payload->size());
+            }
+        }
+
+        void read_requests(std::shared_ptr<connection> c) {
+            std::string line;
+            while(c->socket.read_line(line)) {
+                {
+                    std::scoped_lock lock(c->mutex);
+                    ++c->outstanding;
+                }
+
+                if(line == "stats") {
+                    auto s = stats();
+                    std::ostringstream os;
+                    os << "requests " << s.requests << " cache_hits " << s.cache_hits << " coalesced " << s.coalesced
+                        << " rendered " << s.rendered << " errors " << s.errors;
+                    respond(*c, 0, true, os.str());
+                    continue;
+                }
+
+                tile_request r;
+                try {
+                    r = tile_request::parse(line);
+                    //Unknown fractals are refused here rather than by a render task
+                    ra::fractal_logic::henon_map<FLOAT_T> check;
+                    if(r.fractal.compare(0, 5, "expr:") == 0) {
+                        ra::fractal_logic::expression_formula formula(r.fractal.substr(5));
+                    } else if(!check.set_fractal_type(r.fractal)) {
+                        throw std::invalid_argument("Unknown fractal type " + r.fractal);
+                    }
+                } catch(std::invalid_argument& e) {
+                    {
+                        std::scoped_lock lock(mutex_);
+                        ++stats_.errors;
+                    }
+                    std::istringstream is(line);
+                    std::string command;
+                    std::uint64_t id = 0;
+                    is >> command >> id;
+                    respond(*c, id, false, e.what());
+                    continue;
+                }
+
+                submit(r, c);
+            }
+        }
+
+        void submit(const tile_request& r, const std::shared_ptr<connection>& c) {
+            std::string key = r.key();
+            std::unique_lock lock(mutex_);
+            ++stats_.requests;
+
+            if(auto tile = cache_.find(key)) {
+                RA_PROFILE_COUNT(tile_cache_hits, 1);
+                ++stats_.cache_hits;
+                lock.unlock();
+                respond(*c, r.id, true, std::move(tile));
+                return;
+            }
+
+            RA_PROFILE_COUNT(tile_cache_misses, 1);
+            auto found = in_flight_.find(key);
+            if(found != in_flight_.end()) {
+                ++stats_.coalesced;
+                auto& j = found->second;
+                j->waiters.push_back({c, r.id});
+                if(r.priority == tile_priority::interactive && j->priority == tile_priority::batch && !j->taken) {
+                    //The batch queue entry is skipped once the job is taken
+                    j->priority = tile_priority::interactive;
+                    queues_[0].push_back(j);
+                }
+                return;
+            }
+
+            auto j = std::make_shared<job>();
+            j->request = r;
+            j->key = key;
+            j->priority = r.priority;
+            j->waiters.push_back({c, r.id});
+            in_flight_[key] = j;
+            queues_[r.priority == tile_priority::interactive ? 0 : 1].push_back(j);
+            ++pending_;
+            lock.unlock();
+
+            pool_.schedule([this]() {render_next();});
+        }
+
+        /**
+         * Render the most urgent queued tile and answer everyone waiting for it
+         */
+        void render_next() {
+            std::shared_ptr<job> j;
+            {
+                std::scoped_lock lock(mutex_);
+                for(auto& queue: queues_) {
+                    while(!queue.empty() && !j) {
+                        if(!queue.front()->taken) j = queue.front();
+                        queue.pop_front();
+                    }
+                    if(j) break;
+                }
+                j->taken = true;
+            }
+
+            bool ok = true;
+            tile_cache::tile_ptr payload;
+            try {
+                RA_PROFILE_SCOPE("tile");
+                payload = std::make_shared<const std::string>(render(j->request));
+            } catch(std::exception& e) {
+                ok = false;
+                payload = std::make_shared<const std::string>(e.what());
+            }
+
+            std::vector<waiter> waiters;
+            {
+                std::scoped_lock lock(mutex_);
+                if(ok) {
+                    cache_.insert(j->key, payload);
+                    ++stats_.rendered;
+                }
+                in_flight_.erase(j->key);
+                waiters = std::move(j->waiters);
+            }
+
+            for(auto& w: waiters) {
+                respond(*w.client, w.id, ok, payload);
+            }
+
+            //Notified under the lock, the destructor may run as soon as it is released
+            std::scoped_lock lock(mutex_);
+            --pending_;
+            idle_.notify_all();
+        }
+
+        ra::fractal_logic::point<FLOAT_T> min_, max_;
+        int tile_size_;
+        int compression_level_;
+
+        ra::concurrency::thread_pool& pool_;
+        stream_socket listener_;
+
+        mutable std::mutex mutex_;
+        tile_cache cache_;
+        std::unordered_map<std::string, std::shared_ptr<job>> in_flight_;
+        std::deque<std::shared_ptr<job>> queues_[2];   //Interactive, then batch
+        std::vector<std::weak_ptr<connection>> connections_;
+        tile_server_stats stats_;
+        int pending_;   //Jobs queued or rendering
+        int connection_threads_;    //Readers and writers of connections
+        std::condition_variable idle_;
+
+        std::atomic<bool> stopping_;
+    };
+
+    /**
+     * Class: tile_client
+     *
+     * Description: Synchronous client of a tile_server, one request at a time
+     */
+    class tile_client {
+
+        public:
+
+        explicit tile_client(const std::string& path): socket_(stream_socket::connect(path)) {}
+
+        /**
+         * Encoded tile, throwing std::runtime_error if the server refused it
+         */
+        std::string request(const tile_request& r) {
+            socket_.write_all(r.to_line());
+            return read_response(r.id);
+        }
+
+        std::string stats() {
+            socket_.write_all("stats\n");
+            return read_response(0);
+        }
+
+        private:
+
+        std::string read_response(std::uint64_t id) {
+            std::string line, payload;
+            if(!socket_.read_line(line)) {
+                throw std::runtime_error("Tile server closed the connection");
+            }
+
+            std::istringstream is(line);
+            std::uint64_t response_id;
+            std::string status;
+            std::size_t length;
+            if(!(is >> response_id >> status >> length) || !socket_.read_exact(payload, length)) {
+                throw std::runtime_error("Malformed tile server response");
+            }
+            if(status != "ok") {
+                throw std::runtime_error(payload);
+            }
+            if(response_id != id) {
+                throw std::runtime_error("Tile server answered another request");
+            }
+            return payload;
+        }
+
+        stream_socket socket_;
+    };
+}
+
+#endif
@@ -0,0 +1,242 @@
+/**
+ * Calibration of the renderer's settings for a host, and the profile keeping them:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_TUNER_HPP
+#define RA_FRACTAL_LOGIC_TUNER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ra/band_renderer.hpp"
+#include "ra/henon.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    /**
+     * Renderer settings: -j, -B and -V
+     */
+    struct tuned_settings {
+        int threads;
+        int band_height;
+        int lanes;
+        double seconds;     //Fastest render of the tuning view with these settings
+    };
+
+    /**
+     * Class: host_profile
+     *
+     * Description: The tuned settings of one host for each family of
+     * fractals, which differ in how uneven their cost is: "henon" for the
+     * Henon map and user formulas, "mandelbrot" for the escape time fractals
+     * of the complex plane. Kept as text:
+     *   hardware_threads <n>
+     *   <family> threads <n> band_height <rows> lanes <lanes> seconds <s>
+     * A profile is only valid on a machine with the same number of threads.
+     */
+    class host_profile {
+
+        public:
+
+        host_profile(): hardware_threads_(std::thread::hardware_concurrency()) {}
+
+        static std::string host_name() {
+            char name[256] = {};
+            if(::gethostname(name, sizeof(name)-1) != 0 || name[0] == '\0') {
+                return "localhost";
+            }
+            return name;
+        }
+
+        /**
+         * $FRACTAL_PROFILE, else ~/.fractal_profile_<host>, empty without a home
+         */
+        static std::string default_path() {
+            if(const char * path = std::getenv("FRACTAL_PROFILE"); path && *path) {
+                return path;
+            }
+            if(const char * home = std::getenv("HOME"); home && *home) {
+                return std::string(home) + "/.fractal_profile_" + host_name();
+            }
+            return "";
+        }
+
+        static const char * family(const std::string& fractal_name) {
+            return (fractal_name == "henon" || fractal_name == "expr") ? "henon" : "mandelbrot";
+        }
+
+        unsigned hardware_threads() const {return hardware_threads_;}
+
+        //Whether the profile was tuned on a machine like this one
+        bool matches_host() const {return hardware_threads_ == std::thread::hardware_concurrency();}
+
+        void set(const std::string& family, const tuned_settings& settings) {settings_[family] = settings;}
+
+        /**
+         * Settings for the family of fractal_name, null if it was not tuned
+         */
+        const tuned_settings * find(const std::string& fractal_name) const {
+            auto found = settings_.find(family(fractal_name));
+            return found == settings_.end() ? nullptr : &found->second;
+        }
+
+        /**
+         * Replace the profile with one read from is. Throws std::invalid_argument
+         * on malformed lines.
+         */
+        void read(std::istream& is) {
+            settings_.clear();
+            hardware_threads_ = 0;
+
+            std::string line;
+            while(std::getline(is, line)) {
+                if(line.empty() || line[0] == '#') {
+                    continue;
+                }
+
+                std::istringstream fields(line);
+                std::string name, threads, band_height, lanes, seconds, rest;
+                if(line.compare(0, 17, "hardware_threads ") == 0) {
+                    fields >> name >> hardware_threads_;
+                } else {
+                    tuned_settings s;
+                    fields >> name >> threads >> s.threads >> band_height >> s.band_height
+                        >> lanes >> s.lanes >> seconds >> s.seconds;
+                    if(fields && threads == "threads" && band_height == "band_height" && lanes == "lanes"
+                        && seconds == "seconds" && s.threads >= 0 && s.band_height > 0 && find_kernel_variant(s.lanes) >= 0) {
+                        settings_[name] = s;
+                    } else {
+                        fields.setstate(std::ios::failbit);
+                    }
+                }
+                if(!fields || (fields >> rest)) {
+                    throw std::invalid_argument("Could not process profile line: " + line);
+                }
+            }
+        }
+
+        void write(std::ostream& os) const {
+            os << "# Renderer settings tuned for " << host_name() << " by -M tune\n"
+                << "hardware_threads " << hardware_threads_ << '\n';
+            for(const auto& [name, s]: settings_) {
+                os << name << " threads " << s.threads << " band_height " << s.band_height
+                    << " lanes " << s.lanes << " seconds " << s.seconds << '\n';
+            }
+        }
+
+        private:
+
+        unsigned hardware_threads_;
+        std::map<std::string, tuned_settings> settings_;
+    };
+
+    /**
+     * The view each family is tuned on: the default Henon view, and seahorse
+     * valley, whose rows differ widely in cost
+     */
+    template<class FLOAT_T>
+    std::vector<std::pair<std::string, henon_map<FLOAT_T>>> tuning_views() {
+        henon_map<FLOAT_T> henon;
+        henon_map<FLOAT_T> mandelbrot(0.0, 0.0, -0.7480, -0.7440, 0.0980, 0.1010, 2, 1024, 640, 480);
+        mandelbrot.set_fractal_type("mandelbrot");
+        return {{"henon", henon}, {"mandelbrot", mandelbrot}};
+    }
+
+    /**
+     * Class: auto_tuner
+     *
+     * Description: Finds the fastest settings for rendering a view by
+     * coordinate descent: the kernel's lanes on all threads, then the
+     * number of threads, then the rows per band, each measured as the
+     * fastest of repeats renders with the best settings so far.
+     */
+    template<class FLOAT_T>
+    class auto_tuner {
+
+        public:
+
+        /**
+         * max_threads of 0 tries up to all hardware threads
+         */
+        explicit auto_tuner(int repeats = 3, unsigned max_threads = 0):
+            repeats_(std::max(1, repeats)),
+            max_threads_(max_threads > 0 ? max_threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+        /**
+         * Tune for view, describing each measurement on log
+         */
+        tuned_settings tune(const henon_map<FLOAT_T>& view, std::ostream& log) const {
+            tuned_settings best{static_cast<int>(max_threads_), 16, formula_lanes, 0.0};
+            best.seconds = time(view, best);
+
+            auto sweep = [&](const char * knob, int tuned_settings::* field, const std::vector<int>& values) {
+                for(int value: values) {
+                    tuned_settings candidate = best;
+                    candidate.*field = value;
+                    candidate.seconds = time(view, candidate);
+                    log << "  " << knob << ' ' << value << ": " << candidate.seconds*1e3 << " ms" << std::endl;
+                    if(candidate.seconds < best.seconds) {
+                        best = candidate;
+                    }
+                }
+            };
+
+            sweep("lanes", &tuned_settings::lanes, std::vector<int>(kernel_lanes.begin(), kernel_lanes.end()));
+
+            std::vector<int> threads;
+            for(unsigned n=1; n<max_threads_; n*=2) threads.push_back(n);
+            threads.push_back(max_threads_);
+            sweep("threads", &tuned_settings::threads, threads);
+
+            sweep("band_height", &tuned_settings::band_height, {4, 8, 16, 32, 64});
+
+            return best;
+        }
+
+        private:
+
+        //Band sink which only waits for the bands
+        struct discard_sink {
+            using chunk_type = bool;
+
+            void begin(int, int, int) {}
+            chunk_type encode(const band_view&) const {return true;}
+            void write(chunk_type&&) {}
+            void end() {}
+        };
+
+        double time(const henon_map<FLOAT_T>& view, const tuned_settings& settings) const {
+            henon_map<FLOAT_T> map(view);
+            map.set_kernel_lanes(settings.lanes);
+            ra::concurrency::thread_pool pool(settings.threads);
+
+            double fastest = 0.0;
+            for(int r=0; r<repeats_; ++r) {
+                auto start = std::chrono::steady_clock::now();
+                discard_sink sink;
+                band_renderer<FLOAT_T>(map, pool, settings.band_height).render(sink);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                fastest = (r == 0) ? seconds : std::min(fastest, seconds);
+            }
+            return fastest;
+        }
+
+        int repeats_;
+        unsigned max_threads_;
+    };
+}
+
+#endif
@@ -0,0 +1,463 @@
+/**
+ * GUI input events: the view changes they make, recording and headless replay:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_FRACTAL_LOGIC_VIEW_EVENTS_HPP
+#define RA_FRACTAL_LOGIC_VIEW_EVENTS_HPP
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ra/band_renderer.hpp"
+#include "ra/color.hpp"
+#include "ra/henon.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::fractal_logic {
+
+    //GLUT's values for mouse buttons and their states, which events record
+    enum mouse_button {left_button = 0, middle_button = 1, right_button = 2, scroll_up = 3, scroll_down = 4};
+    enum button_state {button_down = 0, button_up = 1};
+
+    /**
+     * One call of a GUI callback, time in seconds from the start of recording.
+     * mouse: code is the button, state its state, x, y the window position
+     * keyboard: code is the key, x, y the mouse position
+     * reshape: x, y are the new window size
+     */
+    struct input_event {
+        enum kind_t {mouse, keyboard, reshape};
+
+        double time;
+        kind_t kind;
+        int code, state;
+        int x, y;
+    };
+
+    /**
+     * Write an event as one line: "<time> mouse <button> <state> <x> <y>",
+     * "<time> key <key> <x> <y>" or "<time> reshape <width> <height>"
+     */
+    inline void write_event(std::ostream& os, const input_event& e) {
+        os << std::fixed << std::setprecision(6) << e.time;
+        if(e.kind == input_event::mouse) {
+            os << " mouse " << e.code << ' ' << e.state << ' ' << e.x << ' ' << e.y << '\n';
+        } else if(e.kind == input_event::keyboard) {
+            os << " key " << e.code << ' ' << e.x << ' ' << e.y << '\n';
+        } else {
+            os << " reshape " << e.x << ' ' << e.y << '\n';
+        }
+    }
+
+    /**
+     * Read events written by write_event. Blank lines and lines starting
+     * with # are skipped.
+     */
+    inline std::vector<input_event> read_events(std::istream& is) {
+        std::vector<input_event> events;
+        std::string line;
+        while(std::getline(is, line)) {
+            if(line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            std::istringstream fields(line);
+            input_event e{0.0, input_event::mouse, 0, 0, 0, 0};
+            std::string kind;
+            fields >> e.time >> kind;
+            if(kind == "mouse") {
+                fields >> e.code >> e.state >> e.x >> e.y;
+            } else if(kind == "key") {
+                e.kind = input_event::keyboard;
+                fields >> e.code >> e.x >> e.y;
+            } else if(kind == "reshape") {
+                e.kind = input_event::reshape;
+                fields >> e.x >> e.y;
+            } else {
+                fields.setstate(std::ios::failbit);
+            }
+
+            std::string rest;
+            if(!fields || (fields >> rest) || (e.kind == input_event::reshape && (e.x <= 0 || e.y <= 0))) {
+                throw std::invalid_argument("Could not process event: " + line);
+            }
+            events.push_back(e);
+        }
+        return events;
+    }
+
+    /**
+     * Class: event_recorder
+     *
+     * Description: Appends events to a file as they happen, timed from the
+     * recorder's construction. Each line is flushed, so the recording
+     * survives the window being closed.
+     */
+    class event_recorder {
+
+        public:
+
+        explicit event_recorder(const std::string& path): file_(path), start_(std::chrono::steady_clock::now()) {
+            if(!file_) {
+                throw std::runtime_error("Could not open " + path);
+            }
+        }
+
+        void record(input_event::kind_t kind, int code, int state, int x, int y) {
+            const double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+            write_event(file_, {time, kind, code, state, x, y});
+            file_.flush();
+        }
+
+        private:
+
+        std::ofstream file_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    /**
+     * Class: view_controller
+     *
+     * Description: How input events change the view of a henon_map: mouse
+     * drags pan (left button) or select a region to zoom to (right button),
+     * the wheel and the z/x keys zoom and r resets. Window coordinates have
+     * y down, as GLUT gives them. Used by the GUI's callbacks and by replays.
+     */
+    template<class FLOAT_T>
+    class view_controller {
+
+        public:
+
+        enum action_t {
+            ignore,         //The view is unchanged
+            redisplay,      //The view changed and should be drawn
+            quit            //Escape was pressed
+        };
+
+        explicit view_controller(henon_map<FLOAT_T>& map): map_(map), mouse_state_(none), mouse_down_x_(0), mouse_down_y_(0) {}
+
+        action_t apply(const input_event& e) {
+            switch(e.kind) {
+                case input_event::mouse: return mouse(e.code, e.state, e.x, e.y);
+                case input_event::keyboard: return keyboard(static_cast<unsigned char>(e.code));
+                default: return reshape(e.x, e.y);
+            }
+        }
+
+        /**
+         * Change of window size. Scales viewing region by amount of increase
+         * in size, keeping center region the same.
+         */
+        action_t reshape(int new_x_pixels, int new_y_pixels) {
+
+            //Set scale factors
+            FLOAT_T sf_x = static_cast<double>(new_x_pixels)/map_.get_x_pixels();
+            FLOAT_T sf_y = static_cast<double>(new_y_pixels)/map_.get_y_pixels();
+
+            point<FLOAT_T> min = map_.get_bottom_left();
+            point<FLOAT_T> max = map_.get_top_right();
+
+            point<FLOAT_T> center((max.x+min.x)/2.0, (max.y+min.y)/2.0);
+
+            FLOAT_T x_half_range = sf_x*(max.x-min.x)/2.0;
+            FLOAT_T y_half_range = sf_y*(max.y-min.y)/2.0;
+
+            //Reset fractal scale with parameters scaled to new size of screen
+            map_.set_bottom_left({center.x - x_half_range, center.y - y_half_range});
+            map_.set_top_right({center.x + x_half_range, center.y + y_half_range});
+
+            map_.set_x_pixels(new_x_pixels);
+            map_.set_y_pixels(new_y_pixels);
+
+            return redisplay;
+        }
+
+        /**
+         * Keyboard event: zoom in/out, reset or exit
+         */
+        action_t keyboard(unsigned char key) {
+
+            constexpr char ESCAPE = 27;
+
+            point<FLOAT_T> min(map_.get_bottom_left());
+            point<FLOAT_T> max(map_.get_top_right());
+
+            switch (key) {
+                case 'x': case 'X': //Zoom out
+                    zoom(0.1, min, max);
+                    break;
+                case 'z': case 'Z': //Zoom in
+                    zoom(-0.1, min, max);
+                    break;
+                case 'r': case 'R': { //Reset
+                    map_.set_bottom_left(map_.get_start_bottom_left());
+                    map_.set_top_right(map_.get_start_top_right());
+                    break;
+                }
+                case ESCAPE:
+                    return quit;
+                default:
+                    return ignore;
+            }
+            return redisplay;
+        }
+
+        /**
+         * Mouse event: pans and selections complete when their button is
+         * released, the wheel zooms once per notch
+         */
+        action_t mouse(int button, int state, int x, int y) {
+
+            //Want lower value of y to correspond to lower on screen
+            //And higher to higher on screen
+            y = map_.get_y_pixels()-1-y;
+
+            point<FLOAT_T> min(map_.get_bottom_left());
+            point<FLOAT_T> max(map_.get_top_right());
+
+            switch(button) {
+                case left_button: { // Pan
+                    if(mouse_state_ != none && mouse_state_ != left_button) {
+                        return ignore; //Not the right state
+                    }
+
+                    if(state == button_down) {
+                        mouse_state_ = left_button;
+                        mouse_down_x_ = x;
+                        mouse_down_y_ = y;
+                        return ignore;
+                    }
+                    translate(mouse_down_x_, mouse_down_y_, x, y, min, max);
+                    mouse_state_ = none;
+                }
+                break;
+                case right_button: {
+                    if(mouse_state_ != none && mouse_state_ != right_button) return ignore; //Not the right state
+
+                    if(state == button_down) { // Zoom in
+                        mouse_state_ = right_button;
+                        mouse_down_x_ = x;
+                        mouse_down_y_ = y;
+                        return ignore;
+                    }
+                    select(mouse_down_x_, mouse_down_y_, x, y);
+                    mouse_state_ = none;
+                }
+                break;
+                case scroll_down: {
+                    if(mouse_state_ != none && mouse_state_ != scroll_down) return ignore; //Not the right state
+
+                    mouse_state_ = scroll_down;
+
+                    //Return for rendent mouse scroll
+                    if(state == button_down) return ignore;
+
+                    zoom(0.1, min, max);
+
+                    mouse_state_ = none;
+                }
+                break;
+                case scroll_up: {
+                    if(mouse_state_ != none && mouse_state_ != scroll_up) return ignore; //Not the right state
+
+                    mouse_state_ = scroll_up;
+
+                    if(state == button_down) return ignore;
+
+                    zoom(-0.1, min, max);
+
+                    mouse_state_ = none;
+                }
+                break;
+                default:
+                    return ignore;
+            }
+            return redisplay;
+        }
+
+        private:
+
+        static constexpr int none = -1;
+
+        /**
+         * Translation of viewing region by mouse
+         * xs,ys: starting coordinate
+         * xe,ye: ending cooridnates
+         * min/max: Starting coordinate of view
+         */
+        void translate(int xs, int ys, int xe, int ye, const point<FLOAT_T>& min, const point<FLOAT_T>& max) {
+            point<FLOAT_T> ps = map_.map_to_cartesian_plane(xs, ys);
+            point<FLOAT_T> pe = map_.map_to_cartesian_plane(xe, ye);
+
+            map_.set_x_params(min.x - pe.x + ps.x, max.x - pe.x + ps.x);
+            map_.set_y_params(min.y - pe.y + ps.y, max.y - pe.y + ps.y);
+        }
+
+        /**
+         * Zooming viewing region, sf: fraction of the view added on each side
+         */
+        void zoom(double sf, const point<FLOAT_T>& min, const point<FLOAT_T>& max) {
+            FLOAT_T x_dist = max.x - min.x;
+            FLOAT_T y_dist = max.y - min.y;
+
+            map_.set_bottom_left({min.x-x_dist*sf, min.y-y_dist*sf});
+            map_.set_top_right({max.x+x_dist*sf, max.y+y_dist*sf});
+        }
+
+        /**
+         * Selection of viewing region by mouse, widened to the aspect ratio
+         * of the window so that the fractal is not squished
+         * xs,ys: starting coordinate
+         * xe,ye: ending cooridnates
+         */
+        void select(int xs, int ys, int xe, int ye) {
+
+            double selection_aspect_ratio = std::abs(static_cast<double>(ys - ye)/(xs-xe));
+            double screen_aspect_ratio = static_cast<double>(map_.get_y_pixels())/map_.get_x_pixels();
+
+            int min_x, max_x, x_selection_size;
+            int min_y, max_y, y_selection_size;
+
+            double middle_x, middle_y;
+
+            //Selection is larger relatively in x direction than in y
+            if(selection_aspect_ratio < screen_aspect_ratio) {
+                x_selection_size = std::abs(xe-xs);
+                y_selection_size = x_selection_size*screen_aspect_ratio;
+
+            } else {
+                y_selection_size = std::abs(ye-ys);
+                x_selection_size = y_selection_size/screen_aspect_ratio;
+            }
+
+            middle_y = (ys+ye)/2.0;
+            min_y    =  middle_y - y_selection_size/2.0;
+            max_y    =  middle_y + y_selection_size/2.0;
+
+            middle_x = (xs+xe)/2.0;
+
+            min_x    =  middle_x - x_selection_size/2.0;
+            max_x    =  middle_x + x_selection_size/2.0;
+
+            auto lower_point = map_.map_to_cartesian_plane(min_x, min_y);
+            auto upper_point = map_.map_to_cartesian_plane(max_x, max_y);
+
+            map_.set_bottom_left(lower_point);
+            map_.set_top_right(upper_point);
+        }
+
+        henon_map<FLOAT_T>& map_;
+
+        int mouse_state_;
+        int mouse_down_x_, mouse_down_y_;
+    };
+
+    /**
+     * Latency of one replayed event, in seconds from its dispatch until a
+     * preview and the full resolution image of the new view are ready.
+     * Events which leave the view unchanged render nothing.
+     */
+    struct event_latency {
+        input_event event;
+        bool rendered;
+        double preview;
+        double final;
+    };
+
+    /**
+     * Class: event_replayer
+     *
+     * Description: Feeds recorded events through a view_controller and, after
+     * each one which changes the view, renders it as the display would
+     * respond: first a preview at 1/preview_scale of the resolution, then the
+     * full image, both colored into memory by the band renderer. Events are
+     * dispatched back to back rather than at their recorded times, so
+     * latencies do not depend on how fast they were recorded.
+     */
+    template<class FLOAT_T>
+    class event_replayer {
+
+        public:
+
+        event_replayer(henon_map<FLOAT_T>& map, ra::concurrency::thread_pool& pool, int preview_scale = 4, int band_height = 16):
+            map_(map), pool_(pool), controller_(map), preview_scale_(std::max(1, preview_scale)), band_height_(band_height) {}
+
+        /**
+         * Replay events, up to the first quit
+         */
+        std::vector<event_latency> replay(const std::vector<input_event>& events) {
+            using clock = std::chrono::steady_clock;
+
+            std::vector<event_latency> latencies;
+            for(const auto& e: events) {
+                const auto dispatched = clock::now();
+                const auto action = controller_.apply(e);
+                if(action == view_controller<FLOAT_T>::quit) {
+                    break;
+                }
+
+                event_latency latency{e, false, 0.0, 0.0};
+                if(action == view_controller<FLOAT_T>::redisplay) {
+                    henon_map<FLOAT_T> preview(map_);
+                    preview.set_x_pixels(std::max(2, map_.get_x_pixels()/preview_scale_));
+                    preview.set_y_pixels(std::max(2, map_.get_y_pixels()/preview_scale_));
+                    render(preview, preview_rgb_);
+                    latency.preview = std::chrono::duration<double>(clock::now() - dispatched).count();
+
+                    render(map_, rgb_);
+                    latency.final = std::chrono::duration<double>(clock::now() - dispatched).count();
+                    latency.rendered = true;
+                }
+                latencies.push_back(latency);
+            }
+            return latencies;
+        }
+
+        //Packed rgb of the last full resolution image, top row first
+        const std::vector<unsigned char>& image() const {return rgb_;}
+
+        private:
+
+        //Band sink coloring bands straight into an rgb buffer
+        struct rgb_sink {
+            using chunk_type = bool;
+
+            void begin(int width, int, int) {row_bytes = 3*static_cast<std::size_t>(width);}
+            chunk_type encode(const band_view& band) const {
+                colorize(band.its, static_cast<std::size_t>(band.num_rows)*band.width, band.max_its,
+                    rgb.data() + band.first_row*row_bytes);
+                return true;
+            }
+            void write(chunk_type&&) {}
+            void end() {}
+
+            std::vector<unsigned char>& rgb;
+            std::size_t row_bytes;
+        };
+
+        void render(const henon_map<FLOAT_T>& map, std::vector<unsigned char>& rgb) {
+            rgb.resize(3*static_cast<std::size_t>(map.get_x_pixels())*map.get_y_pixels());
+            rgb_sink sink{rgb, 0};
+            band_renderer<FLOAT_T>(map, pool_, band_height_).render(sink);
+        }
+
+        henon_map<FLOAT_T>& map_;
+        ra::concurrency::thread_pool& pool_;
+        view_controller<FLOAT_T> controller_;
+
+        int preview_scale_;
+        int band_height_;
+
+        std::vector<unsigned char> rgb_, preview_rgb_;
+    };
+}
+
+#endif
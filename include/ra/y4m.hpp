@@ -0,0 +1,223 @@
+/**
+ * YUV4MPEG2 and raw rgb frame streams for piping into video encoders:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#ifndef RA_IO_Y4M_HPP
+#define RA_IO_Y4M_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ra/animation.hpp"
+#include "ra/color.hpp"
+#include "ra/profile.hpp"
+#include "ra/thread_pool.hpp"
+
+namespace ra::io {
+
+    /**
+     * Class: video_stream_writer
+     *
+     * Description: Writes frames to a file descriptor, usually stdout piped
+     * into an encoder, either as a YUV4MPEG2 stream with 4:2:0 full range
+     * chroma (C420jpeg) or as headerless packed rgb24.
+     *
+     * Every possible iteration count is converted to rgb and YUV once per
+     * palette, so converting a frame is a table lookup per pixel plus a 2x2
+     * chroma average, done in bands on the pool. Planes are handed to the
+     * kernel straight from the frame buffers with a single writev.
+     */
+    class video_stream_writer {
+
+        public:
+
+        enum format_t {
+            y4m,
+            rgb
+        };
+
+        video_stream_writer(int fd, format_t format, int frame_rate = 30):
+            fd_(fd), format_(format), frame_rate_(std::max(1, frame_rate)),
+            width_(0), height_(0), max_its_(-1) {}
+
+        /**
+         * Convert and write one frame. Must be called from one thread at a time;
+         * all frames must have the same size.
+         */
+        void write_frame(const ra::fractal_logic::frame& f, ra::concurrency::thread_pool& pool, int band_height = 64) {
+            if(width_ == 0) {
+                width_ = f.width;
+                height_ = f.height;
+                if(format_ == y4m) {
+                    std::string header = "YUV4MPEG2 W" + std::to_string(width_) + " H" + std::to_string(height_)
+                        + " F" + std::to_string(frame_rate_) + ":1 Ip A1:1 C420jpeg\n";
+                    write_all({{const_cast<char *>(header.data()), header.size()}});
+                }
+            } else if(f.width != width_ || f.height != height_) {
+                throw std::invalid_argument("Frame size changed within a video stream");
+            }
+
+            if(f.max_its != max_its_) {
+                build_tables(f.max_its);
+            }
+
+            const int chroma_width = (width_+1)/2, chroma_height = (height_+1)/2;
+            if(format_ == y4m) {
+                y_.resize(static_cast<std::size_t>(width_)*height_);
+                u_.resize(static_cast<std::size_t>(chroma_width)*chroma_height);
+                v_.resize(u_.size());
+            } else {
+                rgb_.resize(3*static_cast<std::size_t>(width_)*height_);
+            }
+
+            //Bands cover an even number of rows so chroma rows are not shared
+            band_height = std::max(2, band_height + band_height%2);
+
+            std::vector<std::future<void>> bands;
+            for(int first_row=0; first_row<height_; first_row+=band_height) {
+                int last_row = std::min(height_, first_row+band_height);
+                bands.push_back(pool.submit([this, &f, first_row, last_row]() {
+                    if(format_ == y4m) {
+                        convert_yuv(f.its.data(), first_row, last_row);
+                    } else {
+                        convert_rgb(f.its.data(), first_row, last_row);
+                    }
+                }));
+            }
+            for(auto& band: bands) {
+                band.get();
+            }
+
+            if(format_ == y4m) {
+                static char frame_header[] = "FRAME\n";
+                write_all({
+                    {frame_header, sizeof(frame_header)-1},
+                    {y_.data(), y_.size()},
+                    {u_.data(), u_.size()},
+                    {v_.data(), v_.size()}
+                });
+            } else {
+                write_all({{rgb_.data(), rgb_.size()}});
+            }
+        }
+
+        private:
+
+        void build_tables(int max_its) {
+            max_its_ = max_its;
+
+            y_table_.resize(max_its+1);
+            u_table_.resize(max_its+1);
+            v_table_.resize(max_its+1);
+            rgb_table_.resize(3*(max_its+1));
+
+            for(int i=0; i<=max_its; ++i) {
+                unsigned char * c = rgb_table_.data() + 3*i;
+                ra::fractal_logic::set_rgb(static_cast<double>(i)/max_its, c);
+
+                //Full range BT.601, scaled by 256
+                int r = c[0], g = c[1], b = c[2];
+                y_table_[i] = (77*r + 150*g + 29*b + 128) >> 8;
+                u_table_[i] = ((-43*r - 85*g + 128*b + 128) >> 8) + 128;
+                v_table_[i] = ((128*r - 107*g - 21*b + 128) >> 8) + 128;
+            }
+        }
+
+        int clamp_its(int its) const {
+            return std::clamp(its, 0, max_its_);
+        }
+
+        void convert_rgb(const int * its, int first_row, int last_row) {
+            const std::size_t begin = static_cast<std::size_t>(first_row)*width_;
+            const std::size_t end = static_cast<std::size_t>(last_row)*width_;
+
+            unsigned char * out = rgb_.data() + 3*begin;
+            for(std::size_t i=begin; i<end; ++i, out+=3) {
+                const unsigned char * c = rgb_table_.data() + 3*clamp_its(its[i]);
+                out[0] = c[0];
+                out[1] = c[1];
+                out[2] = c[2];
+            }
+        }
+
+        void convert_yuv(const int * its, int first_row, int last_row) {
+            const int chroma_width = (width_+1)/2;
+
+            for(int row=first_row; row<last_row; ++row) {
+                const int * src = its + static_cast<std::size_t>(row)*width_;
+                unsigned char * y = y_.data() + static_cast<std::size_t>(row)*width_;
+
+                for(int x=0; x<width_; ++x) {
+                    y[x] = y_table_[clamp_its(src[x])];
+                }
+            }
+
+            //Each chroma sample averages a 2x2 block, repeating the last row/column for odd sizes
+            for(int row=first_row; row<last_row; row+=2) {
+                const int * top = its + static_cast<std::size_t>(row)*width_;
+                const int * bottom = (row+1 < height_) ? top + width_ : top;
+
+                unsigned char * u = u_.data() + static_cast<std::size_t>(row/2)*chroma_width;
+                unsigned char * v = v_.data() + static_cast<std::size_t>(row/2)*chroma_width;
+
+                for(int x=0; x<chroma_width; ++x) {
+                    int x0 = 2*x, x1 = std::min(2*x+1, width_-1);
+                    int a = clamp_its(top[x0]), b = clamp_its(top[x1]);
+                    int c = clamp_its(bottom[x0]), d = clamp_its(bottom[x1]);
+
+                    u[x] = (u_table_[a] + u_table_[b] + u_table_[c] + u_table_[d] + 2) >> 2;
+                    v[x] = (v_table_[a] + v_table_[b] + v_table_[c] + v_table_[d] + 2) >> 2;
+                }
+            }
+        }
+
+        /**
+         * writev until every buffer has been written, resuming after partial writes
+         */
+        void write_all(std::vector<iovec> buffers) {
+            std::size_t first = 0;
+            while(first < buffers.size()) {
+                int count = static_cast<int>(std::min<std::size_t>(buffers.size()-first, IOV_MAX));
+                ssize_t written = ::writev(fd_, buffers.data()+first, count);
+
+                if(written < 0) {
+                    if(errno == EINTR) continue;
+                    throw std::system_error(errno, std::generic_category(), "Could not write video stream");
+                }
+                RA_PROFILE_COUNT(bytes_written, written);
+
+                std::size_t remaining = written;
+                while(first < buffers.size() && remaining >= buffers[first].iov_len) {
+                    remaining -= buffers[first].iov_len;
+                    ++first;
+                }
+                if(first < buffers.size()) {
+                    buffers[first].iov_base = static_cast<char *>(buffers[first].iov_base) + remaining;
+                    buffers[first].iov_len -= remaining;
+                }
+            }
+        }
+
+        int fd_;
+        format_t format_;
+        int frame_rate_;
+
+        int width_, height_;
+        int max_its_;
+
+        std::vector<unsigned char> y_table_, u_table_, v_table_, rgb_table_;
+        std::vector<unsigned char> y_, u_, v_, rgb_;
+    };
+}
+
+#endif
@@ -0,0 +1,232 @@
+/**
+ * libfractal: the CPU renderers behind a C interface, without GL:
+ * Samuel Barrett, Seng 475, Summer 2021
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ra/color.hpp"
+#include "ra/fractal.h"
+#include "ra/henon.hpp"
+#include "ra/thread_pool.hpp"
+
+struct fractal_context {
+    explicit fractal_context(int threads): pool(threads), cancelled(false),
+        renders(0), cancelled_renders(0), pixels(0), iterations(0), nanoseconds(0) {}
+
+    ra::fractal_logic::henon_map<long double> map;
+    ra::concurrency::thread_pool pool;
+
+    std::atomic<bool> cancelled;
+
+    std::atomic<std::uint64_t> renders, cancelled_renders, pixels, iterations, nanoseconds;
+
+    std::string last_error;
+};
+
+namespace {
+
+    //Rows of a render handed to one task
+    constexpr int rows_per_task = 8;
+
+    int fail(fractal_context * context, int status, const std::string& message) {
+        context->last_error = message;
+        return status;
+    }
+
+    /**
+     * Run body, turning exceptions into status codes so none cross the C interface
+     */
+    template<class BODY>
+    int guarded(fractal_context * context, BODY&& body) {
+        if(!context) {
+            return FRACTAL_INVALID_ARGUMENT;
+        }
+        try {
+            return body();
+        } catch(std::bad_alloc&) {
+            return fail(context, FRACTAL_OUT_OF_MEMORY, "Out of memory");
+        } catch(std::exception& e) {
+            return fail(context, FRACTAL_ERROR, e.what());
+        }
+    }
+}
+
+fractal_context * fractal_create(int threads) {
+    try {
+        return new fractal_context(std::max(0, threads));
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+void fractal_destroy(fractal_context * context) {
+    delete context;
+}
+
+int fractal_set_type(fractal_context * context, const char * type) {
+    return guarded(context, [&]() {
+        if(!type) {
+            return fail(context, FRACTAL_INVALID_ARGUMENT, "No fractal type");
+        }
+
+        //Compile user formulas here first to keep their syntax errors
+        const std::string name = type, prefix = "expr:";
+        if(name.compare(0, prefix.size(), prefix) == 0) {
+            try {
+                ra::fractal_logic::expression_formula formula(name.substr(prefix.size()));
+            } catch(std::invalid_argument& e) {
+                return fail(context, FRACTAL_INVALID_ARGUMENT, e.what());
+            }
+        }
+
+        if(!context->map.set_fractal_type(name)) {
+            return fail(context, FRACTAL_INVALID_ARGUMENT, "Unknown fractal type " + name);
+        }
+        return static_cast<int>(FRACTAL_OK);
+    });
+}
+
+int fractal_set_parameters(fractal_context * context, double a, double b, double threshold, int max_iterations) {
+    return guarded(context, [&]() {
+        if(!(threshold > 0.0) || max_iterations < 0) {
+            return fail(context, FRACTAL_INVALID_ARGUMENT, "Threshold must be positive and max iterations non-negative");
+        }
+        context->map.set_a(a);
+        context->map.set_b(b);
+        context->map.set_threshold(threshold);
+        context->map.set_max_iterations(max_iterations);
+        return static_cast<int>(FRACTAL_OK);
+    });
+}
+
+int fractal_set_view(fractal_context * context, double min_x, double min_y, double max_x, double max_y, int width, int height) {
+    return guarded(context, [&]() {
+        if(width < 2 || height < 2) {
+            return fail(context, FRACTAL_INVALID_ARGUMENT, "A view needs at least 2x2 pixels");
+        }
+        context->map.set_bottom_left({min_x, min_y});
+        context->map.set_top_right({max_x, max_y});
+        context->map.set_x_pixels(width);
+        context->map.set_y_pixels(height);
+        return static_cast<int>(FRACTAL_OK);
+    });
+}
+
+int fractal_render(fractal_context * context, int x, int y, int width, int height,
+    int format, void * buffer, size_t stride) {
+
+    return guarded(context, [&]() {
+        const auto& map = context->map;
+        const std::size_t pixel_bytes = (format == FRACTAL_RGBA8) ? 4 : sizeof(std::int32_t);
+
+        if(format != FRACTAL_ITERATIONS && format != FRACTAL_RGBA8) {
+            return fail(context, FRACTAL_INVALID_ARGUMENT, "Unknown pixel format");
+        }
+        if(x < 0 || y < 0 || width <= 0 || height <= 0
+            || width > map.get_x_pixels() - x || height > map.get_y_pixels() - y) {
+            return fail(context, FRACTAL_INVALID_ARGUMENT, "Rectangle outside the view");
+        }
+        if(!buffer || stride < width*pixel_bytes) {
+            return fail(context, FRACTAL_INVALID_ARGUMENT, "Buffer missing or stride too small");
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        context->cancelled = false;
+
+        const auto params = map.get_formula_params();
+        const int max_its = map.get_max_iterations();
+
+        //Same coordinates as henon_map::render_rows, so tiles match whole images
+        std::vector<double> px(width);
+        for(int i=0; i<width; ++i) {
+            px[i] = static_cast<double>(map.map_to_cartesian_plane(x+i, 0).x);
+        }
+
+        std::vector<std::future<std::uint64_t>> tasks;
+        for(int first=0; first<height; first+=rows_per_task) {
+            tasks.push_back(context->pool.submit([&, first]() {
+                std::vector<double> py(width);
+                std::vector<int> its(width);
+                std::vector<unsigned char> rgb(format == FRACTAL_RGBA8 ? 3*width : 0);
+                std::uint64_t sum = 0;
+
+                for(int row=first; row<std::min(height, first+rows_per_task); ++row) {
+                    if(context->cancelled.load(std::memory_order_relaxed)) {
+                        break;
+                    }
+
+                    std::fill(py.begin(), py.end(),
+                        static_cast<double>(map.map_to_cartesian_plane(0, map.get_y_pixels()-1-(y+row)).y));
+                    map.compute_batch(px.data(), py.data(), width, params, its.data());
+
+                    unsigned char * out = static_cast<unsigned char *>(buffer) + row*stride;
+                    if(format == FRACTAL_ITERATIONS) {
+                        std::memcpy(out, its.data(), width*sizeof(std::int32_t));
+                    } else {
+                        ra::fractal_logic::colorize(its.data(), width, max_its, rgb.data());
+                        for(int i=0; i<width; ++i) {
+                            out[4*i] = rgb[3*i];
+                            out[4*i+1] = rgb[3*i+1];
+                            out[4*i+2] = rgb[3*i+2];
+                            out[4*i+3] = 255;
+                        }
+                    }
+
+                    for(int i=0; i<width; ++i) sum += its[i];
+                    context->pixels += width;
+                }
+                return sum;
+            }));
+        }
+
+        //Every task reads this frame's locals, so wait for all before any can throw
+        for(auto& task: tasks) {
+            task.wait();
+        }
+        std::uint64_t iterations = 0;
+        for(auto& task: tasks) {
+            iterations += task.get();
+        }
+        context->iterations += iterations;
+        context->nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if(context->cancelled) {
+            ++context->cancelled_renders;
+            return fail(context, FRACTAL_CANCELLED, "Render cancelled");
+        }
+        ++context->renders;
+        return static_cast<int>(FRACTAL_OK);
+    });
+}
+
+void fractal_cancel(fractal_context * context) {
+    if(context) {
+        context->cancelled = true;
+    }
+}
+
+int fractal_get_stats(const fractal_context * context, fractal_stats * stats) {
+    if(!context || !stats) {
+        return FRACTAL_INVALID_ARGUMENT;
+    }
+    stats->renders = context->renders;
+    stats->cancelled = context->cancelled_renders;
+    stats->pixels = context->pixels;
+    stats->iterations = context->iterations;
+    stats->seconds = context->nanoseconds*1e-9;
+    return FRACTAL_OK;
+}
+
+const char * fractal_last_error(const fractal_context * context) {
+    return context ? context->last_error.c_str() : "No context";
+}
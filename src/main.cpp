@@ -16,9 +16,42 @@
 #include <complex>
 #include <regex>
 #include <cmath>
+#include <cstdio>
+#include <cctype>
+#include <chrono>
+#include <memory>
+#include <system_error>
+#include <iomanip>
+#include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "ra/henon.hpp"
 #include "ra/shaders.hpp"
+#include "ra/thread_pool.hpp"
+#include "ra/band_renderer.hpp"
+#include "ra/pnm.hpp"
+#include "ra/png.hpp"
+#include "ra/mapped_image.hpp"
+#include "ra/animation.hpp"
+#include "ra/exp_map.hpp"
+#include "ra/y4m.hpp"
+#include "ra/density.hpp"
+#include "ra/atlas.hpp"
+#include "ra/buddhabrot.hpp"
+#include "ra/lyapunov.hpp"
+#include "ra/dimension.hpp"
+#include "ra/area.hpp"
+#include "ra/distance.hpp"
+#include "ra/diagnostics.hpp"
+#include "ra/tile_server.hpp"
+#include "ra/distributed.hpp"
+#include "ra/frame_stream.hpp"
+#include "ra/view_events.hpp"
+#include "ra/tuner.hpp"
+#include "ra/profile.hpp"
 
 using std::cout, std::endl, std::size_t;
 using point = ra::fractal_logic::point<long double>;
@@ -34,20 +67,17 @@ class call_back_funcs {
 
     public:
 
-    enum mouse_state_t {
-        right_button,
-        left_button,
-        scroll_up,
-        scroll_down,
-        none
-    };
+    using view_controller = ra::fractal_logic::view_controller<long double>;
 
     static ra::fractal_logic::henon_map<long double> henon;
 
-    static volatile int mouse_down_x, mouse_down_y;
-    static volatile int pan_pos_x, pan_start_pos_y;
+    //Changes henon's view on input events
+    static view_controller view;
 
-    static volatile mouse_state_t mouse_state;
+    //Records input events when -R is given
+    static std::unique_ptr<ra::fractal_logic::event_recorder> recorder;
+
+    static volatile int pan_pos_x, pan_start_pos_y;
 
     static unsigned int list_index;
 
@@ -60,15 +90,24 @@ class call_back_funcs {
      * then draws the elements
      */
     static void display_func() {
-        //Set world dimensions
-        glUniform2f(min_loc, henon.get_bottom_left().x, henon.get_bottom_left().y);
-        glUniform2f(max_loc, henon.get_top_right().x, henon.get_top_right().y);
+        {
+            RA_PROFILE_SCOPE("display");
+
+            //Set world dimensions
+            {
+                RA_PROFILE_SCOPE("upload");
+                glUniform2f(min_loc, henon.get_bottom_left().x, henon.get_bottom_left().y);
+                glUniform2f(max_loc, henon.get_top_right().x, henon.get_top_right().y);
+            }
 
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
-        //cout << "(" << henon.get_bottom_left() << "," << henon.get_top_right() << ")" << endl;
+            //cout << "(" << henon.get_bottom_left() << "," << henon.get_top_right() << ")" << endl;
 
-        glutSwapBuffers();
+            RA_PROFILE_SCOPE("swap");
+            glutSwapBuffers();
+        }
+        RA_PROFILE_FRAME("display");
     }
 
     /**
@@ -77,32 +116,9 @@ class call_back_funcs {
      * Keeping center region the same
      */
     static void reshape_func(int new_x_pixels,int new_y_pixels) {
+        if(recorder) recorder->record(ra::fractal_logic::input_event::reshape, 0, 0, new_x_pixels, new_y_pixels);
 
-        //Set scale factors
-        long double sf_x = static_cast<double>(new_x_pixels)/henon.get_x_pixels();
-        long double sf_y = static_cast<double>(new_y_pixels)/henon.get_y_pixels();
-
-        point min = henon.get_bottom_left();
-        point max = henon.get_top_right();
-
-        point center((max.x+min.x)/2.0, (max.y+min.y)/2.0);
-
-        long double x_half_range = sf_x*(max.x-min.x)/2.0;
-        long double y_half_range = sf_y*(max.y-min.y)/2.0;
-
-        long double min_x = center.x - x_half_range;
-        long double max_x = center.x + x_half_range;
-
-        long double min_y = center.y - y_half_range;
-        long double max_y = center.y + y_half_range;
-
-        //Reset fractal scale with parameters scaled to new size of screen
-        henon.set_bottom_left({min_x, min_y});
-        henon.set_top_right({max_x, max_y});
-
-
-        henon.set_x_pixels(new_x_pixels);
-        henon.set_y_pixels(new_y_pixels);
+        view.reshape(new_x_pixels, new_y_pixels);
 
         //Update shader with new info
         glUniform2ui(screen_pixels_loc, henon.get_x_pixels(), henon.get_y_pixels());
@@ -111,198 +127,52 @@ class call_back_funcs {
         glUniform2f(min_loc, henon.get_bottom_left().x, henon.get_bottom_left().y);
         glUniform2f(max_loc, henon.get_top_right().x, henon.get_top_right().y);
 
-        //Allocate space for new pixels if needed
-        //henon.set_vector_size();
-
         glViewport(0,0,henon.get_x_pixels(), henon.get_y_pixels());
-
-        //glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-        //glutPostRedisplay();
-        //glutSwapBuffers();
-    }
-
-    /**
-     * Code to process translation of viewing region by mouse
-     * xs,ys: starting coordinate 
-     * xe,ye: ending cooridnates
-     * min/max: Starting coordinate of view
-     */
-    static void mouse_translate(int xs, int ys, int xe, int ye, 
-        point& min, point& max) {
-
-        
-        point ps = henon.map_to_cartesian_plane(xs, ys);
-        point pe = henon.map_to_cartesian_plane(xe, ye);
-
-        henon.set_x_params(min.x - pe.x + ps.x, max.x - pe.x + ps.x);
-        henon.set_y_params(min.y - pe.y + ps.y, max.y - pe.y + ps.y);
     }
 
-    /**
-     * Code to process zooming viewing region by mouse
-     * sf: Amount to zoom mouse by
-     */
-    static void mouse_zoom(double sf, point& min, point& max) {
-        long double x_dist = max.x - min.x;
-        long double y_dist = max.y - min.y;
-
-        henon.set_bottom_left({min.x-x_dist*sf, min.y-y_dist*sf});
-        henon.set_top_right({max.x+x_dist*sf, max.y+y_dist*sf});
-    }
-
-    /**
-     * Code to process selection of viewing region by mouse
-     * xs,ys: starting coordinate 
-     * xe,ye: ending cooridnates
-     */
-    static void mouse_select(int xs, int ys, int xe, int ye) {
-
-        double selection_aspect_ratio = std::abs(static_cast<double>(ys - ye)/(xs-xe));
-        double screen_aspect_ratio = static_cast<double>(henon.get_y_pixels())/henon.get_x_pixels();
-
-        int min_x, max_x, x_selection_size;
-        int min_y, max_y, y_selection_size;
-
-        double middle_x, middle_y;
-
-        //Selection is larger relatively in x direction than in y
-        if(selection_aspect_ratio < screen_aspect_ratio) {
-            x_selection_size = std::abs(xe-xs);
-            y_selection_size = x_selection_size*screen_aspect_ratio;
-
-        } else {
-            y_selection_size = std::abs(ye-ys);
-            x_selection_size = y_selection_size/screen_aspect_ratio;
-        }
-
-        middle_y = (ys+ye)/2.0;
-        min_y    =  middle_y - y_selection_size/2.0;
-        max_y    =  middle_y + y_selection_size/2.0;
-
-        middle_x = (xs+xe)/2.0;
-
-        min_x    =  middle_x - x_selection_size/2.0;
-        max_x    =  middle_x + x_selection_size/2.0;
-
-        auto lower_point = henon.map_to_cartesian_plane(min_x, min_y);
-        auto upper_point = henon.map_to_cartesian_plane(max_x, max_y);
-        
-        henon.set_bottom_left(lower_point);
-        henon.set_top_right(upper_point);
-    }
-
-
     /**
      * Called upon keyboard event, performs transformation of viewing region (zoom in/out or exit) depending on 
      * key press
      */
-    static void keyboard_func (unsigned char key, int, int) {
+    static void keyboard_func (unsigned char key, int x, int y) {
+        if(recorder) recorder->record(ra::fractal_logic::input_event::keyboard, key, 0, x, y);
 
-        constexpr char ESCAPE = 27;
-
-        point min(henon.get_bottom_left());
-        point max(henon.get_top_right());
-
-        switch (key) {
-            case 'x': case 'X': //Zoom out
-                mouse_zoom(0.1, min, max);
-                break;
-            case 'z': case 'Z': //Zoom in
-                mouse_zoom(-0.1, min, max);
-                break;
-            case 'r': case 'R': { //Reset
-                henon.set_bottom_left(henon.get_start_bottom_left());
-                henon.set_top_right(henon.get_start_top_right());
-                break;
-            }
-            case ESCAPE: {
+        switch(view.keyboard(key)) {
+            case view_controller::quit:
                 glutDestroyWindow(glutGetWindow());
                 return;
-            }
+            case view_controller::redisplay:
+                glutPostRedisplay();
+                break;
+            default:
+                break;
         }
-        glutPostRedisplay();
     }
 
     /**
      * Called upon mouse event, performs transformation of viewing region depending on operation
      */
     static void mouse_func(int button, int state, int x, int y) {
+        if(recorder) recorder->record(ra::fractal_logic::input_event::mouse, button, state, x, y);
 
-        constexpr int MOUSE_SCROLL_UP = 3;
-        constexpr int MOUSE_SCROLL_DOWN = 4;
-
-        //Want lower value of y to correspond to lower on screen
-        //And higher to higher on screen
-        y = henon.get_y_pixels()-1-y;
-
-        point min(henon.get_bottom_left());
-        point max(henon.get_top_right());
-
-        switch(button) {
-            case GLUT_LEFT_BUTTON: { // Pan
-                if(mouse_state != none && mouse_state != left_button) {
-                    return; //Not the right state
-                }
-                
-                if(state == GLUT_DOWN) {
-                    mouse_state = left_button;
-                    mouse_down_x = x;
-                    mouse_down_y = y;
-                } else if(state == GLUT_UP) {
-                    mouse_translate(mouse_down_x, mouse_down_y, x, y, min, max);
-                    mouse_state = none;
-                }
-            }
-            break;
-            case GLUT_RIGHT_BUTTON: {
-                if(mouse_state != none && mouse_state != right_button) return; //Not the right state
-                
-                if(state == GLUT_DOWN) { // Zoom in 
-                    mouse_state = right_button;
-                    mouse_down_x = x;
-                    mouse_down_y = y;
-                } else if(state == GLUT_UP){
-                    mouse_select(mouse_down_x, mouse_down_y, x, y);
-                    mouse_state = none;
-                }
-            }
-            break;
-            case MOUSE_SCROLL_DOWN: {
-                if(mouse_state != none && mouse_state != scroll_down) return; //Not the right state
-                
-                mouse_state = scroll_down;
-
-                //Return for rendent mouse scroll
-                if(state == GLUT_DOWN) return;
-
-                mouse_zoom(0.1, min, max);
-
-                mouse_state = none;
-            }
-            break;
-            case MOUSE_SCROLL_UP: {
-                if(mouse_state != none && mouse_state != scroll_up) return; //Not the right state
-
-                mouse_state = scroll_up;
-
-                if(state == GLUT_DOWN) return;
-
-                mouse_zoom(-0.1, min, max);
-
-                mouse_state = none;
-            }
+        if(view.mouse(button, state, x, y) == view_controller::redisplay) {
+            glutPostRedisplay();
         }
-        glutPostRedisplay();
     }
 };
 
+//Recorded events hold GLUT's values
+static_assert(GLUT_LEFT_BUTTON == ra::fractal_logic::left_button && GLUT_RIGHT_BUTTON == ra::fractal_logic::right_button
+    && GLUT_DOWN == ra::fractal_logic::button_down && GLUT_UP == ra::fractal_logic::button_up,
+    "GLUT's mouse values differ from input_event's");
+
 ra::fractal_logic::henon_map<long double> call_back_funcs::henon;
 
-volatile int call_back_funcs::mouse_down_x, call_back_funcs::mouse_down_y;
-volatile int call_back_funcs::pan_pos_x, call_back_funcs::pan_start_pos_y;
+call_back_funcs::view_controller call_back_funcs::view(call_back_funcs::henon);
+
+std::unique_ptr<ra::fractal_logic::event_recorder> call_back_funcs::recorder;
 
-volatile call_back_funcs::mouse_state_t call_back_funcs::mouse_state = call_back_funcs::mouse_state_t::none;
+volatile int call_back_funcs::pan_pos_x, call_back_funcs::pan_start_pos_y;
 
 unsigned int call_back_funcs::list_index;
 
@@ -329,7 +199,50 @@ static int show_usage(std::string name) {
         << "\n\t-L [leftmost point],[lowest point]:\n\t\tSpecify bottom left point to display initially on xy plane\n"
         << "\t-U [rightmost point],[highest point]:\n\t\tSpecify top right point to display initially on xy plane\n"
         << "\t-f [fractal]:\tSpecify top right point to display initially on xy plane\n"
-        << "\t\tArguments:\n\t\tmandelbrot: display mandelbrot set\n\t\thenon: display henon (default)\n";
+        << "\t\tArguments:\n\t\tmandelbrot: display mandelbrot set\n\t\thenon: display henon (default)\n"
+        << "\t\tjulia: julia set of z^2 + c with c = a + bi (-a/-b), burningship, tricorn,\n"
+        << "\t\tmultibrot3, multibrot4, multibrot5: rendered with -o or -M only\n"
+        << "\t\t\"expr:<x expression>, <y expression>\": user map of x, y, a, b, cx, cy,\n"
+        << "\t\te.g. \"expr:1 - a*x^2 + y, b*x\" (+ - * / ^, sin cos exp log sqrt abs, pi)\n"
+        << "\n\t-o [file]\tRender to a .png, .ppm, .pfm or .pnm file without opening a window (- for pnm on stdout)\n"
+        << "\t-B [rows]\tNumber of rows per band when rendering to a file\n"
+        << "\t-j [threads]\tNumber of worker threads (0 for all hardware threads)\n"
+        << "\t-z [level]\tpng compression level, 0 (none) to 9 (smallest), -1 for default\n"
+        << "\t-A [samples]\tAnti-alias -o images with up to this many samples per edge pixel\n"
+        << "\n\t-F [frames]\tRender a zoom animation of this many frames, -o is a pattern with %d or %0Nd (frame%05d.png),\n"
+        << "\t\ta .y4m or .rgb video stream, or - for a y4m stream on stdout\n"
+        << "\t-r [fps]\tFrame rate written to y4m streams\n"
+        << "\t-l [leftmost point],[lowest point]:\n\t\tSpecify bottom left point of the last animation frame\n"
+        << "\t-u [rightmost point],[highest point]:\n\t\tSpecify top right point of the last animation frame\n"
+        << "\t-K [file]\tAnimate through the views in file, one \"x,y x,y\" pair of corners per line\n"
+        << "\n\t-M [mode]\tHeadless render mode:\n"
+        << "\t\texpmap: zoom animation resampled from one log-polar strip\n"
+        << "\t\tattractor: density of -n points on the henon strange attractor\n"
+        << "\t\tbuddhabrot, antibuddhabrot: density of -n mandelbrot orbits which escape (or not)\n"
+        << "\t\tatlas: bounded fraction of the -L/-U view over the -P/-Q (a, b) rectangle,\n"
+        << "\t\t\tplus a contact sheet of basins written to [file]_sheet\n"
+        << "\t\tlyapunov: largest lyapunov exponent of each pixel's orbit of -m steps\n"
+        << "\t\tdimension: box counting dimension of the henon attractor from -n points in the -L/-U view\n"
+        << "\t\tarea: stratified estimate of the bounded area of the -L/-U view from -n samples\n"
+        << "\t\tdistance: boundary distance estimates of the -f fractal over the -L/-U view\n"
+        << "\t\tdiagnose: render -o and write its cost heatmap [file]_cost, escape count histogram\n"
+        << "\t\t\t[file]_histogram.csv and band times [file]_bands.csv\n"
+        << "\t\treplay: replay the -R events through the view logic and CPU renderer, timing each\n"
+        << "\t\ttune: time -j, -B and -V settings on henon and mandelbrot views and save the fastest\n"
+        << "\t\t\tin this host's profile, used by later runs for the settings they are not given\n"
+        << "\t\tserve: render png tiles of the -L/-U view, -w pixels square, for clients of -s\n"
+        << "\t\tload: -n tile requests from -j concurrent clients of the -s server, with latencies\n"
+        << "\t\tstream: stream the -w x -h view to remote viewers on -s, sending only changed tiles\n"
+        << "\t\tcoordinate: render -o in bands of -B rows on workers connecting to -s\n"
+        << "\t\tworker: render bands for the coordinator at -s\n"
+        << "\t-n [samples]\tNumber of samples for density modes (e.g. 1e9)\n"
+        << "\t-P [a],[b]\tLower left (a, b) of the atlas\n"
+        << "\t-Q [a],[b]\tUpper right (a, b) of the atlas\n"
+        << "\t-S [samples]\tSamples per side of the grid summarizing each atlas pixel\n"
+        << "\t-s [socket]\tUnix socket path, or host:port for TCP, of the tile, frame or render server\n"
+        << "\t-V [lanes]\tPoints iterated together by the batch kernels: 4, 8 or 16\n"
+        << "\t-R [file]\tRecord the GUI's input events to file, or the events replayed by -M replay\n"
+        << "\t-T [file]\tWrite a Chrome trace of the run (builds with ENABLE_PROFILING)\n";
 
     return -1;
 }
@@ -588,12 +501,1035 @@ int init_shaders() {
     return set_uniforms(program_id);
 }
 
+/**
+ * Calls render(sink) with the sink for the extension of file_name.
+ * Files ending in .png are written as png, .ppm and .pfm through a memory
+ * mapping of the file, anything else as binary pnm ("-" for stdout).
+ * 
+ * Throws on failure
+ */
+template<class RENDER>
+void render_to_file(const std::string& file_name, RENDER&& render) {
+    auto has_extension = [&file_name](const std::string& ext) {
+        return file_name.size() >= ext.size() &&
+            file_name.compare(file_name.size()-ext.size(), ext.size(), ext) == 0;
+    };
+
+    //Raw formats are written in place through a mapping of the output file
+    if(has_extension(".ppm") || has_extension(".pfm")) {
+        ra::io::mapped_image_sink sink(file_name, has_extension(".ppm")
+            ? ra::io::mapped_image_sink::ppm : ra::io::mapped_image_sink::pfm);
+        render(sink);
+        RA_PROFILE_FRAME(file_name);
+        return;
+    }
+
+    std::ofstream file;
+    if(file_name != "-") {
+        file.open(file_name, std::ios::binary);
+        if(!file) {
+            throw std::runtime_error("Could not open " + file_name);
+        }
+    }
+    std::ostream& os = (file_name == "-") ? cout : file;
+
+    if(has_extension(".png")) {
+        ra::io::png_sink sink(os, call_back_funcs::henon.get_compression_level());
+        render(sink);
+    } else {
+        ra::io::pnm_sink sink(os);
+        render(sink);
+    }
+    RA_PROFILE_FRAME(file_name);
+}
+
+/**
+ * Destination of animation frames given by -o. A file name ending in .y4m,
+ * or - for stdout, receives a YUV4MPEG2 stream and .rgb a raw rgb24 stream,
+ * ready to be piped into a video encoder. Anything else is a pattern with
+ * one image per frame, whose number replaces its one %d or %0Nd, e.g.
+ * frame%05d.png, and where %% is a literal %.
+ */
+class frame_output {
+
+    public:
+
+    explicit frame_output(ra::concurrency::thread_pool& pool):
+        pool_(pool), pattern_(call_back_funcs::henon.get_output_file()), fd_(-1) {
+
+        auto has_extension = [this](const std::string& ext) {
+            return pattern_.size() >= ext.size() &&
+                pattern_.compare(pattern_.size()-ext.size(), ext.size(), ext) == 0;
+        };
+
+        if(pattern_ == "-" || has_extension(".y4m") || has_extension(".rgb")) {
+            fd_ = STDOUT_FILENO;
+            if(pattern_ != "-") {
+                fd_ = ::open(pattern_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if(fd_ < 0) {
+                    throw std::system_error(errno, std::generic_category(), "Could not open " + pattern_);
+                }
+            }
+
+            stream_ = std::make_unique<ra::io::video_stream_writer>(fd_,
+                has_extension(".rgb") ? ra::io::video_stream_writer::rgb : ra::io::video_stream_writer::y4m,
+                call_back_funcs::henon.get_frame_rate());
+        } else {
+            parse_pattern();
+        }
+    }
+
+    frame_output(const frame_output&) = delete;
+    frame_output& operator=(const frame_output&) = delete;
+
+    ~frame_output() {
+        if(fd_ > STDERR_FILENO) {
+            ::close(fd_);
+        }
+    }
+
+    void operator()(const ra::fractal_logic::frame& f) {
+        if(stream_) {
+            stream_->write_frame(f, pool_);
+            return;
+        }
+
+        std::string number = std::to_string(f.index);
+        if(number.size() < width_) {
+            number.insert(0, width_-number.size(), '0');
+        }
+
+        render_to_file(prefix_ + number + suffix_, [&](auto& sink) {
+            ra::fractal_logic::encode_frame(sink, f, pool_);
+        });
+    }
+
+    private:
+
+    /**
+     * Split the pattern around its frame number. Throws std::invalid_argument
+     * unless there is exactly one %d or %0Nd, so frames cannot overwrite
+     * each other.
+     */
+    void parse_pattern() {
+        auto invalid = [this]() {
+            return std::invalid_argument("Frame pattern " + pattern_ +
+                " needs one %d or %0Nd for the frame number, and %% for a literal %");
+        };
+
+        std::string * part = &prefix_;
+        for(std::size_t i=0; i<pattern_.size(); ++i) {
+            if(pattern_[i] != '%') {
+                *part += pattern_[i];
+            } else if(i+1 < pattern_.size() && pattern_[i+1] == '%') {
+                *part += '%';
+                ++i;
+            } else {
+                //At most two digits of width, led by a 0
+                std::size_t end = i+1;
+                while(end < pattern_.size() && end < i+4 && std::isdigit(static_cast<unsigned char>(pattern_[end]))) {
+                    ++end;
+                }
+                if(part != &prefix_ || end >= pattern_.size() || pattern_[end] != 'd'
+                    || end > i+3 || (end > i+1 && pattern_[i+1] != '0')) {
+                    throw invalid();
+                }
+                width_ = end > i+1 ? std::stoul(pattern_.substr(i+1, end-i-1)) : 0;
+                part = &suffix_;
+                i = end;
+            }
+        }
+        if(part != &suffix_) {
+            throw invalid();
+        }
+    }
+
+    ra::concurrency::thread_pool& pool_;
+    std::string pattern_;
+    std::string prefix_, suffix_;
+    std::size_t width_ = 0;
+
+    int fd_;
+    std::unique_ptr<ra::io::video_stream_writer> stream_;
+};
+
+/**
+ * Render the initial view to the file given by -o, without a window.
+ * Bands are streamed to the output as they complete, so images larger
+ * than memory can be produced.
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_headless() {
+    const auto& henon = call_back_funcs::henon;
+
+    ra::concurrency::thread_pool pool(henon.get_threads());
+    ra::fractal_logic::band_renderer<long double> renderer(henon, pool, henon.get_band_height());
+
+    try {
+        if(henon.get_supersample() > 1) {
+            ra::fractal_logic::adaptive_supersampler<long double> sampler(henon, henon.get_supersample());
+            render_to_file(henon.get_output_file(), [&](auto& sink) {
+                renderer.render(sink, [&sampler](int first_row, int num_rows, int * its, unsigned char * rgb) {
+                    sampler.render_rows(first_row, num_rows, its, nullptr, rgb);
+                }, sampler.levels());
+            });
+
+            double pixels = static_cast<double>(henon.get_x_pixels())*henon.get_y_pixels();
+            std::cerr << "Supersampling: " << sampler.samples()/pixels << " samples per pixel" << endl;
+        } else {
+            render_to_file(henon.get_output_file(), [&renderer](auto& sink) {
+                renderer.render(sink);
+            });
+        }
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Render -F frames zooming from the -L/-U view to the -l/-u view, or along
+ * the views in the -K keyframe file, to the frame_output given by -o
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_animation() {
+    using view = ra::fractal_logic::view<long double>;
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        std::vector<view> keyframes;
+        if(!henon.get_keyframe_file().empty()) {
+            std::ifstream keyframe_file(henon.get_keyframe_file());
+            if(!keyframe_file) {
+                throw std::runtime_error("Could not open " + henon.get_keyframe_file());
+            }
+            keyframes = ra::fractal_logic::read_keyframes<long double>(keyframe_file);
+        } else {
+            keyframes = {
+                {henon.get_start_bottom_left(), henon.get_start_top_right()},
+                {henon.get_end_bottom_left(), henon.get_end_top_right()}
+            };
+        }
+
+        auto views = ra::fractal_logic::zoom_path(keyframes, henon.get_frames());
+
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::animation_renderer<long double> renderer(henon, pool, henon.get_band_height());
+
+        frame_output output(pool);
+        renderer.render(views, std::ref(output));
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Render -F frames zooming from the size of the -L/-U view to the -l/-u view,
+ * by resampling a single log-polar strip centered on the -l/-u view
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_exponential_zoom() {
+    using view = ra::fractal_logic::view<long double>;
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::exponential_zoom_renderer<long double> renderer(henon, pool, henon.get_band_height());
+
+        view start{henon.get_start_bottom_left(), henon.get_start_top_right()};
+        view end{henon.get_end_bottom_left(), henon.get_end_top_right()};
+
+        frame_output output(pool);
+        renderer.render(start, end, henon.get_frames(), std::ref(output));
+
+        std::cerr << "Exponential map: " << renderer.strip()->angles() << " angles x "
+            << renderer.strip()->rows() << " radii" << endl;
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Write a tone mapped density grid to the -o file
+ */
+void write_density(const ra::fractal_logic::density_grid& grid, ra::concurrency::thread_pool& pool) {
+    constexpr int levels = 1024;
+
+    ra::fractal_logic::frame f{0, grid.width(), grid.height(), levels, grid.tone_map(levels)};
+    render_to_file(call_back_funcs::henon.get_output_file(), [&](auto& sink) {
+        ra::fractal_logic::encode_frame(sink, f, pool);
+    });
+}
+
+/**
+ * Render the density of -n points of the Henon attractor for -a/-b
+ * over the -L/-U view
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_attractor() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::henon_attractor<long double> attractor(henon, pool);
+
+        auto start = std::chrono::steady_clock::now();
+        auto grid = attractor.render(henon.get_samples());
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cerr << "Attractor: " << attractor.points() << " points in " << elapsed.count() << " s ("
+            << attractor.points()/elapsed.count() << " points/s), "
+            << grid.total() << " inside the view" << endl;
+
+        write_density(grid, pool);
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Render a Buddhabrot (or anti-Buddhabrot) from -n samples of c over the
+ * -L/-U view
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_buddhabrot(bool anti) {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::buddhabrot<long double> buddhabrot(henon, pool, anti);
+
+        auto grid = buddhabrot.render(henon.get_samples());
+        const auto& stats = buddhabrot.stats();
+
+        std::cerr << (anti ? "Anti-Buddhabrot: " : "Buddhabrot: ") << stats.samples << " samples in "
+            << stats.seconds << " s (" << stats.samples_per_second() << " samples/s), acceptance rate "
+            << stats.acceptance_rate() << endl;
+
+        write_density(grid, pool);
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Render the largest Lyapunov exponent of the orbit from each pixel of the
+ * -L/-U view to the -o file, streamed in bands like render_headless
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_lyapunov() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::band_renderer<long double> renderer(henon, pool, henon.get_band_height());
+        ra::fractal_logic::lyapunov_field<long double> field(henon);
+
+        auto start = std::chrono::steady_clock::now();
+        render_to_file(henon.get_output_file(), [&](auto& sink) {
+            renderer.render(sink, [&field](int first_row, int num_rows, int * its) {
+                field.render_rows(first_row, num_rows, its);
+            }, field.levels());
+        });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        double pixels = static_cast<double>(henon.get_x_pixels())*henon.get_y_pixels();
+        std::cerr << "Lyapunov: " << pixels << " pixels in " << elapsed.count() << " s ("
+            << pixels/elapsed.count() << " pixels/s)" << endl;
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Estimate the box counting dimension of the Henon attractor for -a/-b from
+ * -n orbit points, with boxes dividing the -L/-U view
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_dimension() {
+    using box_dimension = ra::fractal_logic::box_dimension<long double>;
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        box_dimension estimator(henon, pool);
+
+        auto start = std::chrono::steady_clock::now();
+        auto counts = estimator.count(henon.get_samples());
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        auto fit = box_dimension::fit(counts, estimator.points());
+
+        cout << "level\tboxes\tlocal slope" << endl;
+        for(std::size_t i=0; i<counts.size(); ++i) {
+            cout << counts[i].level << "\t" << counts[i].boxes;
+            if(!counts[i].complete) {
+                cout << "+ (table full)";
+            } else if(i > 0 && counts[i-1].boxes > 0 && counts[i].boxes > 0) {
+                cout << "\t" << std::log2(static_cast<double>(counts[i].boxes)/counts[i-1].boxes);
+            }
+            cout << endl;
+        }
+
+        if(fit.last_level < fit.first_level) {
+            cout << "Too few usable levels for a fit, increase -n" << endl;
+        } else {
+            cout << "Box counting dimension: " << fit.dimension << " +/- " << fit.standard_error
+                << " (levels " << fit.first_level << "-" << fit.last_level << ", r^2 " << fit.r_squared << ")" << endl;
+        }
+        std::cerr << "Dimension: " << estimator.points() << " points in " << elapsed.count() << " s ("
+            << estimator.points()/elapsed.count() << " points/s)" << endl;
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Estimate the area of the bounded points of the -L/-U view for the -f
+ * fractal from -n samples, printing the estimate after every round
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_area() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::area_estimator<long double> estimator(henon, pool);
+
+        cout << "samples\tseconds\tarea\tstandard error" << endl;
+        auto result = estimator.run(henon.get_samples(), [](const ra::fractal_logic::area_estimate& e) {
+            cout << e.samples << "\t" << e.seconds << "\t" << std::setprecision(10) << e.area
+                << "\t" << e.standard_error << std::setprecision(6) << endl;
+        });
+
+        cout << "Area: " << std::setprecision(10) << result.area << " +/- " << 1.96*result.standard_error
+            << " (95%)" << std::setprecision(6) << endl;
+        std::cerr << "Area: " << result.samples << " samples in " << result.seconds << " s ("
+            << result.samples/result.seconds << " samples/s)" << endl;
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Render distance estimates to the boundary of the -f fractal over the
+ * -L/-U view to the -o file
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_distance() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::band_renderer<long double> renderer(henon, pool, henon.get_band_height());
+        ra::fractal_logic::distance_field<long double> field(henon);
+
+        render_to_file(henon.get_output_file(), [&](auto& sink) {
+            renderer.render(sink, [&field](int first_row, int num_rows, int * its) {
+                field.render_rows(first_row, num_rows, its);
+            }, field.levels());
+        });
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Name of a file written next to file_name: suffix is added to its stem, and
+ * its extension kept unless another is given.
+ * atlas.png -> atlas_sheet.png, view.png -> view_bands.csv
+ */
+std::string derived_file_name(const std::string& file_name, const std::string& suffix, const std::string& extension = "") {
+    auto dot = file_name.find_last_of('.');
+    auto slash = file_name.find_last_of('/');
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return file_name + suffix + extension;
+    }
+    return file_name.substr(0, dot) + suffix + (extension.empty() ? file_name.substr(dot) : extension);
+}
+
+/**
+ * Render the atlas of the -P/-Q (a, b) rectangle at -w/-h pixels to the -o
+ * file, and a contact sheet of basin thumbnails next to it
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_atlas() {
+    constexpr int sheet_columns = 8, sheet_rows = 8, thumbnail = 64;
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        if(henon.get_output_file() == "-") {
+            throw std::invalid_argument("The atlas needs a file name for its contact sheet");
+        }
+
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::parameter_atlas<long double> atlas(henon, pool,
+            henon.get_param_bottom_left(), henon.get_param_top_right(),
+            henon.get_x_pixels(), henon.get_y_pixels(), henon.get_atlas_samples());
+
+        auto start = std::chrono::steady_clock::now();
+        auto image = atlas.parameter_image();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cerr << "Atlas: " << image.its.size() << " (a, b) pairs in " << elapsed.count() << " s ("
+            << image.its.size()/elapsed.count() << " pairs/s)" << endl;
+
+        render_to_file(henon.get_output_file(), [&](auto& sink) {
+            ra::fractal_logic::encode_frame(sink, image, pool);
+        });
+
+        auto sheet = atlas.contact_sheet(sheet_columns, sheet_rows, thumbnail);
+        render_to_file(derived_file_name(henon.get_output_file(), "_sheet"), [&](auto& sink) {
+            ra::fractal_logic::encode_frame(sink, sheet, pool);
+        });
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Render the -o image like render_headless (with -A), and next to it where
+ * the time went: a heatmap of the orbit steps of each pixel ([file]_cost),
+ * the escape count histogram ([file]_histogram.csv) and the wall time of
+ * each band of -B rows ([file]_bands.csv), with a summary on stderr
+ * 
+ * return 0 for success, -1 for failure
+ */
+int render_diagnosed() {
+    const auto& henon = call_back_funcs::henon;
+    const std::string& file_name = henon.get_output_file();
+
+    auto write_csv = [](const std::string& csv_name, auto&& write) {
+        std::ofstream csv(csv_name);
+        write(csv);
+        if(!csv) {
+            throw std::runtime_error("Could not write " + csv_name);
+        }
+    };
+
+    try {
+        if(file_name == "-") {
+            throw std::invalid_argument("Diagnostics need a file name to write next to");
+        }
+
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::band_renderer<long double> renderer(henon, pool, henon.get_band_height());
+        ra::fractal_logic::adaptive_supersampler<long double> sampler(henon, henon.get_supersample());
+
+        const bool supersampled = henon.get_supersample() > 1;
+        ra::fractal_logic::render_diagnostics diagnostics(henon.get_x_pixels(), henon.get_y_pixels(),
+            henon.get_max_iterations(), supersampled ? sampler.scale : 1);
+
+        render_to_file(file_name, [&](auto& sink) {
+            if(supersampled) {
+                diagnostics.render(renderer, sink, [&sampler](int first_row, int num_rows, int * its,
+                    std::uint64_t * cost, unsigned char * rgb) {
+                    sampler.render_rows(first_row, num_rows, its, cost, rgb);
+                });
+            } else {
+                diagnostics.render(renderer, sink, ra::fractal_logic::cost_rows(henon));
+            }
+        });
+
+        auto heatmap = diagnostics.heatmap();
+        render_to_file(derived_file_name(file_name, "_cost"), [&](auto& sink) {
+            ra::fractal_logic::encode_frame(sink, heatmap, pool);
+        });
+        write_csv(derived_file_name(file_name, "_histogram", ".csv"), [&](std::ostream& os) {diagnostics.write_histogram(os);});
+        write_csv(derived_file_name(file_name, "_bands", ".csv"), [&](std::ostream& os) {diagnostics.write_bands(os);});
+
+        diagnostics.write_summary(std::cerr);
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * The q quantile (0 to 1) of latencies v, which are reordered; 0 if empty
+ */
+static double percentile(std::vector<double>& v, double q) {
+    if(v.empty()) return 0.0;
+    auto nth = v.begin() + static_cast<std::size_t>(q*(v.size()-1));
+    std::nth_element(v.begin(), nth, v.end());
+    return *nth;
+}
+
+/**
+ * Replay the input events recorded in the -R file through the GUI's view
+ * logic, without a window. After each event which changes the view, a
+ * quarter resolution preview and then the full -w by -h image are rendered
+ * with -j threads in bands of -B rows. Prints the latency of each event and
+ * percentiles over all of them.
+ * 
+ * return 0 for success, -1 for failure
+ */
+int replay_events() {
+    auto& henon = call_back_funcs::henon;
+
+    try {
+        std::ifstream event_file(henon.get_event_file());
+        if(!event_file) {
+            throw std::runtime_error("Could not open " + henon.get_event_file() + ", give the recorded events with -R");
+        }
+        auto events = ra::fractal_logic::read_events(event_file);
+
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::fractal_logic::event_replayer<long double> replayer(henon, pool, 4, henon.get_band_height());
+        auto latencies = replayer.replay(events);
+
+        const char * kinds[] = {"mouse", "key", "reshape"};
+        std::vector<double> previews, finals;
+        cout << "event\ttime s\tkind\tpreview ms\tfinal ms" << endl;
+        for(std::size_t i=0; i<latencies.size(); ++i) {
+            const auto& l = latencies[i];
+            cout << i << '\t' << l.event.time << '\t' << kinds[l.event.kind];
+            if(l.rendered) {
+                cout << '\t' << l.preview*1e3 << '\t' << l.final*1e3;
+                previews.push_back(l.preview*1e3);
+                finals.push_back(l.final*1e3);
+            } else {
+                cout << "\t-\t-";
+            }
+            cout << endl;
+        }
+
+        cout << "latency\tevents\tp50 ms\tp95 ms\tmax ms" << endl;
+        cout << "preview\t" << previews.size() << '\t' << percentile(previews, 0.5) << '\t'
+            << percentile(previews, 0.95) << '\t' << percentile(previews, 1.0) << endl;
+        cout << "final\t" << finals.size() << '\t' << percentile(finals, 0.5) << '\t'
+            << percentile(finals, 0.95) << '\t' << percentile(finals, 1.0) << endl;
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Tune the rendering settings for this host on the views of tuning_views,
+ * with up to -j threads, and save them as its profile
+ * 
+ * return 0 for success, -1 for failure
+ */
+int run_tuner() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        const std::string path = ra::fractal_logic::host_profile::default_path();
+        if(path.empty()) {
+            throw std::runtime_error("No place for the profile, set FRACTAL_PROFILE or HOME");
+        }
+
+        ra::fractal_logic::host_profile profile;
+        ra::fractal_logic::auto_tuner<long double> tuner(3, henon.get_threads());
+        for(const auto& [family, view]: ra::fractal_logic::tuning_views<long double>()) {
+            std::cerr << "Tuning " << family << endl;
+            auto best = tuner.tune(view, std::cerr);
+            profile.set(family, best);
+
+            cout << family << ": -j " << best.threads << " -B " << best.band_height << " -V " << best.lanes
+                << " (" << best.seconds*1e3 << " ms)" << endl;
+        }
+
+        std::ofstream file(path);
+        profile.write(file);
+        if(!file) {
+            throw std::runtime_error("Could not write " + path);
+        }
+        cout << "Saved " << path << endl;
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Use the settings of this host's profile, if -M tune has written one, for
+ * the fractal's family where -j, -B and -V were not given. Not for load,
+ * whose -j is a number of clients, nor for coordinate and worker, so that
+ * every host of a distributed render runs with the settings it was given.
+ */
+void apply_host_profile() {
+    auto& henon = call_back_funcs::henon;
+
+    const std::string path = ra::fractal_logic::host_profile::default_path();
+    std::ifstream file(path);
+    if(path.empty() || !file) {
+        return;
+    }
+
+    ra::fractal_logic::host_profile profile;
+    try {
+        profile.read(file);
+    } catch(std::invalid_argument& e) {
+        std::cerr << "Ignoring " << path << ": " << e.what() << endl;
+        return;
+    }
+    if(!profile.matches_host()) {
+        std::cerr << "Ignoring " << path << ": tuned for " << profile.hardware_threads()
+            << " threads, run -M tune again" << endl;
+        return;
+    }
+
+    const auto * tuned = profile.find(henon.get_fractal_name());
+    if(!tuned) {
+        return;
+    }
+    if(!henon.is_option_given('j')) henon.set_threads(tuned->threads);
+    if(!henon.is_option_given('B')) henon.set_band_height(tuned->band_height);
+    if(!henon.is_option_given('V')) henon.set_kernel_lanes(tuned->lanes);
+
+    std::cerr << "Tuned settings from " << path << ": -j " << henon.get_threads() << " -B " << henon.get_band_height()
+        << " -V " << henon.get_kernel_lanes() << endl;
+}
+
+/**
+ * Serve tiles of the -L/-U view, -w pixels square, on the -s unix socket
+ * until killed
+ * 
+ * return -1 for failure
+ */
+int serve_tiles() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        if(henon.get_socket_path().empty()) {
+            throw std::invalid_argument("The tile server needs a socket, use -s");
+        }
+
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::io::tile_server<long double> server(henon, pool);
+        server.listen(henon.get_socket_path());
+
+        std::cerr << "Serving " << server.tile_size() << "x" << server.tile_size() << " tiles on "
+            << henon.get_socket_path() << endl;
+        server.run();
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stream the initial view to remote viewers on the -s socket as tile
+ * deltas, rendering with -j threads, until killed
+ * 
+ * return 0 for success, -1 for failure
+ */
+int serve_frames() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        if(henon.get_socket_path().empty()) {
+            throw std::invalid_argument("The frame server needs a socket, use -s");
+        }
+
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::io::frame_server<long double> server(henon, pool);
+        server.listen(henon.get_socket_path());
+
+        std::cerr << "Streaming " << henon.get_x_pixels() << "x" << henon.get_y_pixels() << " frames on "
+            << henon.get_socket_path() << endl;
+        server.run();
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Load generator for the tile server on -s: -j clients (one request
+ * outstanding each) send -n requests in total for the -f/-a/-b/-t/-m
+ * fractal. Four in five are interactive requests for the 64 tiles of zoom
+ * 3, the rest batch requests for the 1024 tiles of zoom 5, so clients
+ * overlap and exercise the cache and request coalescing. Prints latency
+ * percentiles by priority and the server's counters.
+ * 
+ * return 0 for success, -1 for failure
+ */
+int run_load_generator() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        if(henon.get_socket_path().empty()) {
+            throw std::invalid_argument("The load generator needs the server's socket, use -s");
+        }
+
+        const int clients = henon.get_threads() > 0 ? henon.get_threads()
+            : std::max(1u, std::thread::hardware_concurrency());
+        const unsigned long long total = henon.get_samples();
+
+        std::vector<std::vector<double>> latencies[2];
+        latencies[0].resize(clients);
+        latencies[1].resize(clients);
+        std::vector<std::string> errors(clients);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int client=0; client<clients; ++client) {
+            threads.emplace_back([&, client]() {
+                try {
+                    ra::io::tile_client connection(henon.get_socket_path());
+                    std::mt19937_64 rng(client);
+
+                    ra::io::tile_request r;
+                    r.fractal = henon.get_fractal_type() == fractal_t::expression
+                        ? "expr:" + henon.get_expression()->source() : henon.get_fractal_name();
+                    r.a = henon.get_a();
+                    r.b = henon.get_b();
+                    r.threshold = henon.get_threshold();
+                    r.max_its = henon.get_max_iterations();
+
+                    for(unsigned long long i=client; i<total; i+=clients) {
+                        bool interactive = rng()%5 != 0;
+                        r.id = i;
+                        r.priority = interactive ? ra::io::tile_priority::interactive : ra::io::tile_priority::batch;
+                        r.zoom = interactive ? 3 : 5;
+                        r.x = rng() % (1u << r.zoom);
+                        r.y = rng() % (1u << r.zoom);
+
+                        auto sent = std::chrono::steady_clock::now();
+                        connection.request(r);
+                        std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - sent;
+                        latencies[interactive ? 0 : 1][client].push_back(latency.count());
+                    }
+                } catch(std::exception& e) {
+                    errors[client] = e.what();
+                }
+            });
+        }
+        for(auto& thread: threads) {
+            thread.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        for(const auto& error: errors) {
+            if(!error.empty()) throw std::runtime_error(error);
+        }
+
+        std::vector<double> all;
+        cout << "priority\trequests\tp50 ms\tp99 ms" << endl;
+        for(int priority=0; priority<2; ++priority) {
+            std::vector<double> merged;
+            for(const auto& l: latencies[priority]) merged.insert(merged.end(), l.begin(), l.end());
+            all.insert(all.end(), merged.begin(), merged.end());
+
+            cout << (priority == 0 ? "interactive" : "batch") << "\t" << merged.size() << "\t"
+                << percentile(merged, 0.5) << "\t" << percentile(merged, 0.99) << endl;
+        }
+
+        std::cerr << "Load: " << all.size() << " requests from " << clients << " clients in " << elapsed.count()
+            << " s (" << all.size()/elapsed.count() << " requests/s)" << endl;
+        cout << "Server: " << ra::io::tile_client(henon.get_socket_path()).stats() << endl;
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Render the initial view to the -o file on worker processes which
+ * connect to the -s socket, in bands of -B rows
+ * 
+ * return 0 for success, -1 for failure
+ */
+int coordinate_render() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        if(henon.get_socket_path().empty() || henon.get_output_file().empty()) {
+            throw std::invalid_argument("The coordinator needs a socket for its workers (-s) and an output file (-o)");
+        }
+
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::io::render_coordinator<long double> coordinator(henon, pool, henon.get_band_height());
+        coordinator.listen(henon.get_socket_path());
+        std::cerr << "Waiting for workers on " << henon.get_socket_path() << endl;
+
+        auto start = std::chrono::steady_clock::now();
+        render_to_file(henon.get_output_file(), [&coordinator](auto& sink) {
+            coordinator.render(sink);
+        });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        auto stats = coordinator.stats();
+        std::cerr << "Coordinator: " << stats.bands << " bands from " << stats.workers << " workers in "
+            << elapsed.count() << " s, " << stats.lost << " workers lost, " << stats.requeued << " bands requeued" << endl;
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Render bands for the coordinator on the -s socket with -j threads,
+ * waiting up to 30 s for it to come up
+ * 
+ * return 0 for success, -1 for failure
+ */
+int run_worker() {
+    const auto& henon = call_back_funcs::henon;
+
+    try {
+        if(henon.get_socket_path().empty()) {
+            throw std::invalid_argument("The worker needs the coordinator's socket, use -s");
+        }
+
+        ra::concurrency::thread_pool pool(henon.get_threads());
+        ra::io::render_worker<long double> worker(pool);
+
+        auto start = std::chrono::steady_clock::now();
+        for(;;) {
+            try {
+                auto bands = worker.run(henon.get_socket_path());
+                std::cerr << "Worker: " << bands << " bands rendered" << endl;
+                break;
+            } catch(std::system_error& e) {
+                if(std::chrono::steady_clock::now() - start > std::chrono::seconds(30)) throw;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+    } catch(std::exception& e) {
+        std::cerr << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char ** argv) {
 
     if(call_back_funcs::henon.process_command_line_args(argc, argv) < 0) {
         return show_usage(argv[0]);
     }
 
+    if(!call_back_funcs::henon.get_trace_file().empty()) {
+        if(!ra::profile::enabled) {
+            std::cerr << "-T needs a build with profiling, cmake -DENABLE_PROFILING=true" << endl;
+            return -1;
+        }
+        ra::profile::write_trace_at_exit(call_back_funcs::henon.get_trace_file());
+    }
+
+    const std::string& mode = call_back_funcs::henon.get_mode();
+    if(mode == "tune") {
+        return run_tuner();
+    }
+    if(mode != "load" && mode != "coordinate" && mode != "worker") {
+        apply_host_profile();
+    }
+
+    if(mode == "expmap") {
+        return render_exponential_zoom();
+    } else if(mode == "attractor") {
+        return render_attractor();
+    } else if(mode == "buddhabrot" || mode == "antibuddhabrot") {
+        return render_buddhabrot(mode == "antibuddhabrot");
+    } else if(mode == "lyapunov") {
+        return render_lyapunov();
+    } else if(mode == "dimension") {
+        return render_dimension();
+    } else if(mode == "area") {
+        return render_area();
+    } else if(mode == "distance") {
+        return render_distance();
+    } else if(mode == "atlas") {
+        return render_atlas();
+    } else if(mode == "diagnose") {
+        return render_diagnosed();
+    } else if(mode == "replay") {
+        return replay_events();
+    } else if(mode == "serve") {
+        return serve_tiles();
+    } else if(mode == "load") {
+        return run_load_generator();
+    } else if(mode == "stream") {
+        return serve_frames();
+    } else if(mode == "coordinate") {
+        return coordinate_render();
+    } else if(mode == "worker") {
+        return run_worker();
+    } else if(!mode.empty()) {
+        std::cerr << "Unknown mode " << mode << endl;
+        return show_usage(argv[0]);
+    }
+
+    if(!call_back_funcs::henon.get_output_file().empty()) {
+        if(call_back_funcs::henon.get_frames() > 1 || !call_back_funcs::henon.get_keyframe_file().empty()) {
+            return render_animation();
+        }
+        return render_headless();
+    }
+
+    //The shaders only cover the original two formulas
+    if(call_back_funcs::henon.get_fractal_type() != fractal_t::henon
+        && call_back_funcs::henon.get_fractal_type() != fractal_t::mandelbrot) {
+        std::cerr << call_back_funcs::henon.get_fractal_name() << " can only be rendered to a file, use -o" << endl;
+        return -1;
+    }
+
+    if(!call_back_funcs::henon.get_event_file().empty()) {
+        try {
+            call_back_funcs::recorder = std::make_unique<ra::fractal_logic::event_recorder>(call_back_funcs::henon.get_event_file());
+        } catch(std::exception& e) {
+            std::cerr << e.what() << endl;
+            return -1;
+        }
+    }
+
     glutInit(&argc,argv);
 
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);